@@ -0,0 +1,558 @@
+/*
+    IIPImage Server - Request admission control
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include "AdmissionControl.h"
+#include "Tokenizer.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <map>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#endif
+
+
+using namespace std;
+
+
+// Identifier for our shared state file
+static const char state_magic[8] = { 'I','I','P','A','D','M','2','\0' };
+
+// Polling interval in milliseconds while waiting for a slot
+static const unsigned int poll_interval = 2;
+
+const unsigned int AdmissionControl::MAX_SLOTS;
+const unsigned int AdmissionControl::MAX_RESERVATIONS;
+const unsigned int AdmissionControl::THUMBNAIL_SIZE;
+const unsigned int AdmissionControl::MAX_TILE_SIZE;
+
+static const char* class_names[AdmissionControl::NUM_CLASSES] = { "tile", "info", "thumbnail", "export" };
+
+
+
+/// Current monotonic time in milliseconds
+static int64_t now_ms()
+{
+#ifndef WIN32
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+  return 0;
+#endif
+}
+
+
+
+/// Identifier of the current system boot or an empty string if unavailable
+static void bootId( char* id, size_t length )
+{
+  memset( id, 0, length );
+#ifdef __linux__
+  int fd = open( "/proc/sys/kernel/random/boot_id", O_RDONLY );
+  if( fd < 0 ) return;
+  ssize_t n = read( fd, id, length - 1 );
+  if( n < 0 ) memset( id, 0, length );
+  close( fd );
+#endif
+}
+
+
+
+/// Atomic operations on our shared state. Admission control is only available on POSIX systems
+static inline bool cas( int32_t* p, int32_t o, int32_t n )
+{
+#ifndef WIN32
+  return __sync_bool_compare_and_swap( p, o, n );
+#else
+  return false;
+#endif
+}
+
+static inline bool cas( int64_t* p, int64_t o, int64_t n )
+{
+#ifndef WIN32
+  return __sync_bool_compare_and_swap( p, o, n );
+#else
+  return false;
+#endif
+}
+
+static inline int64_t load( int64_t* p )
+{
+#ifndef WIN32
+  return __atomic_load_n( p, __ATOMIC_RELAXED );
+#else
+  return *p;
+#endif
+}
+
+static inline void store( int64_t* p, int64_t v )
+{
+#ifndef WIN32
+  __atomic_store_n( p, v, __ATOMIC_RELAXED );
+#else
+  *p = v;
+#endif
+}
+
+
+
+/// Parse a comma-delimited list of name:value pairs
+static map<string,unsigned int> parseList( const string& list )
+{
+  map<string,unsigned int> values;
+  Tokenizer izer( list, "," );
+  while( izer.hasMoreTokens() ){
+    string token = izer.nextToken();
+    size_t n = token.find( ':' );
+    if( n == string::npos ) continue;
+    string name = token.substr( 0, n );
+    transform( name.begin(), name.end(), name.begin(), ::tolower );
+    int value = atoi( token.substr( n+1 ).c_str() );
+    values[name] = (value > 0) ? value : 0;
+  }
+  return values;
+}
+
+
+
+/// Largest dimension of an IIIF size parameter or 0 if the size is not limited
+static unsigned int iiifSize( string size )
+{
+  if( !size.empty() && size[0] == '^' ) size.erase( 0, 1 );
+  if( !size.empty() && size[0] == '!' ) size.erase( 0, 1 );
+  size_t n = size.find( ',' );
+  if( n == string::npos || size.compare( 0, 4, "pct:" ) == 0 ) return 0;
+  unsigned int w = atoi( size.substr( 0, n ).c_str() );
+  unsigned int h = atoi( size.substr( n+1 ).c_str() );
+  return std::max( w, h );
+}
+
+
+
+AdmissionControl::AdmissionControl( const string& path, const string& limits, const string& budgets,
+				    unsigned int retry, unsigned int memory ) :
+  _state( NULL ), _total_limit( 0 ), _retry_after( retry ), _memory_budget( (int64_t) memory * 1048576 ),
+  _held_class( -1 ), _held_slot( -1 ), _held_total( -1 ), _held_reservation( -1 ),
+  _latency_target( 0 ), _latency( 0.0 ), _latency_breached( false ), _pid( 0 )
+{
+  // Default budgets give interactive requests time to find a slot, while exports are shed quickly
+  static const unsigned int default_budgets[NUM_CLASSES] = { 1000, 1000, 2000, 200 };
+
+  map<string,unsigned int> l = parseList( limits );
+  map<string,unsigned int> b = parseList( budgets );
+
+  for( int c = 0; c < NUM_CLASSES; c++ ){
+    _limits[c] = l.count( class_names[c] ) ? std::min( l[class_names[c]], MAX_SLOTS ) : 0;
+    _budgets[c] = b.count( class_names[c] ) ? b[class_names[c]] : default_budgets[c];
+  }
+  if( l.count( "total" ) ) _total_limit = std::min( l["total"], MAX_SLOTS );
+
+#ifndef WIN32
+  if( path.empty() ) return;
+
+  int fd = open( path.c_str(), O_RDWR | O_CREAT, 0644 );
+  if( fd < 0 ) return;
+
+  // Extend our file if necessary - new regions are zero filled, which marks all slots as free
+  struct stat sb;
+  if( fstat( fd, &sb ) != 0 || ( (size_t) sb.st_size < sizeof(SharedState) && ftruncate( fd, sizeof(SharedState) ) != 0 ) ){
+    close( fd );
+    return;
+  }
+
+  void *m = mmap( NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  if( m == MAP_FAILED ){
+    close( fd );
+    return;
+  }
+
+  _state = (SharedState*) m;
+  _pid = (int32_t) getpid();
+
+  // Our state persists across restarts of the system, after which its process IDs and monotonic
+  // time stamps are meaningless. Start afresh for a new file, a new layout or a new system boot
+  char boot[sizeof(_state->boot)];
+  bootId( boot, sizeof(boot) );
+
+  flock( fd, LOCK_EX );
+  if( memcmp( _state->magic, state_magic, sizeof(state_magic) ) != 0 ||
+      memcmp( _state->boot, boot, sizeof(boot) ) != 0 ){
+    memset( _state, 0, sizeof(SharedState) );
+    memcpy( _state->magic, state_magic, sizeof(state_magic) );
+    memcpy( _state->boot, boot, sizeof(boot) );
+  }
+  flock( fd, LOCK_UN );
+  close( fd );
+
+  // Release anything held by processes which no longer exist and any waiting marks which cannot be
+  // valid, such as those left by a system without a boot identifier
+  int64_t now = now_ms();
+  for( int c = 0; c < NUM_CLASSES; c++ ){
+    int64_t mark = load( &_state->waiting[c] );
+    if( mark > now + 2*poll_interval ) cas( &_state->waiting[c], mark, 0 );
+    reclaim( _state->slots[c], MAX_SLOTS );
+  }
+  reclaim( _state->total, MAX_SLOTS );
+  reclaimReservations();
+#endif
+}
+
+
+
+AdmissionControl::~AdmissionControl()
+{
+  release();
+#ifndef WIN32
+  if( _state ) munmap( _state, sizeof(SharedState) );
+#endif
+  _state = NULL;
+}
+
+
+
+AdmissionControl::RequestClass AdmissionControl::classify( const string& request )
+{
+  // Commands are case insensitive
+  map<string,string> commands;
+  Tokenizer izer( request, "&" );
+  while( izer.hasMoreTokens() ){
+    string token = izer.nextToken();
+    size_t n = token.find( '=' );
+    if( n == string::npos ) continue;
+    string command = token.substr( 0, n );
+    transform( command.begin(), command.end(), command.begin(), ::tolower );
+    commands[command] = token.substr( n+1 );
+  }
+
+  if( commands.count( "jtl" ) || commands.count( "ptl" ) || commands.count( "wtl" ) ||
+      commands.count( "til" ) || commands.count( "jtls" ) ) return TILE;
+
+  if( commands.count( "deepzoom" ) ){
+    const string& a = commands["deepzoom"];
+    return ( a.length() > 4 && a.compare( a.length()-4, 4, ".dzi" ) == 0 ) ? INFO : TILE;
+  }
+
+  if( commands.count( "zoomify" ) ){
+    const string& a = commands["zoomify"];
+    return ( a.length() > 4 && a.compare( a.length()-4, 4, ".xml" ) == 0 ) ? INFO : TILE;
+  }
+
+  if( commands.count( "iiif" ) ){
+    // IIIF image requests are of the form identifier/region/size/rotation/quality.format
+    vector<string> segments;
+    Tokenizer path( commands["iiif"], "/" );
+    while( path.hasMoreTokens() ) segments.push_back( path.nextToken() );
+    size_t n = segments.size();
+    if( n < 5 || segments[n-1].find( '.' ) == string::npos || segments[n-1] == "info.json" ) return INFO;
+
+    const string& region = segments[n-4];
+    unsigned int size = iiifSize( segments[n-3] );
+    if( region != "full" && region != "square" && region.compare( 0, 4, "pct:" ) != 0 ){
+      return ( size > 0 && size <= MAX_TILE_SIZE ) ? TILE : EXPORT;
+    }
+    return ( size > 0 && size <= THUMBNAIL_SIZE ) ? THUMBNAIL : EXPORT;
+  }
+
+  // Contact sheets decode many images, unless only their layout is requested
+  if( commands.count( "sheet" ) ){
+    const string& a = commands["sheet"];
+    return ( a.compare( 0, 5, "json:" ) == 0 ) ? INFO : EXPORT;
+  }
+
+  if( commands.count( "cvt" ) ){
+    unsigned int size = 0;
+    if( commands.count( "wid" ) ) size = atoi( commands["wid"].c_str() );
+    if( commands.count( "hei" ) ) size = std::max( size, (unsigned int) atoi( commands["hei"].c_str() ) );
+    return ( size > 0 && size <= THUMBNAIL_SIZE ) ? THUMBNAIL : EXPORT;
+  }
+
+  // Everything else consists of lightweight metadata requests
+  return INFO;
+}
+
+
+
+const char* AdmissionControl::className( RequestClass c )
+{
+  return ( c < NUM_CLASSES ) ? class_names[c] : "unknown";
+}
+
+
+
+int AdmissionControl::take( int32_t* slots, unsigned int limit )
+{
+  for( unsigned int i = 0; i < limit; i++ ){
+    if( slots[i] == 0 && cas( &slots[i], 0, _pid ) ) return i;
+  }
+  return -1;
+}
+
+
+
+void AdmissionControl::reclaim( int32_t* slots, unsigned int limit )
+{
+#ifndef WIN32
+  for( unsigned int i = 0; i < limit; i++ ){
+    int32_t pid = slots[i];
+    if( pid == 0 ) continue;
+    // We hold no slots while being admitted, so any slot marked with our own ID is also stale
+    if( pid == _pid || ( kill( pid, 0 ) == -1 && errno == ESRCH ) ){
+      cas( &slots[i], pid, 0 );
+    }
+  }
+#endif
+}
+
+
+
+void AdmissionControl::reclaimReservations()
+{
+#ifndef WIN32
+  for( unsigned int i = 0; i < MAX_RESERVATIONS; i++ ){
+    int32_t pid = _state->reservers[i];
+    if( pid == 0 ) continue;
+    if( pid != _pid && kill( pid, 0 ) == -1 && errno == ESRCH ){
+      int64_t bytes = load( &_state->reservations[i] );
+      if( cas( &_state->reservers[i], pid, 0 ) ) __sync_fetch_and_sub( &_state->reserved, bytes );
+    }
+  }
+#endif
+}
+
+
+
+int64_t AdmissionControl::waitingUntil( RequestClass c, int64_t now )
+{
+  // Marks are never set further ahead than twice our polling interval, so any later mark is stale
+  int64_t mark = load( &_state->waiting[c] );
+  return ( mark > now + 2*poll_interval ) ? 0 : mark;
+}
+
+
+
+bool AdmissionControl::higherPriorityWaiting( RequestClass c, int64_t now )
+{
+  for( int k = 0; k < c; k++ ){
+    if( waitingUntil( (RequestClass) k, now ) > now ) return true;
+  }
+  return false;
+}
+
+
+
+bool AdmissionControl::admit( RequestClass c )
+{
+  if( !_state || c >= NUM_CLASSES ) return true;
+
+  // Nothing to do if this class is not limited in any way
+  if( _limits[c] == 0 && _total_limit == 0 ) return true;
+
+  release();
+
+  int64_t now = now_ms();
+  int64_t deadline = now + _budgets[c];
+  bool reclaimed = false;
+
+  while( true ){
+
+    // Only compete for overall slots if no higher priority request is waiting
+    int slot = -1, total = -1;
+    if( _total_limit == 0 || !higherPriorityWaiting( c, now ) ){
+      slot = ( _limits[c] > 0 ) ? take( _state->slots[c], _limits[c] ) : MAX_SLOTS;
+      if( slot >= 0 && _total_limit > 0 ){
+	total = take( _state->total, _total_limit );
+	if( total < 0 ){
+	  if( slot < (int) MAX_SLOTS ) cas( &_state->slots[c][slot], _pid, 0 );
+	  slot = -1;
+	}
+      }
+    }
+
+    if( slot >= 0 ){
+      _held_class = c;
+      _held_slot = ( slot < (int) MAX_SLOTS ) ? slot : -1;
+      _held_total = total;
+      return true;
+    }
+
+    // Before waiting, make sure no slots are held by processes that have since terminated
+    if( !reclaimed ){
+      if( _limits[c] > 0 ) reclaim( _state->slots[c], _limits[c] );
+      if( _total_limit > 0 ) reclaim( _state->total, _total_limit );
+      reclaimed = true;
+      continue;
+    }
+
+    if( now >= deadline ) return false;
+
+    // Signal to lower priority classes that we are waiting. The mark expires by itself, so that
+    // waiting processes which are terminated do not block other classes
+    store( &_state->waiting[c], now + 2*poll_interval );
+
+#ifndef WIN32
+    usleep( poll_interval * 1000 );
+#endif
+    now = now_ms();
+  }
+}
+
+
+
+bool AdmissionControl::reserve( size_t bytes )
+{
+  if( _memory_budget == 0 ) return true;
+
+  // Requests larger than our entire budget can never be satisfied
+  if( (int64_t) bytes > _memory_budget ) return false;
+
+  // Without shared state, each process handles a single request at a time
+  if( !_state ) return true;
+
+  if( _held_reservation >= 0 ) return false;
+
+  // Take a reservation entry. Its size is recorded immediately before each attempt to add it to our
+  // total, so that the bytes of a process terminated once they have been added are always released,
+  // and is cleared while we wait, so that those of a process terminated while waiting are not
+  int entry = take( _state->reservers, MAX_RESERVATIONS );
+  if( entry < 0 ){
+    reclaimReservations();
+    if( (entry = take( _state->reservers, MAX_RESERVATIONS )) < 0 ) return false;
+  }
+  store( &_state->reservations[entry], 0 );
+
+  int64_t now = now_ms();
+  int64_t deadline = now + _budgets[ (_held_class >= 0) ? _held_class : EXPORT ];
+  bool reclaimed = false;
+
+  while( true ){
+
+    int64_t reserved = load( &_state->reserved );
+    if( reserved + (int64_t) bytes <= _memory_budget ){
+      store( &_state->reservations[entry], (int64_t) bytes );
+      if( cas( &_state->reserved, reserved, reserved + (int64_t) bytes ) ){
+	_held_reservation = entry;
+	return true;
+      }
+      continue;
+    }
+    store( &_state->reservations[entry], 0 );
+
+    if( !reclaimed ){
+      reclaimReservations();
+      reclaimed = true;
+      continue;
+    }
+
+    if( now >= deadline ) break;
+
+#ifndef WIN32
+    usleep( poll_interval * 1000 );
+#endif
+    now = now_ms();
+  }
+
+  cas( &_state->reservers[entry], _pid, 0 );
+  return false;
+}
+
+
+
+void AdmissionControl::release()
+{
+  if( !_state ) return;
+  if( _held_reservation >= 0 ){
+    int64_t bytes = load( &_state->reservations[_held_reservation] );
+    if( cas( &_state->reservers[_held_reservation], _pid, 0 ) ){
+#ifndef WIN32
+      __sync_fetch_and_sub( &_state->reserved, bytes );
+#endif
+    }
+    _held_reservation = -1;
+  }
+  if( _held_class >= 0 && _held_slot >= 0 ){
+    cas( &_state->slots[_held_class][_held_slot], _pid, 0 );
+  }
+  if( _held_total >= 0 ){
+    cas( &_state->total[_held_total], _pid, 0 );
+  }
+  _held_class = _held_slot = _held_total = -1;
+}
+
+
+
+void AdmissionControl::recordLatency( unsigned int us )
+{
+  if( _latency_target == 0 ) return;
+
+  // Smooth over roughly the last 10 requests
+  _latency = ( _latency == 0.0 ) ? us : 0.9 * _latency + 0.1 * us;
+
+  if( !_latency_breached && _latency > _latency_target ) _latency_breached = true;
+  else if( _latency_breached && _latency < _latency_target / 2 ) _latency_breached = false;
+}
+
+
+
+bool AdmissionControl::overloaded()
+{
+  if( _latency_target == 0 ) return false;
+  if( _latency_breached ) return true;
+
+  // Check whether any request class has had to queue within the last second
+  if( _state ){
+    int64_t now = now_ms();
+    for( int c = 0; c < NUM_CLASSES; c++ ){
+      if( waitingUntil( (RequestClass) c, now ) > now - 1000 ) return true;
+    }
+  }
+  return false;
+}
+
+
+
+string AdmissionControl::getConfiguration() const
+{
+  ostringstream config;
+  for( int c = 0; c < NUM_CLASSES; c++ ){
+    config << class_names[c] << ": ";
+    if( _limits[c] ) config << _limits[c];
+    else config << "unlimited";
+    config << " (" << _budgets[c] << " ms), ";
+  }
+  config << "total: ";
+  if( _total_limit ) config << _total_limit;
+  else config << "unlimited";
+  if( _memory_budget ) config << ", memory: " << getMemoryBudget() << " MB";
+  return config.str();
+}
@@ -0,0 +1,225 @@
+/*
+    IIPImage Server - Request admission control
+
+    Limits the number of concurrent requests of each class across all iipsrv
+    processes sharing the same state file and sheds excess load.
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _ADMISSIONCONTROL_H
+#define _ADMISSIONCONTROL_H
+
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+
+
+/// Class to provide admission control and prioritisation between classes of request
+/** Requests are classified as tile, info, thumbnail or export requests. Each class has its own
+    limit on the number of requests processed concurrently and a budget for how long a request
+    may wait for a free slot. An overall limit can also be set, in which case waiting requests of
+    higher priority classes (in the order tile, info, thumbnail, export) take precedence over lower
+    priority ones. Requests which cannot be admitted within their budget are rejected, allowing the
+    server to return a 503 Service Unavailable rather than queueing without bound.
+
+    Requests which allocate large buffers, such as region exports, can also reserve their estimated
+    peak memory use from a memory budget before decoding, so that concurrent exports cannot exhaust
+    the memory of the host.
+
+    As iipsrv runs as a pool of single-threaded processes, state is held in a small memory mapped
+    file shared by all processes. Each slot records the process ID of its holder, so that slots held
+    by processes that have terminated are reclaimed.
+ */
+class AdmissionControl {
+
+ public:
+
+  /// Request classes in order of priority
+  enum RequestClass { TILE, INFO, THUMBNAIL, EXPORT, NUM_CLASSES };
+
+  /// Maximum number of slots per class
+  static const unsigned int MAX_SLOTS = 256;
+
+  /// Maximum number of concurrent memory reservations
+  static const unsigned int MAX_RESERVATIONS = 1024;
+
+  /// Maximum output dimension for a region request to be considered a thumbnail
+  static const unsigned int THUMBNAIL_SIZE = 512;
+
+  /// Maximum output dimension of IIIF region requests to be considered tiles
+  static const unsigned int MAX_TILE_SIZE = 1024;
+
+
+ private:
+
+  /// Layout of our shared state
+  struct SharedState {
+    char magic[8];
+    char boot[40];                             ///< Identifier of the system boot in which our state was written
+    int32_t total[MAX_SLOTS];                  ///< Slots for the overall limit
+    int32_t slots[NUM_CLASSES][MAX_SLOTS];     ///< Slots for each class
+    int64_t waiting[NUM_CLASSES];              ///< Time until which a request of each class is known to be waiting
+    int64_t reserved;                          ///< Total memory currently reserved in bytes
+    int32_t reservers[MAX_RESERVATIONS];       ///< Process holding each memory reservation
+    int64_t reservations[MAX_RESERVATIONS];    ///< Size of each memory reservation
+  };
+
+  /// Shared state
+  SharedState *_state;
+
+  /// Concurrency limits for each class and overall limit. Zero means unlimited
+  unsigned int _limits[NUM_CLASSES];
+  unsigned int _total_limit;
+
+  /// Queue-time budgets in milliseconds
+  unsigned int _budgets[NUM_CLASSES];
+
+  /// Retry-After value in seconds
+  unsigned int _retry_after;
+
+  /// Memory budget in bytes. Zero means unlimited
+  int64_t _memory_budget;
+
+  /// Currently held slots
+  int _held_class, _held_slot, _held_total;
+
+  /// Currently held memory reservation
+  int _held_reservation;
+
+  /// Latency target for tile requests in microseconds used to detect overload. Zero disables overload mode
+  unsigned int _latency_target;
+
+  /// Exponentially weighted moving average of tile request times in microseconds
+  double _latency;
+
+  /// Whether our latency target is currently breached
+  bool _latency_breached;
+
+  /// Our process ID
+  int32_t _pid;
+
+
+  /// Try to take a free slot from a set of slots
+  /** @param slots slot array
+      @param limit number of usable slots
+      @return index of slot taken or -1 if none free
+   */
+  int take( int32_t* slots, unsigned int limit );
+
+  /// Release slots held by processes that no longer exist
+  /** @param slots slot array
+      @param limit number of usable slots
+   */
+  void reclaim( int32_t* slots, unsigned int limit );
+
+  /// Release memory reservations held by processes that no longer exist
+  void reclaimReservations();
+
+  /// Time until which a request of a class is known to be waiting, ignoring stale marks
+  /** @param c request class
+      @param now current time in milliseconds
+      @return time in milliseconds or 0 if no valid mark is set
+   */
+  int64_t waitingUntil( RequestClass c, int64_t now );
+
+  /// Whether a higher priority class has requests waiting
+  /** @param c request class
+      @param now current time in milliseconds
+   */
+  bool higherPriorityWaiting( RequestClass c, int64_t now );
+
+
+ public:
+
+  /// Constructor
+  /** @param path shared state file, which is created if it does not exist. Disabled if empty
+      @param limits comma-delimited list of class:limit pairs, eg. "tile:32,export:2,total:40"
+      @param budgets comma-delimited list of class:milliseconds queue-time budgets
+      @param retry value for the Retry-After header in seconds
+      @param memory memory budget in MB shared by all processes or, if no state file is used, for each process
+   */
+  AdmissionControl( const std::string& path, const std::string& limits, const std::string& budgets,
+		    unsigned int retry, unsigned int memory = 0 );
+
+  /// Destructor
+  ~AdmissionControl();
+
+  /// Return whether admission control is active
+  bool isEnabled() const { return _state != NULL; };
+
+  /// Classify a request from its query string
+  /** @param request request string
+      @return request class
+   */
+  static RequestClass classify( const std::string& request );
+
+  /// Return name of request class
+  static const char* className( RequestClass c );
+
+  /// Admit a request, waiting for a free slot up to the budget for its class
+  /** @param c request class
+      @return whether the request was admitted
+   */
+  bool admit( RequestClass c );
+
+  /// Reserve memory for a request from our memory budget
+  /** Waits for memory to be freed by other requests up to the queue-time budget of the class of
+      the current request. The reservation is held until release() is called
+      @param bytes estimated peak memory use of the request
+      @return whether the memory could be reserved
+   */
+  bool reserve( size_t bytes );
+
+  /// Return our memory budget in MB
+  unsigned int getMemoryBudget() const { return (unsigned int)( _memory_budget / 1048576 ); };
+
+  /// Release any slots and memory reservations held by this process
+  void release();
+
+  /// Set the latency target used to detect overload
+  /** @param ms target mean tile request time in milliseconds. Zero disables overload detection */
+  void setLatencyTarget( unsigned int ms ){ _latency_target = ms * 1000; };
+
+  /// Return the latency target in milliseconds
+  unsigned int getLatencyTarget() const { return _latency_target / 1000; };
+
+  /// Record the time taken by a tile request
+  /** @param us request time in microseconds */
+  void recordLatency( unsigned int us );
+
+  /// Whether the server is overloaded
+  /** Overload is signalled when the moving average of tile request times exceeds our latency target,
+      or when requests have recently had to queue for admission. Overload due to latency ends once the
+      average drops below half the target
+      @return whether requests should be served in degraded mode
+   */
+  bool overloaded();
+
+  /// Return the Retry-After value in seconds to send with rejected requests
+  unsigned int getRetryAfter() const { return _retry_after; };
+
+  /// Return a description of our limits and budgets
+  std::string getConfiguration() const;
+
+};
+
+
+#endif
@@ -21,6 +21,7 @@
 #include "Task.h"
 #include "Transforms.h"
 #include "Environment.h"
+#include "AdmissionControl.h"
 #include <cmath>
 #include <algorithm>
 #include <sstream>
@@ -55,10 +56,20 @@ void CVT::send( Session* session ){
 #endif
 #ifdef HAVE_WEBP
   else if( session->view->output_format == ImageEncoding::WEBP ) compressor = session->webp;
+#endif
+#ifdef HAVE_ZLIB
+  else if( session->view->output_format == ImageEncoding::DEFLATE ) compressor = session->tiff;
 #endif
   else return;
 
 
+  // Deflate compressed TIFF output keeps the native bit depth and channels of our image unless processing
+  // has been requested, in which case the usual 8 bit output is produced
+  const bool native = ( session->view->output_format == ImageEncoding::DEFLATE ) && !session->view->floatProcessing()
+    && !session->view->equalization && session->view->colorspace == ColorSpace::NONE
+    && session->view->getRotation() == 0.0 && session->view->flip == 0;
+
+
   // Reload info in case we are dealing with a sequence
   //(*session->image)->loadImageInfo( session->view->xangle, session->view->yangle );
 
@@ -150,6 +161,29 @@ void CVT::send( Session* session ){
   }
 
 
+  // Reserve our estimated peak memory use before decoding: the decoded region, a floating point copy
+  // if float processing is required, and the resampled output together with its encoding buffer
+  if( session->admission ){
+    size_t channels = (*session->image)->getNumChannels();
+    size_t pixels = (size_t) view_width * view_height;
+    size_t bytes = pixels * channels * ( (*session->image)->getNumBitsPerPixel() / 8 );
+    if( (*session->image)->getSampleType() == SampleType::FLOATINGPOINT || session->view->floatProcessing() ){
+      bytes += pixels * channels * sizeof(float);
+    }
+    bytes += (size_t) resampled_width * resampled_height * channels * 2;
+
+    if( !session->admission->reserve( bytes ) ){
+      if( session->loglevel >= 1 ){
+	*(session->logfile) << "CVT :: Unable to reserve " << bytes << " bytes of memory for region" << endl;
+      }
+      throw( 503 );
+    }
+    if( session->loglevel >= 4 ){
+      *(session->logfile) << "CVT :: Reserved " << bytes << " bytes of memory for region" << endl;
+    }
+  }
+
+
 #ifndef DEBUG
 
   // Define our separator depending on the OS
@@ -181,42 +215,25 @@ void CVT::send( Session* session ){
 
   // Set up our TileManager object
   TileManager tilemanager( session->tileCache, *session->image, session->watermark, compressor, session->logfile, session->loglevel );
+  tilemanager.setCancellation( session->cancellation );
 
 
-  // First calculate histogram if we have asked for either binarization,
-  //  histogram equalization or contrast stretching
-  if( session->view->requireHistogram() && (*session->image)->histogram.empty() &&
-      (*session->image)->getColorSpace() != ColorSpace::BINARY ){
-
-    if( session->loglevel >= 5 ) function_timer.start();
-
-    // Retrieve an uncompressed version of our smallest tile
-    // which should be sufficient for calculating the histogram
-    RawTile thumbnail = tilemanager.getTile( 0, 0, 0, session->view->yangle, session->view->getLayers(), ImageEncoding::RAW );
-
-    // Calculate histogram
-    (*session->image)->histogram =
-      session->processor->histogram( thumbnail, (*session->image)->max, (*session->image)->min );
-
-    if( session->loglevel >= 5 ){
-      *(session->logfile) << "CVT :: Calculated histogram in "
-			  << function_timer.getTime() << " microseconds" << endl;
-    }
-
-    // Insert the histogram into our image cache
-    const string key = (*session->image)->getImagePath();
-    imageCacheMapType::iterator i = session->imageCache->find(key);
-    if( i != session->imageCache->end() ) (i->second).histogram = (*session->image)->histogram;
+  // Calculate our image statistics and histogram if we have asked for either binarization, histogram
+  // equalization or contrast stretching or if we need a sample range for floating point data
+  if( session->view->requireHistogram() || (*session->image)->default_range ){
+    this->loadStatistics( tilemanager );
   }
 
 
 
   // Retrieve image region
   if( session->loglevel >= 2 ) function_timer.start();
-  RawTile complete_image = tilemanager.getRegion( requested_res,
-						  session->view->xangle, session->view->yangle,
-						  session->view->getLayers(),
-						  view_left, view_top, view_width, view_height );
+  RawTile complete_image = ( session->view->reduction != REDUCE_NONE ) ?
+    this->reduceStack( tilemanager, requested_res, -1, view_left, view_top, view_width, view_height ) :
+    tilemanager.getRegion( requested_res,
+			   session->view->xangle, session->view->yangle,
+			   session->view->getLayers(),
+			   view_left, view_top, view_width, view_height );
   if( session->loglevel >= 2 ){
     *(session->logfile) << "CVT :: Region decoding time: "
 			<< function_timer.getTime() << " microseconds" << endl;
@@ -235,12 +252,18 @@ void CVT::send( Session* session ){
 
 
   // Only use our floating point image processing pipeline if necessary
-  if( complete_image.sampleType == SampleType::FLOATINGPOINT || session->view->floatProcessing() ){
+  if( ( complete_image.sampleType == SampleType::FLOATINGPOINT && !native ) || session->view->floatProcessing() ){
 
     // Make a copy of our max and min as we may change these
     vector <float> min = (*session->image)->min;
     vector <float> max = (*session->image)->max;
 
+    // Stack reductions have their own range unless one has been given explicitly
+    if( session->view->reduction != REDUCE_NONE && !session->view->minmax ){
+      session->processor->reductionRange( session->view->reduction,
+					  (*session->image)->getHorizontalViewsList().size(), min, max );
+    }
+
     // Change our image max and min if we have asked for a contrast stretch
     if( session->view->contrast == -1 ){
 
@@ -271,6 +294,17 @@ void CVT::send( Session* session ){
     }
 
 
+    // Drop any bands not used by a color twist so that they are neither normalized nor processed
+    vector< vector<float> > ctw = session->view->ctw;
+    if( ctw.size() && !session->view->shaded ){
+      session->processor->twistBands( complete_image, ctw, min, max );
+      if( session->loglevel >= 5 ){
+	*(session->logfile) << "CVT :: Color twist uses " << complete_image.channels << " band"
+			    << ((complete_image.channels>1)?"s":"") << endl;
+      }
+    }
+
+
     // Apply normalization and perform float conversion
     {
       if( session->loglevel >= 5 ) function_timer.start();
@@ -293,9 +327,9 @@ void CVT::send( Session* session ){
 
 
     // Apply color twist if requested
-    if( session->view->ctw.size() ){
+    if( ctw.size() ){
       if( session->loglevel >= 5 ) function_timer.start();
-      session->processor->twist( complete_image, session->view->ctw );
+      session->processor->twist( complete_image, ctw );
       if( session->loglevel >= 5 ){
 	*(session->logfile) << "CVT :: Applying color twist in " << function_timer.getTime() << " microseconds" << endl;
       }
@@ -366,7 +400,7 @@ void CVT::send( Session* session ){
   }
 
   // If no image processing is being done, but we have a 32 or 16 bit fixed point image, do a fast rescale to 8 bit
-  else if( complete_image.bpc > 8 ){
+  else if( complete_image.bpc > 8 && !native ){
     if( session->loglevel >= 5 ){
       *(session->logfile) << "CVT :: Scaling from " << complete_image.bpc << " to 8 bits per channel in ";
       function_timer.start();
@@ -383,7 +417,11 @@ void CVT::send( Session* session ){
     string interpolation_type;
     if( session->loglevel >= 5 ) function_timer.start();
 
-    unsigned int interpolation = Environment::getInterpolation();
+    // Bilinear interpolation is only available for 8 bit data. Also keep bilevel images bilevel for PNG output,
+    // which can then be encoded at 1 bit per pixel
+    unsigned int interpolation = ( complete_image.bpc > 8 ||
+				   ( (*session->image)->getColorSpace() == ColorSpace::BINARY &&
+				     session->view->output_format == ImageEncoding::PNG ) ) ? 0 : Environment::getInterpolation();
     switch( interpolation ){
      case 0:
       interpolation_type = "nearest neighbour";
@@ -513,6 +551,9 @@ void CVT::send( Session* session ){
     }
   }
 
+  // Load any ICC profile and XMP metadata on demand
+  loadMetadata();
+
   // Set ICC profile if of a reasonable size
   if( session->view->embedICC() && ((*session->image)->getMetadata("icc").size()>0) ){
     if( (*session->image)->getMetadata("icc").size() < 65536 ){
@@ -540,6 +581,41 @@ void CVT::send( Session* session ){
   }
 
 
+  // No need to compress anything if our client has already gone away
+  if( session->cancellation ) session->cancellation->check();
+
+
+  // Deflate compressed TIFF images consist of a single strip, so compress our entire region in one go
+  if( session->view->output_format == ImageEncoding::DEFLATE ){
+
+    if( session->loglevel >= 5 ) function_timer.start();
+    len = compressor->Compress( complete_image );
+    if( session->loglevel >= 5 ){
+      *(session->logfile) << "CVT :: Deflate compressed TIFF of " << len << " bytes in "
+			  << function_timer.getTime() << " microseconds" << endl;
+    }
+
+    if( session->out->putStr( (const char*) complete_image.data, len ) != len ){
+      if( session->loglevel >= 1 ){
+	*(session->logfile) << "CVT :: Error writing output" << endl;
+      }
+    }
+
+    if( session->out->flush() == -1 ) {
+      if( session->loglevel >= 1 ){
+	*(session->logfile) << "CVT :: Error flushing output" << endl;
+      }
+    }
+
+    session->response->setImageSent();
+
+    if( session->loglevel >= 2 ){
+      *(session->logfile) << "CVT :: Total command time " << command_timer.getTime() << " microseconds" << endl;
+    }
+    return;
+  }
+
+
   // Initialise our output compression object
   compressor->InitCompression( complete_image, resampled_height );
 
@@ -571,6 +647,9 @@ void CVT::send( Session* session ){
 
   for( int n=0; n<strips; n++ ){
 
+    // Stop sending strips if our client has gone away
+    if( session->cancellation && session->cancellation->isCancelled() ) break;
+
     // Get the starting index for this strip of data
     unsigned char* input = &((unsigned char*)complete_image.data)[n*strip_height*resampled_width*channels];
 
@@ -607,6 +686,16 @@ void CVT::send( Session* session ){
   // Finish off the image compression
   len = compressor->Finish( output );
 
+  // Abandon the request if our client disconnected during compression. Compression must
+  // nevertheless be finished in order to release the resources held by the compressor
+  if( session->cancellation && session->cancellation->isCancelled() ){
+    delete[] output;
+    if( session->loglevel >= 2 ){
+      *(session->logfile) << "CVT :: Client disconnected: abandoning output" << endl;
+    }
+    throw( (int) CLIENT_DISCONNECTED );
+  }
+
   if( session->out->putStr( (const char*) output, len ) != len ){
     if( session->loglevel >= 1 ){
       *(session->logfile) << "CVT :: Error writing output" << endl;
@@ -131,6 +131,20 @@ class Cache {
   TileMap tileMap;
 
 
+  /// Data shared between tiles with identical content and the number of tiles referring to it
+  struct Content {
+    RawTile tile;
+    unsigned int references;
+    Content() : references( 0 ) {};
+  };
+
+  /// Content-addressed storage of shared tile data
+  HASHMAP < std::string, Content > contentMap;
+
+  /// Content keys of those tiles whose data is held in our shared storage
+  HASHMAP < std::string, std::string > contentKeys;
+
+
   /// Internal touch function
   /** Touches a key in the Cache and makes it the most recently used
    *  @param key to be touched
@@ -151,15 +165,37 @@ class Cache {
    *  @warning miter is no longer usable after being passed to this function.
    */
   void _remove( const TileMap::iterator &miter ) {
-    // Reduce our current size counter
-    currentSize -= ( (miter->second->second).dataLength +
-		     ( (miter->second->second).filename.capacity() + (miter->second->first).capacity() )*sizeof(char) +
-		     tileSize );
+    // Reduce our current size counter. Shared data is only accounted for once
+    HASHMAP < std::string, std::string >::iterator citer = contentKeys.find( miter->first );
+    if( citer != contentKeys.end() ){
+      currentSize -= ( (miter->second->first).capacity()*sizeof(char) + tileSize );
+      this->_release( citer->second );
+      contentKeys.erase( citer );
+    }
+    else{
+      currentSize -= ( (miter->second->second).dataLength +
+		       (miter->second->first).capacity()*sizeof(char) +
+		       tileSize );
+    }
     tileList.erase( miter->second );
     tileMap.erase( miter );
   }
 
 
+  /// Internal release function for shared data
+  /** Removes the shared data once no tile refers to it any longer
+   *  @param c content key
+   */
+  void _release( const std::string &c ) {
+    HASHMAP < std::string, Content >::iterator citer = contentMap.find( c );
+    if( citer == contentMap.end() ) return;
+    if( --(citer->second.references) == 0 ){
+      currentSize -= ( citer->second.tile.dataLength + (citer->first).capacity()*sizeof(char) + tileSize );
+      contentMap.erase( citer );
+    }
+  }
+
+
   /// Interal remove function
   /** @param key to remove */
   void _remove( const std::string &key ) {
@@ -175,9 +211,9 @@ class Cache {
   /** @param max Maximum cache size in MB */
   Cache( const float max ) {
     maxSize = (unsigned long)(max*1024000) ; currentSize = 0;
-    // 64 chars added at the end represents an average string length
+    // 32 chars added at the end represents an average key length
     tileSize = sizeof( RawTile ) + sizeof( std::pair<const std::string,RawTile> ) +
-      sizeof( std::pair<const std::string, List_Iter> ) + sizeof(char)*64 + sizeof(List_Iter);
+      sizeof( std::pair<const std::string, List_Iter> ) + sizeof(char)*32 + sizeof(List_Iter);
   };
 
 
@@ -191,18 +227,25 @@ class Cache {
   void clear() {
     tileList.clear();
     tileMap.clear();
+    contentKeys.clear();
+    contentMap.clear();
     currentSize = 0;
   }
 
 
   /// Insert a tile
-  /** @param r Tile to be inserted */
-  void insert( const RawTile& r ) {
+  /** Tiles inserted with the same content key share a single copy of their data, which is only accounted
+      for once. The caller guarantees that tiles with the same content key have identical data.
+      @param r Tile to be inserted
+      @param p processing key for tiles to which image processing has been applied
+      @param c content key or an empty string if the tile data is not to be shared
+   */
+  void insert( const RawTile& r, const std::string& p = std::string(), const std::string& c = std::string() ) {
 
     if( maxSize == 0 ) return;
 
-    std::string key = this->getIndex( r.filename, r.resolution, r.tileNum,
-				      r.hSequence, r.vSequence, r.compressionType, r.quality );
+    std::string key = this->getIndex( r.imageId, r.resolution, r.tileNum,
+				      r.hSequence, r.vSequence, r.compressionType, r.quality, p );
 
     // Touch the key, if it exists
     TileMap::iterator miter = this->_touch( key );
@@ -217,18 +260,51 @@ class Cache {
       else return;
     }
 
-    // Store the key if it doesn't already exist in our cache
-    // Ok, do the actual insert at the head of the list
-    tileList.push_front( std::make_pair(key,r) );
+    List_Iter liter;
 
-    // And store this in our map
-    List_Iter liter = tileList.begin();
-    tileMap[ key ] = liter;
+    // Tiles with shared data refer to a single copy held in our content storage
+    if( !c.empty() && r.data && r.dataLength > 0 ){
 
-    // Update our total current size variable. Use the string::capacity function
-    // rather than length() as std::string can allocate slightly more than necessary
-    // The +1 is for the terminating null byte
-    currentSize += (r.dataLength + (r.filename.capacity()+key.capacity())*sizeof(char) + tileSize);
+      HASHMAP < std::string, Content >::iterator citer = contentMap.find( c );
+      if( citer == contentMap.end() ){
+	citer = contentMap.insert( std::make_pair( c, Content() ) ).first;
+	citer->second.tile = r;
+	currentSize += (r.dataLength + c.capacity()*sizeof(char) + tileSize);
+      }
+      citer->second.references++;
+
+      // Insert a copy of our tile without its data and point it at the shared data
+      RawTile shared( r.tileNum, r.resolution, r.hSequence, r.vSequence, r.width, r.height, r.channels, r.bpc );
+      shared.imageId = r.imageId;
+      shared.sampleType = r.sampleType;
+      shared.compressionType = r.compressionType;
+      shared.quality = r.quality;
+      shared.ycbcr = r.ycbcr;
+      shared.timestamp = r.timestamp;
+      tileList.push_front( std::make_pair(key,shared) );
+
+      liter = tileList.begin();
+      liter->second.data = citer->second.tile.data;
+      liter->second.dataLength = citer->second.tile.dataLength;
+      liter->second.memoryManaged = 0;
+      contentKeys[ key ] = c;
+      tileMap[ key ] = liter;
+
+      currentSize += (key.capacity()*sizeof(char) + tileSize);
+    }
+    else{
+      // Store the key if it doesn't already exist in our cache
+      // Ok, do the actual insert at the head of the list
+      tileList.push_front( std::make_pair(key,r) );
+
+      // And store this in our map
+      liter = tileList.begin();
+      tileMap[ key ] = liter;
+
+      // Update our total current size variable. Use the string::capacity function
+      // rather than length() as std::string can allocate slightly more than necessary
+      currentSize += (r.dataLength + key.capacity()*sizeof(char) + tileSize);
+    }
 
     // Check to see if we need to remove an element due to exceeding max_size
     while( currentSize > maxSize ) {
@@ -245,26 +321,32 @@ class Cache {
   unsigned int getNumElements() const { return tileList.size(); }
 
 
+  /// Return the number of distinct blocks of shared tile data
+  unsigned int getNumShared() const { return contentMap.size(); }
+
+
   /// Return the number of MB stored
   float getMemorySize() const { return (float) ( currentSize / 1024000.0 ); }
 
 
   /// Get a tile from the cache
   /** 
-   *  @param f filename
+   *  @param i image identifier
    *  @param r resolution number
    *  @param t tile number
    *  @param h horizontal sequence number
    *  @param v vertical sequence number
    *  @param c compression type
    *  @param q compression quality
+   *  @param p processing key for processed tiles
    *  @return pointer to data or NULL on error
    */
-  RawTile* getTile( const std::string& f, int r, int t, int h, int v, ImageEncoding c, int q ) {
+  RawTile* getTile( uint32_t i, int r, int t, int h, int v, ImageEncoding c, int q,
+		    const std::string& p = std::string() ) {
 
     if( maxSize == 0 ) return NULL;
 
-    std::string key = this->getIndex( f, r, t, h, v, c, q );
+    std::string key = this->getIndex( i, r, t, h, v, c, q, p );
 
     TileMap::iterator miter = tileMap.find( key );
     if( miter == tileMap.end() ) return NULL;
@@ -274,21 +356,59 @@ class Cache {
   }
 
 
+  /// Get shared tile data by its content key
+  /**
+   *  @param c content key
+   *  @return pointer to a tile holding the shared data or NULL if none exists
+   */
+  const RawTile* getContent( const std::string& c ) const {
+    HASHMAP < std::string, Content >::const_iterator citer = contentMap.find( c );
+    if( citer == contentMap.end() ) return NULL;
+    return &(citer->second.tile);
+  }
+
+
   /// Create a hash index
-  /** 
-   *  @param f filename
+  /** Indices refer to the image by its interned identifier, which keeps them short
+   *  @param i image identifier
+   *  @param r resolution number
+   *  @param t tile number
+   *  @param h horizontal sequence number
+   *  @param v vertical sequence number
+   *  @param c ImageEncoding type
+   *  @param q compression quality
+   *  @param p processing key, which is appended to the index if not empty
+   *  @return string
+   */
+  std::string getIndex( uint32_t i, int r, int t, int h, int v, ImageEncoding c, int q,
+			const std::string& p = std::string() ) const {
+    char tmp[96];
+    snprintf( tmp, 96, "%u:%d:%d:%d:%d:%d:%d", i, r, t, h, v, (int)c, q );
+    std::string index( tmp );
+    if( !p.empty() ) index += ":" + p;
+    return index;
+  }
+
+
+  /// Create an index for tiles shared between processes
+  /** Image identifiers are local to each process, so shared indices use the image path
+   *  @param f image path
    *  @param r resolution number
    *  @param t tile number
    *  @param h horizontal sequence number
    *  @param v vertical sequence number
    *  @param c ImageEncoding type
    *  @param q compression quality
+   *  @param p processing key, which is appended to the index if not empty
    *  @return string
    */
-  std::string getIndex( const std::string& f, int r, int t, int h, int v, ImageEncoding c, int q ) const {
-    char tmp[1024];
-    snprintf( tmp, 1024, "%s:%d:%d:%d:%d:%d:%d", f.c_str(), r, t, h, v, (int)c, q );
-    return std::string( tmp );
+  static std::string getSharedIndex( const std::string& f, int r, int t, int h, int v, ImageEncoding c, int q,
+				     const std::string& p = std::string() ) {
+    char tmp[96];
+    snprintf( tmp, 96, ":%d:%d:%d:%d:%d:%d", r, t, h, v, (int)c, q );
+    std::string index = f + tmp;
+    if( !p.empty() ) index += ":" + p;
+    return index;
   }
 
 
@@ -0,0 +1,112 @@
+/*
+    IIPImage Server - Per-request cancellation token
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CANCELLATION_H
+#define _CANCELLATION_H
+
+
+#ifndef WIN32
+#include <poll.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+
+/// HTTP-like status code thrown when a request has been abandoned by the client
+#define CLIENT_DISCONNECTED 499
+
+
+
+/// Cancellation token tracking whether the client of the current request has gone away
+/** A request is cancelled either explicitly, for example when writing to the client fails, or when the
+    connection to the web server is found to have been closed.
+    Long running tasks should call check() between units of work, such as between tiles or strips, so that
+    no further effort is wasted on a request whose response will never be read.
+ */
+class Cancellation {
+
+ private:
+
+  /// FastCGI connection to the web server. Negative if unavailable
+  int fd;
+
+  /// Whether the request has been cancelled
+  bool cancelled;
+
+
+  /// Check our connection for a socket closed by the web server
+  /** The FastCGI library may already have read part of a record into its own buffer, so the pending
+      data cannot be assumed to begin at a record boundary and is not interpreted
+   */
+  bool poll_connection(){
+#ifndef WIN32
+    if( fd < 0 ) return false;
+
+    struct pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+#ifdef POLLRDHUP
+    p.events |= POLLRDHUP;
+#endif
+    p.revents = 0;
+    if( ::poll( &p, 1, 0 ) <= 0 ) return false;
+    if( p.revents & (POLLERR|POLLHUP|POLLNVAL) ) return true;
+#ifdef POLLRDHUP
+    if( p.revents & POLLRDHUP ) return true;
+#endif
+    if( !(p.revents & POLLIN) ) return false;
+
+    // Peek without consuming any data, so that the FastCGI library still sees it. Only the end of
+    // the stream indicates that the web server has closed our connection
+    unsigned char buf[1];
+    ssize_t n = recv( fd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT );
+    if( n == 0 ) return true;
+    if( n < 0 ) return ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR );
+#endif
+    return false;
+  };
+
+
+ public:
+
+  /// Constructor
+  /** @param f file descriptor of the connection to the web server or -1 if none */
+  Cancellation( int f = -1 ) : fd( f ), cancelled( false ) {};
+
+  /// Mark the request as cancelled
+  void cancel(){ cancelled = true; };
+
+  /// Return whether the request has been cancelled, checking our connection if not yet known
+  bool isCancelled(){
+    if( !cancelled && poll_connection() ) cancelled = true;
+    return cancelled;
+  };
+
+  /// Throw CLIENT_DISCONNECTED if the request has been cancelled
+  void check(){
+    if( isCancelled() ) throw( (int) CLIENT_DISCONNECTED );
+  };
+
+};
+
+
+#endif
@@ -104,6 +104,22 @@ class Compressor {
   inline void setXMPMetadata( const std::string& x ){ xmp = x; }
 
 
+  /// Get the physical output resolution
+  /** @param x horizontal resolution
+      @param y vertical resolution
+      @param units resolution units
+   */
+  inline void getResolution( float& x, float& y, int& units ) const { x = dpi_x; y = dpi_y; units = dpi_units; };
+
+
+  /// Get the ICC profile
+  inline const std::string& getICCProfile() const { return icc; }
+
+
+  /// Get XMP metadata
+  inline const std::string& getXMPMetadata() const { return xmp; }
+
+
   /// Return the image header size
   /** @return header size in bytes */
   virtual unsigned int getHeaderSize() const { return 0; };
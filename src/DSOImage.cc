@@ -1,7 +1,6 @@
-
 /*  DSO module loader for external image types
 
-    Copyright (C) 2000-2012 Ruven Pillay.
+    Copyright (C) 2000-2026 Ruven Pillay.
 
     This program is free software; you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -22,259 +21,381 @@
 #ifdef ENABLE_DL
 
 #include "DSOImage.h"
+#include "Tokenizer.h"
 
 #include <dlfcn.h>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
 
 
 using namespace std;
- 
-    
-// Typedefs for typecasting our loaded module functions
-//  - there's probably a more elegant way to do this :/
-
-typedef char* (*tile_func) (int, int, int*, int*, int*);
-typedef void* (*func) (void*);
-
 
 
+// Static registry of loaded decoders
+map <string, const iip_decoder*> DSOImage::decoders;
 
 
 
-void DSOImage::Load( const string& s ) throw (string)
+string DSOImage::loadModule( const string& path )
 {
-  modulePath = s;
-
-  char* error;
-  libHandle = NULL;
-
-  loadLibrary();
+  // Modules remain loaded for the lifetime of the process
+  void *library = dlopen( path.c_str(), RTLD_NOW | RTLD_LOCAL );
+  if( library == NULL ){
+    const char* error = dlerror();
+    throw string( error ? error : "Error in loading module " + path );
+  }
 
+  iip_decoder_entry_func entry = (iip_decoder_entry_func) dlsym( library, IIP_DECODER_ENTRY );
+  if( entry == NULL ){
+    dlclose( library );
+    throw string( "Module " + path + " does not export " IIP_DECODER_ENTRY );
+  }
 
-  // Check for the file extension it handles
+  const iip_decoder *decoder = (*entry)();
+  if( !decoder || decoder->abi_version != IIP_DECODER_ABI_VERSION ){
+    dlclose( library );
+    ostringstream error;
+    error << "Module " << path << " uses decoder interface version " << (decoder ? decoder->abi_version : 0)
+	  << " rather than " << IIP_DECODER_ABI_VERSION;
+    throw error.str();
+  }
 
-  void *getParameter;
-  getParameter = dlsym( libHandle, "get_file_extension" );  
-  error = dlerror();
-  if( error != 0 ){
-    throw string( error );
+  // Check that mandatory functions are present
+  if( !decoder->open || !decoder->close || !decoder->get_resolution_size || !decoder->get_tile ||
+      !decoder->free_buffer || !decoder->get_error || !decoder->extensions || !decoder->description ||
+      ( (decoder->capabilities & IIP_DECODER_REGION) && !decoder->get_region ) ){
+    dlclose( library );
+    throw string( "Module " + path + " is missing mandatory decoder fields" );
   }
 
-  // This doesn't seem to work! So use typedef casting instead :o
-//   char *ext = static_cast <char *()> (getParameter) ();
+  // Register each file extension handled by this module
+  Tokenizer izer( decoder->extensions, "," );
+  while( izer.hasMoreTokens() ){
+    string extension = izer.nextToken();
+    transform( extension.begin(), extension.end(), extension.begin(), ::tolower );
+    decoders[ extension ] = decoder;
+  }
 
-  func f = (func) getParameter;
+  return string( decoder->description );
+}
 
-  type = (char*) (*f) (NULL);
 
 
-  // Check for the description
+const iip_decoder* DSOImage::getDecoder( const string& extension )
+{
+  string e = extension;
+  transform( e.begin(), e.end(), e.begin(), ::tolower );
+  map <string, const iip_decoder*>::const_iterator i = decoders.find( e );
+  return ( i == decoders.end() ) ? NULL : i->second;
+}
 
-  getParameter = dlsym( libHandle, "get_description" );
-  error = dlerror();
-  if( error != 0 ){
-    throw string( error );
-  }
-  f = (func) getParameter;
-  description = (char*) (*f) (NULL);
 
 
-  unloadLibrary();
+string DSOImage::getError()
+{
+  const char* error = decoder->get_error( handle );
+  return string( "DSOImage :: " ) + ( error ? error : "unknown module error" );
 }
 
 
 
-
-// Unload the library on destruction
-
-DSOImage::~DSOImage()
+void DSOImage::openImage()
 {
-  closeImage();
-  unloadLibrary();
-}
-
+  // Insist that the handle be NULL
+  if( handle ) throw file_error( "DSOImage :: handle is not NULL" );
 
+  string filename = getFileName( currentX, currentY );
 
+  // Update our timestamp
+  updateTimestamp( filename );
 
-void DSOImage::loadLibrary() throw (string)
-{
-  libHandle = dlopen( modulePath.c_str(), RTLD_NOW );
+  // Load our metadata if not already loaded - this also opens our handle
+  if( bpc == 0 ) loadImageInfo( currentX, currentY );
+  else{
+    iip_image_info info;
+    memset( &info, 0, sizeof(info) );
+    if( ( handle = decoder->open( filename.c_str(), &info ) ) == NULL ){
+      throw file_error( getError() + " for " + filename );
+    }
+  }
 
-  if( libHandle == NULL ){
-    char* error = dlerror();
-    if( error != NULL ) throw string( error );
-    else throw string( "Error in loading module " + modulePath );
-  } 
+  isSet = true;
 }
 
 
 
-
-void DSOImage::unloadLibrary() throw (string)
+void DSOImage::loadImageInfo( int seq, int ang )
 {
-  if( libHandle ){
-    dlclose( libHandle );
-    char* error = dlerror();
-    if( error != NULL ) throw string( error );
-    libHandle = NULL;
+  currentX = seq;
+  currentY = ang;
+
+  // Re-query our basic image information
+  iip_image_info info;
+  memset( &info, 0, sizeof(info) );
+  if( handle ) decoder->close( handle );
+  string filename = getFileName( seq, ang );
+  if( ( handle = decoder->open( filename.c_str(), &info ) ) == NULL ){
+    throw file_error( getError() + " for " + filename );
   }
-}
-
 
+  if( info.num_resolutions == 0 || info.tile_width == 0 || info.tile_height == 0 ){
+    throw file_error( "DSOImage :: Module returned invalid image information for " + filename );
+  }
 
+  channels = info.channels;
+  bpc = info.bpc;
+  sampleType = (info.sample_format == IIP_SAMPLE_FLOATINGPOINT) ? SampleType::FLOATINGPOINT : SampleType::FIXEDPOINT;
+  colorspace = (ColorSpace) info.colorspace;
+  dpi_x = info.dpi_x;
+  dpi_y = info.dpi_y;
+  dpi_units = info.dpi_units;
+
+  image_widths.clear();
+  image_heights.clear();
+  tile_widths.clear();
+  tile_heights.clear();
+
+  // Stored resolutions
+  for( uint32_t n = 0; n < info.num_resolutions; n++ ){
+    uint32_t w, h;
+    if( decoder->get_resolution_size( handle, n, &w, &h ) != 0 ) throw file_error( getError() );
+    image_widths.push_back( w );
+    image_heights.push_back( h );
+    tile_widths.push_back( info.tile_width );
+    tile_heights.push_back( info.tile_height );
+  }
 
-// Get the error string from the module
-string DSOImage::getError()
-{
-  void *getParameter;
-  getParameter = dlsym( libHandle, "get_error" );
-  char* error = dlerror();
-  if( error != NULL ){
-    return string( error );
+  // Add virtual resolutions if the module can decode at reduced scales
+  virtual_levels = 0;
+  if( decoder->capabilities & IIP_DECODER_SCALED ){
+    unsigned int w = image_widths.back();
+    unsigned int h = image_heights.back();
+    while( w > info.tile_width || h > info.tile_height ){
+      w = (w+1) / 2;
+      h = (h+1) / 2;
+      image_widths.push_back( w );
+      image_heights.push_back( h );
+      tile_widths.push_back( info.tile_width );
+      tile_heights.push_back( info.tile_height );
+      virtual_levels++;
+    }
   }
-  func g = (func) getParameter;
-  char *result = (char*) (*g) (NULL);
-  return string( result );
-}
 
+  numResolutions = image_widths.size();
+
+  // Set min and max to the full bit range. Modules provide no range for floating point data
+  min.clear();
+  max.clear();
+  default_range = ( sampleType == SampleType::FLOATINGPOINT );
+  for( unsigned int i=0; i<channels; i++ ){
+    float m = 255.0;
+    if( bpc == 16 ) m = 65535.0;
+    else if( bpc == 32 && sampleType == SampleType::FIXEDPOINT ) m = 4294967295.0;
+    else if( bpc == 32 && sampleType == SampleType::FLOATINGPOINT ) m = 1.0;
+    min.push_back( 0.0 );
+    max.push_back( m );
+  }
 
+  // Modules do not provide any additional metadata
+  metadata_loaded = true;
+}
 
 
-// Open the image specified by path and get the image and tile
-//  widths and heights
 
-void DSOImage::openImage() throw (string)
+void DSOImage::closeImage()
 {
-  loadLibrary();
-
-  string path = getFileName( currentX, 90 );
-
-  void *getParameter;
-  getParameter = dlsym( libHandle, "open_image" );
-  char* error = dlerror();
-  if( error != NULL ){
-    throw string( error );
+  if( handle ){
+    decoder->close( handle );
+    handle = NULL;
   }
-  func f = (func) getParameter;
-  int result = (int) (*f) ( (void*) path.c_str() );
-  if( result ) throw getError();
+}
 
 
-  getParameter = dlsym( libHandle, "get_tile_width" );
-  error = dlerror();
-  if( error != NULL ){
-    throw string( error );
-  }
-  f = (func) getParameter;
-  tile_width = (int) (*f) (NULL);
 
+void DSOImage::copyBuffer( iip_buffer& buffer, RawTile& tile )
+{
+  tile.width = buffer.width;
+  tile.height = buffer.height;
+  tile.channels = buffer.channels;
+  tile.bpc = buffer.bpc;
+  tile.sampleType = sampleType;
+  tile.compressionType = (ImageEncoding) buffer.encoding;
+  tile.quality = buffer.quality;
+  tile.imageId = getImageId();
+  tile.timestamp = timestamp;
+
+  // Round up our allocation to a whole number of samples as encoded data may have any length
+  tile.allocate( (buffer.length + 3) & ~((size_t)3) );
+  memcpy( tile.data, buffer.data, buffer.length );
+  tile.dataLength = buffer.length;
+
+  decoder->free_buffer( handle, &buffer );
+}
 
-  getParameter = dlsym( libHandle, "get_tile_width" );
-  error = dlerror();
-  if( error != NULL ){
-    throw string( error );
-  }
-  f = (func) getParameter;
-  tile_height = (int) (*f) (NULL);
 
 
-  getParameter = dlsym( libHandle, "get_image_width" );
-  error = dlerror();
-  if( error != NULL ){
-    throw string( error );
+string DSOImage::checkBuffer( const iip_buffer& buffer, unsigned int width, unsigned int height ) const
+{
+  ostringstream error;
+  if( buffer.encoding != IIP_ENCODING_RAW || buffer.data == NULL ){
+    error << "DSOImage :: Module returned no raw pixel data";
+  }
+  else if( buffer.channels != channels || buffer.bpc != bpc ){
+    error << "DSOImage :: Module returned " << buffer.channels << " channels of " << buffer.bpc
+	  << " bits rather than " << channels << " channels of " << bpc << " bits";
   }
-  f = (func) getParameter;
-  image_widths.push_back( (int) (*f) (NULL) );
+  else if( buffer.width > width || buffer.height > height ){
+    error << "DSOImage :: Module returned a buffer of " << buffer.width << "x" << buffer.height
+	  << " larger than " << width << "x" << height;
+  }
+  else if( buffer.length < (size_t) buffer.width * buffer.height * channels * (bpc/8) ){
+    error << "DSOImage :: Module returned " << buffer.length << " bytes for a buffer of "
+	  << buffer.width << "x" << buffer.height;
+  }
+  return error.str();
+}
+
 
 
-  getParameter = dlsym( libHandle, "get_image_height" );  
-  error = dlerror();
-  if( error != NULL ){
-    throw string( error );
+RawTile DSOImage::getTile( int x, int y, unsigned int res, int layers, unsigned int tile, ImageEncoding e )
+{
+  // Check the resolution exists
+  if( res >= numResolutions ){
+    ostringstream error;
+    error << "DSOImage :: Asked for non-existent resolution: " << res;
+    throw file_error( error.str() );
   }
-  f = (func) getParameter;
-  image_heights.push_back( (int) (*f) (NULL) );
 
+  // If we are currently working on a different sequence number, then reload the image
+  if( !handle || (currentX != x) || (currentY != y) ) loadImageInfo( x, y );
 
-  getParameter = dlsym( libHandle, "get_num_resolutions" );  
-  error = dlerror();
-  if( error != NULL ){
-    throw string( error );
+  // Only ask for pre-encoded tiles if the module supports pass-through
+  uint32_t encoding = IIP_ENCODING_RAW;
+  if( (decoder->capabilities & IIP_DECODER_PASSTHROUGH) && IIPImage::codec_passthrough &&
+      (e == ImageEncoding::JPEG || e == ImageEncoding::PNG || e == ImageEncoding::WEBP) ){
+    encoding = (uint32_t) e;
   }
-  f = (func) getParameter;
-  numResolutions = (int) (*f) (NULL);
 
+  iip_buffer buffer;
+  memset( &buffer, 0, sizeof(buffer) );
+  if( decoder->get_tile( handle, getNativeResolution( res ), tile, layers, encoding, &buffer ) != 0 ){
+    throw file_error( getError() );
+  }
 
+  RawTile rawtile( tile, res, x, y );
+  copyBuffer( buffer, rawtile );
+  return rawtile;
 }
 
 
 
+RawTile DSOImage::getRegion( int ha, int va, unsigned int res, int layers, int x, int y, unsigned int w, unsigned int h )
+{
+  // Check the resolution exists
+  if( res >= numResolutions ){
+    ostringstream error;
+    error << "DSOImage :: Asked for non-existent resolution: " << res;
+    throw file_error( error.str() );
+  }
 
+  if( !handle || (currentX != ha) || (currentY != va) ) loadImageInfo( ha, va );
 
-void DSOImage::closeImage() throw (string)
-{
-  if( libHandle ){
-    
-    void *getParameter;
-    getParameter = dlsym( libHandle, "close_image" );
-    
-    char *error = dlerror();
-    if( error != 0 ){
-      throw string( error );
+  int vipsres = getNativeResolution( res );
+  RawTile region( 0, res, ha, va );
+
+  // Use the module's own region decoding if available
+  if( decoder->capabilities & IIP_DECODER_REGION ){
+    iip_buffer buffer;
+    memset( &buffer, 0, sizeof(buffer) );
+    if( decoder->get_region( handle, vipsres, layers, x, y, w, h, &buffer ) != 0 ){
+      throw file_error( getError() );
+    }
+    string error = checkBuffer( buffer, w, h );
+    if( error.empty() && ( buffer.width != w || buffer.height != h ) ){
+      error = "DSOImage :: Module returned a region of the wrong size";
     }
-    
-    func f = (func) getParameter;
-    int result = (int) (*f) (NULL);
-    if( result ) throw getError();
+    if( !error.empty() ){
+      decoder->free_buffer( handle, &buffer );
+      throw file_error( error );
+    }
+    copyBuffer( buffer, region );
+    return region;
   }
-}
 
+  // Otherwise assemble our region from the tiles covering it - in parallel for thread-safe modules
+  unsigned int tw = tile_widths[vipsres];
+  unsigned int th = tile_heights[vipsres];
+  unsigned int ntlx = (image_widths[vipsres] + tw - 1) / tw;
+  unsigned int startx = x / tw;
+  unsigned int starty = y / th;
+  unsigned int ncols = (x + w - 1) / tw - startx + 1;
+  unsigned int nrows = (y + h - 1) / th - starty + 1;
+  int ntiles = ncols * nrows;
+
+  region.width = w;
+  region.height = h;
+  region.channels = channels;
+  region.bpc = bpc;
+  region.sampleType = sampleType;
+  region.imageId = getImageId();
+  region.timestamp = timestamp;
+  region.allocate();
+  region.dataLength = region.capacity;
+
+  const size_t ps = channels * (bpc/8);
+  const bool threadsafe = decoder->capabilities & IIP_DECODER_THREADSAFE;
+  string error;
+
+#if defined(__ICC) || defined(__INTEL_COMPILER)
+#pragma ivdep
+#elif defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) if( threadsafe )
+#endif
+  for( int n = 0; n < ntiles; n++ ){
+
+    unsigned int tx = startx + (n % ncols);
+    unsigned int ty = starty + (n / ncols);
 
+    iip_buffer buffer;
+    memset( &buffer, 0, sizeof(buffer) );
+    if( decoder->get_tile( handle, vipsres, ty*ntlx + tx, layers, IIP_ENCODING_RAW, &buffer ) != 0 ){
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+      error = getError();
+      continue;
+    }
 
+    // Reject buffers which do not match our image, as they would be copied beyond their end
+    string invalid = checkBuffer( buffer, tw, th );
+    if( !invalid.empty() ){
+      decoder->free_buffer( handle, &buffer );
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+      error = invalid;
+      continue;
+    }
 
+    // Intersection of this tile with our region in image coordinates
+    unsigned int ox = tx * tw, oy = ty * th;
+    unsigned int x0 = std::max( ox, (unsigned int) x ), x1 = std::min( ox + buffer.width, x + w );
+    unsigned int y0 = std::max( oy, (unsigned int) y ), y1 = std::min( oy + buffer.height, y + h );
 
-RawTile DSOImage::getTile( int seq, int angle, unsigned int resolution, int layer, unsigned int tile ) throw (string)
-{
-  // Make sure we are on the correct image
-  if( (currentX != seq) && (currentY != angle) ){
-
-    closeImage();
-    
-    // Get the right file name
-    string path = getFileName( seq, angle );
-    
-    // Open the image again
-    void *getParameter;
-    getParameter = dlsym( libHandle, "open_image" );
-    char* error = dlerror();
-    if( error != NULL ){
-      throw string( error );
+    for( unsigned int j = y0; j < y1 && x1 > x0; j++ ){
+      memcpy( (unsigned char*) region.data + ( (size_t)(j-y)*w + (x0-x) ) * ps,
+	      (unsigned char*) buffer.data + ( (size_t)(j-oy)*buffer.width + (x0-ox) ) * ps,
+	      (x1-x0) * ps );
     }
-    func f = (func) getParameter;
-    int result = (int) (*f) ( (void*) path.c_str() );
-    if( result ) throw getError();
-  }
 
-    
-  void *getParameter;
-  getParameter = dlsym( libHandle, "get_tile" );
-  
-  char *error = dlerror();
-  if( error != 0 ){
-    throw string( error );
+    decoder->free_buffer( handle, &buffer );
   }
 
-  tile_func f = (tile_func) getParameter;
-  int data_len, w, h;
-  unsigned char *data = (unsigned char*) (*f) ( tile, resolution, &w, &h, &data_len );
-  
-  if( !data ) throw getError();
+  if( !error.empty() ) throw file_error( error );
 
-  RawTile rawtile( tile, resolution, seq, angle,
-		   w, h, 3, 8 );
-  rawtile.data = data;
-  rawtile.dataLength = data_len;
-  return rawtile;
-}  
+  return region;
+}
 
 
 #endif
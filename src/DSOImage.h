@@ -1,7 +1,6 @@
-
 /*  IIP fcgi server module
 
-    Copyright (C) 2000-2012 Ruven Pillay.
+    Copyright (C) 2000-2026 Ruven Pillay.
 
     This program is free software; you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -18,7 +17,6 @@
     Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
 */
 
-
 #ifdef ENABLE_DL
 
 #ifndef _DSOIMAGE_H
@@ -26,91 +24,120 @@
 
 
 #include <string>
+#include <map>
 #include "IIPImage.h"
+#include "IIPDecoder.h"
 
 
-/// Class to handle dynamically loaded image codecs: Inherits from IIPImage
-
-
-class DSOImage : public IIPImage{
+/// Class to handle dynamically loaded image decoder modules: Inherits from IIPImage
+/** Modules implement the versioned C interface defined in IIPDecoder.h and are loaded
+    once at startup. Images are matched to modules via their file extension.
+ */
+class DSOImage : public IIPImage {
 
  private:
 
-  /// Path of the module
-  std::string modulePath;
-
-  /// Module description
-  std::string description;
-
-  /// Handle to the module
-  void *libHandle;
+  /// Registry of loaded decoders indexed by file extension
+  static std::map <std::string, const iip_decoder*> decoders;
 
-  /// Overloaded function to load the module
-  void loadLibrary() throw (std::string);
+  /// Decoder used for this image
+  const iip_decoder *decoder;
 
-  /// Overloaded function to unload the module
-  void unloadLibrary() throw (std::string);
+  /// Decoder handle for the currently open image
+  void *handle;
 
   /// Get error messages from the module
   std::string getError();
 
+  /// Convert a module buffer into a RawTile and release the buffer
+  /** @param buffer module buffer
+      @param tile tile to fill
+   */
+  void copyBuffer( iip_buffer& buffer, RawTile& tile );
 
- public:
+  /// Check that a raw module buffer matches our image and holds all of its pixels
+  /** @param buffer module buffer
+      @param width maximum width of the buffer
+      @param height maximum height of the buffer
+      @return empty string if the buffer is valid or a description of the problem
+   */
+  std::string checkBuffer( const iip_buffer& buffer, unsigned int width, unsigned int height ) const;
 
-  /// Constructor
-  DSOImage() : IIPImage() { 
-    libHandle = NULL;
-    tile_width = 0; tile_height = 0;
-    numResolutions = 0;
-  };
+
+ public:
 
   /// Constructor
-  /** \param s image path
+  /** @param image IIPImage object
+      @param d decoder to use
    */
-  DSOImage( const std::string& s ) : IIPImage( s ) { 
-    libHandle = NULL;
-    tile_width = 0; tile_height = 0;
-    numResolutions = 0;
-  };
+  DSOImage( const IIPImage& image, const iip_decoder* d ) : IIPImage( image ), decoder( d ), handle( NULL ) {};
 
   /// Copy Constructor
-  /** \param image IIPImage object
+  /** @param image DSOImage object
    */
-  DSOImage( const IIPImage& image ) : IIPImage( image ) { 
-    libHandle = NULL;
-    tile_width = 0; tile_height = 0;
-    numResolutions = 0;
-  };
+  DSOImage( const DSOImage& image ) : IIPImage( image ), decoder( image.decoder ), handle( NULL ) {};
 
   /// Destructor
-  ~DSOImage();
+  ~DSOImage() { closeImage(); };
 
 
-  /// Return description of the module
-  const std::string getDescription() { return description; };
+  /// Load a decoder module and register the file extensions it handles
+  /** @param path module path
+      @return module description
+   */
+  static std::string loadModule( const std::string& path );
 
-  /// Load the module
-  /** \param p module path
+  /// Get the decoder for a particular file extension
+  /** @param extension file extension (case insensitive)
+      @return decoder or NULL if none has been loaded for this extension
    */
-  void Load( const std::string& p ) throw (std::string);
+  static const iip_decoder* getDecoder( const std::string& extension );
+
 
-  /// Overloaded function to open and read the image
-  void openImage() throw (std::string);
+  /// Return description of the module
+  std::string getDescription() const { return std::string( decoder->description ); };
+
+  /// Overloaded function for opening an image
+  void openImage();
 
-  /// Overloaded function to close the image
-  void closeImage() throw (std::string);
+  /// Overloaded function for loading image information
+  /** @param x horizontal sequence angle
+      @param y vertical sequence angle
+   */
+  void loadImageInfo( int x, int y );
 
+  /// Overloaded function for closing an image
+  void closeImage();
 
-  /// Overloaded function to get a specific tile
-  /** Return a RawTile object: Overloaded by child class.
-      \param h horizontal angle
-      \param v vertical angle
-      \param r resolution
-      \param l quality layers
-      \param t tile number
-  */
-  RawTile getTile( int h, int v, unsigned int r, int l, unsigned int t ) throw(std::string);
+  /// Modules either decode regions directly or allow tiles to be decoded concurrently
+  bool regionDecoding(){
+    return decoder->capabilities & (IIP_DECODER_REGION | IIP_DECODER_THREADSAFE);
+  };
 
+  /// Overloaded function for getting a particular tile
+  /** @param x horizontal sequence angle
+      @param y vertical sequence angle
+      @param r resolution
+      @param l number of quality layers to decode
+      @param t tile number
+      @param e image encoding
+   */
+  RawTile getTile( int x, int y, unsigned int r, int l, unsigned int t, ImageEncoding e = ImageEncoding::RAW );
+
+  /// Overloaded function for returning a region for a given angle and resolution
+  /** Uses the module's own region decoding if available. Otherwise, for thread-safe modules,
+      the tiles covering the region are decoded in parallel.
+      @param ha horizontal angle
+      @param va vertical angle
+      @param r resolution
+      @param l number of quality layers to decode
+      @param x x coordinate
+      @param y y coordinate
+      @param w width of region
+      @param h height of region
+      @return RawTile image
+   */
+  RawTile getRegion( int ha, int va, unsigned int r, int l, int x, int y, unsigned int w, unsigned int h );
 
 };
 
@@ -0,0 +1,103 @@
+/*
+    IIPImage Server - Cache for decoded image data
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _DECODECACHE_H
+#define _DECODECACHE_H
+
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+
+
+
+/// Least recently used cache of blocks of decoded image data
+/** Used by image classes which decode blocks larger than a single tile, such as strips or bands
+    of scanlines, so that neighbouring tiles do not need to decode the same data again. Image objects
+    only exist for the duration of a request, so caches are generally declared statically and are
+    shared by all images within a process. Keys should include the image path and timestamp.
+ */
+class DecodeCache {
+
+ private:
+
+  typedef std::pair< std::string, std::vector<unsigned char> > Entry;
+
+  /// Entries in order of use, most recent first
+  std::list<Entry> entries;
+
+  /// Index into our list of entries
+  std::map < std::string, std::list<Entry>::iterator > index;
+
+  /// Current and maximum size of our cached data in bytes
+  size_t size, max_size;
+
+
+ public:
+
+  /// Constructor
+  /** @param m maximum size in bytes */
+  DecodeCache( size_t m ) : size( 0 ), max_size( m ) {};
+
+  /// Return the maximum size in bytes
+  size_t getMaxSize() const { return max_size; };
+
+  /// Find a block of data
+  /** @param key key
+      @return pointer to the data, which remains valid until the next insertion, or NULL if not cached
+   */
+  const std::vector<unsigned char>* find( const std::string& key ){
+    std::map < std::string, std::list<Entry>::iterator >::iterator i = index.find( key );
+    if( i == index.end() ) return NULL;
+    entries.splice( entries.begin(), entries, i->second );
+    return &(i->second->second);
+  };
+
+  /// Insert a block of data, evicting the least recently used blocks if necessary
+  /** @param key key
+      @param data data to insert, the contents of which are taken over by the cache
+      @return pointer to the cached data, which remains valid until the next insertion
+   */
+  const std::vector<unsigned char>* insert( const std::string& key, std::vector<unsigned char>& data ){
+    std::map < std::string, std::list<Entry>::iterator >::iterator i = index.find( key );
+    if( i != index.end() ){
+      size -= i->second->second.size();
+      entries.erase( i->second );
+      index.erase( i );
+    }
+    entries.push_front( Entry( key, std::vector<unsigned char>() ) );
+    entries.front().second.swap( data );
+    index[key] = entries.begin();
+    size += entries.front().second.size();
+    // Never evict the block just inserted
+    while( size > max_size && entries.size() > 1 ){
+      size -= entries.back().second.size();
+      index.erase( entries.back().first );
+      entries.pop_back();
+    }
+    return &(entries.front().second);
+  };
+
+};
+
+
+#endif
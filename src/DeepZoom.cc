@@ -77,7 +77,8 @@ void DeepZoom::run( Session* session, const std::string& argument ){
   unsigned int height = (*session->image)->getImageHeight();
 
 
-  unsigned int tw = (*session->image)->getTileWidth();
+  unsigned int tw, th;
+  getServedTileSize( session, tw, th );
   unsigned int numResolutions = (*session->image)->getNumResolutions();
 
 
@@ -169,7 +170,7 @@ void DeepZoom::run( Session* session, const std::string& argument ){
 
   // Simply pass this on to our JTL send command
   JTL jtl;
-  jtl.send( session, resolution, tile );
+  jtl.send( session, resolution, tile, tw, th );
 
 
   // Total DeepZoom response time
@@ -32,15 +32,29 @@
 #define JPEG_QUALITY 75
 #define PNG_QUALITY 1
 #define WEBP_QUALITY 50
+#define DEFLATE_QUALITY 1
 #define MAX_CVT 5000
 #define MAX_LAYERS 0
 #define FILESYSTEM_PREFIX ""
 #define FILESYSTEM_SUFFIX ""
+#define METADATA_INDEX ""
+#define ADMISSION_CONTROL ""
+#define ADMISSION_LIMITS ""
+#define ADMISSION_BUDGETS ""
+#define ADMISSION_RETRY_AFTER 5  // seconds
+#define MEMORY_BUDGET 0  // MB
+#define OVERLOAD_LATENCY 0  // ms
+#define OVERLOAD_QUALITY 50
+#define TILE_SIZE 0  // Native tile size
+#define TILE_FAST_PATH -1  // seconds
+#define SEQUENCE_PREFETCH 0  // tiles
 #define WATERMARK ""
 #define WATERMARK_PROBABILITY 1.0
 #define WATERMARK_OPACITY 1.0
 #define LIBMEMCACHED_SERVERS "localhost"
 #define LIBMEMCACHED_TIMEOUT 86400  // 24 hours
+#define LIBMEMCACHED_TILES false
+#define LIBMEMCACHED_QUEUE 16  // MB
 #define INTERPOLATION 1  // 1: Bilinear
 #define CORS "";
 #define BASE_URL "";
@@ -157,6 +171,20 @@ class Environment {
   }
 
 
+  static int getDeflateQuality(){
+    const char* envpara = getenv( "DEFLATE_QUALITY" );
+    int quality;
+    if( envpara ){
+      quality = atoi( envpara );
+      if( quality > 9 ) quality = 9;
+      if( quality < 0 ) quality = 0;
+    }
+    else quality = DEFLATE_QUALITY;
+
+    return quality;
+  }
+
+
   static int getMaxCVT(){
     const char* envpara = getenv( "MAX_CVT" );
     int max_CVT;
@@ -194,6 +222,131 @@ class Environment {
   }
 
 
+  static std::string getMetadataIndex(){
+    const char* envpara = getenv( "METADATA_INDEX" );
+    std::string metadata_index;
+    if( envpara ){
+      metadata_index = std::string( envpara );
+    }
+    else metadata_index = METADATA_INDEX;
+
+    return metadata_index;
+  }
+
+
+  static std::string getAdmissionControl(){
+    const char* envpara = getenv( "ADMISSION_CONTROL" );
+    std::string admission_control;
+    if( envpara ){
+      admission_control = std::string( envpara );
+    }
+    else admission_control = ADMISSION_CONTROL;
+
+    return admission_control;
+  }
+
+
+  static std::string getAdmissionLimits(){
+    const char* envpara = getenv( "ADMISSION_LIMITS" );
+    std::string admission_limits;
+    if( envpara ){
+      admission_limits = std::string( envpara );
+    }
+    else admission_limits = ADMISSION_LIMITS;
+
+    return admission_limits;
+  }
+
+
+  static std::string getAdmissionBudgets(){
+    const char* envpara = getenv( "ADMISSION_BUDGETS" );
+    std::string admission_budgets;
+    if( envpara ){
+      admission_budgets = std::string( envpara );
+    }
+    else admission_budgets = ADMISSION_BUDGETS;
+
+    return admission_budgets;
+  }
+
+
+  static unsigned int getAdmissionRetryAfter(){
+    const char* envpara = getenv( "ADMISSION_RETRY_AFTER" );
+    int retry_after;
+    if( envpara ) retry_after = atoi( envpara );
+    else retry_after = ADMISSION_RETRY_AFTER;
+    if( retry_after < 1 ) retry_after = 1;
+    return (unsigned int) retry_after;
+  }
+
+
+  static unsigned int getMemoryBudget(){
+    const char* envpara = getenv( "MEMORY_BUDGET" );
+    int memory_budget;
+    if( envpara ) memory_budget = atoi( envpara );
+    else memory_budget = MEMORY_BUDGET;
+    if( memory_budget < 0 ) memory_budget = 0;
+    return (unsigned int) memory_budget;
+  }
+
+
+  static unsigned int getOverloadLatency(){
+    const char* envpara = getenv( "OVERLOAD_LATENCY" );
+    int overload_latency;
+    if( envpara ) overload_latency = atoi( envpara );
+    else overload_latency = OVERLOAD_LATENCY;
+    if( overload_latency < 0 ) overload_latency = 0;
+    return (unsigned int) overload_latency;
+  }
+
+
+  static int getOverloadQuality(){
+    const char* envpara = getenv( "OVERLOAD_QUALITY" );
+    int overload_quality;
+    if( envpara ) overload_quality = atoi( envpara );
+    else overload_quality = OVERLOAD_QUALITY;
+    if( overload_quality < 1 ) overload_quality = 1;
+    else if( overload_quality > 100 ) overload_quality = 100;
+    return overload_quality;
+  }
+
+
+  static unsigned int getTileSize(){
+    const char* envpara = getenv( "TILE_SIZE" );
+    int tile_size;
+    if( envpara ) tile_size = atoi( envpara );
+    else tile_size = TILE_SIZE;
+    // Limit to a sensible range. Zero uses the native tile size of each image
+    if( tile_size < 0 ) tile_size = 0;
+    else if( tile_size > 0 && tile_size < 64 ) tile_size = 64;
+    else if( tile_size > 4096 ) tile_size = 4096;
+    return (unsigned int) tile_size;
+  }
+
+
+  static int getTileFastPath(){
+    const char* envpara = getenv( "TILE_FAST_PATH" );
+    int interval;
+    if( envpara ) interval = atoi( envpara );
+    else interval = TILE_FAST_PATH;
+    // Any negative value disables the fast path
+    if( interval < 0 ) interval = -1;
+    return interval;
+  }
+
+
+  static unsigned int getSequencePrefetch(){
+    const char* envpara = getenv( "SEQUENCE_PREFETCH" );
+    int tiles;
+    if( envpara ) tiles = atoi( envpara );
+    else tiles = SEQUENCE_PREFETCH;
+    // Zero disables prefetching
+    if( tiles < 0 ) tiles = 0;
+    else if( tiles > 1024 ) tiles = 1024;
+    return (unsigned int) tiles;
+  }
+
+
   static std::string getFileSystemSuffix(){
     const char* envpara = getenv( "FILESYSTEM_SUFFIX" );
     std::string filesystem_suffix;
@@ -268,6 +421,25 @@ class Environment {
   }
 
 
+  static unsigned int getMemcachedQueue(){
+    const char* envpara = getenv( "MEMCACHED_QUEUE" );
+    int memcached_queue;
+    if( envpara ) memcached_queue = atoi( envpara );
+    else memcached_queue = LIBMEMCACHED_QUEUE;
+    if( memcached_queue < 0 ) memcached_queue = 0;
+    return (unsigned int) memcached_queue;
+  }
+
+
+  static bool getMemcachedTiles(){
+    const char* envpara = getenv( "MEMCACHED_TILES" );
+    bool memcached_tiles;
+    if( envpara ) memcached_tiles = atoi( envpara ); // Implicit cast to boolean, all values other than '0' treated as true
+    else memcached_tiles = LIBMEMCACHED_TILES;
+    return memcached_tiles;
+  }
+
+
   static unsigned int getInterpolation(){
     const char* envpara = getenv( "INTERPOLATION" );
     unsigned int interpolation;
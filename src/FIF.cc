@@ -24,6 +24,8 @@
 #include "URL.h"
 #include "Environment.h"
 #include "TPTImage.h"
+#include "JPEGImage.h"
+#include "MetadataIndex.h"
 
 #ifdef HAVE_KAKADU
 #include "KakaduImage.h"
@@ -33,6 +35,10 @@
 #include "OpenJPEGImage.h"
 #endif
 
+#ifdef ENABLE_DL
+#include "DSOImage.h"
+#endif
+
 
 using namespace std;
 
@@ -42,6 +48,75 @@ long FIF::max_metadata_cache_size = 0;
 string FIF::filesystem_prefix;
 string FIF::filesystem_suffix;
 string FIF::filename_pattern;
+MetadataIndex* FIF::metadata_index = NULL;
+
+
+bool FIF::loadFromIndex( Session* session, const string& path, IIPImage& image ){
+
+  if( !FIF::metadata_index ) return false;
+
+  Timer index_timer;
+  if( session->loglevel >= 3 ) index_timer.start();
+
+  bool found = FIF::metadata_index->retrieve( path, image );
+
+  if( session->loglevel >= 2 ){
+    *(session->logfile) << "FIF :: Persistent metadata index " << (found ? "hit" : "miss");
+    if( session->loglevel >= 3 ) *(session->logfile) << " in " << index_timer.getTime() << " microseconds";
+    *(session->logfile) << endl;
+  }
+
+  return found;
+}
+
+
+
+IIPImage* FIF::createImage( Session* session, IIPImage& image, bool log ){
+
+  /*****************************************************
+    Test for supported image formats: TIFF, JPEG2000 or JPEG
+  ******************************************************/
+
+  ImageEncoding format = image.getImageFormat();
+
+  if( format == ImageEncoding::TIFF ){
+    if( log ) *(session->logfile) << "FIF :: TIFF image detected" << endl;
+    return new TPTImage( image );
+  }
+  else if( format == ImageEncoding::JPEG ){
+    if( log ) *(session->logfile) << "FIF :: JPEG image detected" << endl;
+    return new JPEGImage( image );
+  }
+#if defined(HAVE_KAKADU) || defined(HAVE_OPENJPEG)
+  else if( format == ImageEncoding::JPEG2000 ){
+    if( log ) *(session->logfile) << "FIF :: JPEG2000 image detected" << endl;
+#if defined(HAVE_KAKADU)
+    KakaduImage* kakadu = new KakaduImage( image );
+    map<const string,unsigned int>::const_iterator i = session->codecOptions.find( "KAKADU_READMODE" );
+    if( i != session->codecOptions.end() && i->second ){
+      kakadu->kdu_readmode = (KakaduImage::KDU_READMODE) i->second;
+    }
+    return kakadu;
+#elif defined(HAVE_OPENJPEG)
+    return new OpenJPEGImage( image );
+#endif
+  }
+#endif
+#ifdef ENABLE_DL
+  // Otherwise look for a decoder module registered for this file extension
+  else if( format == ImageEncoding::UNSUPPORTED ){
+    string filename = image.getFileName( image.currentX, image.currentY );
+    size_t dot = filename.find_last_of( "." );
+    const iip_decoder *decoder = (dot == string::npos) ? NULL : DSOImage::getDecoder( filename.substr( dot + 1 ) );
+    if( !decoder ) throw string( "Unsupported image type: " + image.getImagePath() );
+    if( log ) *(session->logfile) << "FIF :: " << decoder->description << " image detected" << endl;
+    return new DSOImage( image, decoder );
+  }
+#endif
+
+  throw string( "Unsupported image type: " + image.getImagePath() );
+}
+
 
 
 void FIF::run( Session* session, const string& src ){
@@ -76,6 +151,9 @@ void FIF::run( Session* session, const string& src ){
   // Timestamp of cached image
   time_t timestamp = 0;
 
+  // Whether our image metadata needs to be added to our persistent metadata index
+  bool update_index = false;
+
 
   // Put the image setup into a try block as object creation can throw an exception
   try{
@@ -86,7 +164,10 @@ void FIF::run( Session* session, const string& src ){
       test.setFileNamePattern( FIF::filename_pattern );
       test.setFileSystemPrefix( FIF::filesystem_prefix );
       test.setFileSystemSuffix( FIF::filesystem_suffix );
-      test.Initialise();
+      if( !loadFromIndex( session, argument, test ) ){
+	test.Initialise();
+	update_index = true;
+      }
     }
     else{
 
@@ -110,7 +191,10 @@ void FIF::run( Session* session, const string& src ){
 	test.setFileNamePattern( FIF::filename_pattern );
 	test.setFileSystemPrefix( FIF::filesystem_prefix );
 	test.setFileSystemSuffix( FIF::filesystem_suffix );
-	test.Initialise();
+	if( !loadFromIndex( session, argument, test ) ){
+	  test.Initialise();
+	  update_index = true;
+	}
 
 	// Delete items if our metadata cache becomes too large - unless we have set cache size to -1 (unlimited)
 	if( FIF::max_metadata_cache_size > 0 ){
@@ -124,31 +208,8 @@ void FIF::run( Session* session, const string& src ){
 
 
 
-    /*****************************************************
-      Test for supported image formats: TIFF or JPEG2000
-    ******************************************************/
-
-    ImageEncoding format = test.getImageFormat();
-
-    if( format == ImageEncoding::TIFF ){
-      if( session->loglevel >= 2 ) *(session->logfile) << "FIF :: TIFF image detected" << endl;
-      *session->image = new TPTImage( test );
-    }
-#if defined(HAVE_KAKADU) || defined(HAVE_OPENJPEG)
-    else if( format == ImageEncoding::JPEG2000 ){
-      if( session->loglevel >= 2 )
-        *(session->logfile) << "FIF :: JPEG2000 image detected" << endl;
-#if defined(HAVE_KAKADU)
-      *session->image = new KakaduImage( test );
-      if( session->codecOptions["KAKADU_READMODE"] ){
-	((KakaduImage*)*session->image)->kdu_readmode = (KakaduImage::KDU_READMODE) session->codecOptions["KAKADU_READMODE"];
-      }
-#elif defined(HAVE_OPENJPEG)
-      *session->image = new OpenJPEGImage( test );
-#endif
-    }
-#endif
-    else throw string( "Unsupported image type: " + argument );
+    // Create an image object of the appropriate type for our format
+    *session->image = FIF::createImage( session, test, session->loglevel >= 2 );
 
 
     // Open image and update timestamp
@@ -167,6 +228,17 @@ void FIF::run( Session* session, const string& src ){
 	*(session->logfile) << "FIF :: Image timestamp changed: reloading metadata" << endl;
       }
       (*session->image)->loadImageInfo( (*session->image)->currentX, (*session->image)->currentY );
+      (*session->image)->histogram.clear();
+      (*session->image)->statistics.clear();
+      update_index = true;
+    }
+
+    // Update our persistent metadata index if necessary
+    if( update_index && FIF::metadata_index ){
+      FIF::metadata_index->store( argument, *(*session->image) );
+      if( session->loglevel >= 3 ){
+	*(session->logfile) << "FIF :: Image metadata added to persistent index" << endl;
+      }
     }
 
     // Add this image to our cache, overwriting previous version if it exists
@@ -193,7 +265,8 @@ void FIF::run( Session* session, const string& src ){
 			  << "FIF :: Image contains " << (*session->image)->channels
 			  << " channel" << (((*session->image)->channels>1)?"s":"") << " with "
 			  << (*session->image)->bpc << " bit" << (((*session->image)->bpc>1)?"s":"") << " per channel" << endl
-			  << "FIF :: Image timestamp: " << strt << endl;
+			  << "FIF :: Image timestamp: " << strt << endl
+			  << "FIF :: Image identifier: " << (*session->image)->getImageId() << endl;
       if( (*session->image)->isStack() ){
 	std::list <Stack> stack = (*session->image)->getStack();
 	*(session->logfile) << "FIF :: Image is a stack containing " << stack.size() << " elements" << endl;
@@ -154,8 +154,8 @@ void IIIF::run( Session* session, const string& src )
   unsigned int requested_height;
   unsigned int width = (*session->image)->getImageWidth();
   unsigned int height = (*session->image)->getImageHeight();
-  unsigned tw = (*session->image)->getTileWidth();
-  unsigned th = (*session->image)->getTileHeight();
+  unsigned tw, th;
+  getServedTileSize( session, tw, th );
   unsigned numResolutions = (*session->image)->getNumResolutions();
 
   session->view->setImageSize( width, height );
@@ -226,6 +226,8 @@ void IIIF::run( Session* session, const string& src )
     snprintf( iiif_context, 48, IIIF_CONTEXT, iiif_version );
 
     // Get rights field if set either in image metadata or globally
+    this->session = session;
+    loadMetadata();
     string rights = (*session->image)->metadata["rights"];
     if( rights.empty() ) rights = session->headers["COPYRIGHT"];
 
@@ -263,6 +265,19 @@ void IIIF::run( Session* session, const string& src )
                      << "  ]," << endl;
 
 
+    // Output formats: WebP and full precision Deflate compressed TIFF are extra formats beyond those of the IIIF profile
+    string formats = "\"jpg\", \"png\", \"webp\"";
+    string extra_formats;
+#ifdef HAVE_WEBP
+    extra_formats = "\"webp\"";
+#endif
+#ifdef HAVE_ZLIB
+    formats += ", \"tif\"";
+    extra_formats += string( extra_formats.empty() ? "" : "," ) + "\"tif\"";
+#endif
+    if( !extra_formats.empty() ) extra_formats = "  \"extraFormats\": [" + extra_formats + "],\n";
+
+
     // Profile for IIIF version 3 and above
     if( iiif_version >= 3 ){
       infoStringStream << "  \"id\" : \"" << iiif_id << "\"," << endl
@@ -271,9 +286,7 @@ void IIIF::run( Session* session, const string& src )
 		       << "  \"maxWidth\" : " << max << "," << endl
 		       << "  \"maxHeight\" : " << max << "," << endl
 		       << "  \"extraQualities\": [\"color\",\"gray\",\"bitonal\"]," << endl
-#ifdef HAVE_WEBP
-		       << "  \"extraFormats\": [\"webp\"]," << endl
-#endif
+		       << extra_formats
 		       << "  \"extraFeatures\": [\"regionByPct\",\"sizeByForcedWh\",\"sizeByWh\",\"sizeAboveFull\",\"sizeUpscaling\",\"rotationBy90s\",\"mirroring\"]";
 
       if( !rights.empty() ){
@@ -287,7 +300,7 @@ void IIIF::run( Session* session, const string& src )
       infoStringStream << "  \"@id\" : \"" << iiif_id << "\"," << endl
 		       << "  \"profile\" : [" << endl
 		       << "     \"" << IIIF_PROTOCOL << "/" << iiif_version << "/" << IIIF_PROFILE << ".json\"," << endl
-		       << "     { \"formats\" : [ \"jpg\", \"png\", \"webp\" ]," << endl
+		       << "     { \"formats\" : [ " << formats << " ]," << endl
 		       << "       \"qualities\" : [\"native\",\"color\",\"gray\",\"bitonal\"]," << endl
 		       << "       \"supports\" : [\"regionByPct\",\"regionSquare\",\"sizeByForcedWh\",\"sizeByWh\",\"sizeAboveFull\",\"sizeUpscaling\",\"rotationBy90s\",\"mirroring\"]," << endl
 		       << "       \"maxWidth\" : " << max << "," << endl
@@ -614,6 +627,9 @@ void IIIF::run( Session* session, const string& src )
 #endif
 #ifdef HAVE_WEBP
 	else if( format == "webp" ) session->view->output_format = ImageEncoding::WEBP;
+#endif
+#ifdef HAVE_ZLIB
+	else if( format == "tif" ) session->view->output_format = ImageEncoding::DEFLATE;
 #endif
 	else throw invalid_argument( "IIIF :: unsupported output format" );
       }
@@ -720,7 +736,7 @@ void IIIF::run( Session* session, const string& src )
 
     // Simply pass this on to our JTL send command
     JTL jtl;
-    jtl.send( session, requested_res, tile );
+    jtl.send( session, requested_res, tile, tw, th );
 
   }
   else{
@@ -0,0 +1,157 @@
+/*
+    IIPImage Server - Decoder module interface
+
+    Versioned C interface to be implemented by dynamically loaded image decoder
+    modules. Modules are listed in the DECODER_MODULES startup variable and are
+    loaded once at startup.
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _IIPDECODER_H
+#define _IIPDECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Interface version. Modules must set abi_version in their iip_decoder structure to this value.
+   The version is incremented whenever the layout of any of the structures below changes.
+*/
+#define IIP_DECODER_ABI_VERSION 1
+
+/* Name of the symbol exported by each module: a function of type iip_decoder_entry_func */
+#define IIP_DECODER_ENTRY "iip_decoder_entry"
+
+
+/* Capability flags */
+
+/* get_region() is implemented and can decode arbitrary regions at any resolution */
+#define IIP_DECODER_REGION       0x01
+
+/* The decoder can synthesise further power-of-two reduced resolutions beyond those reported in
+   iip_image_info::num_resolutions. Resolution numbers passed to get_tile() and get_region() may
+   then go beyond the stored levels down to the level at which the image fits within a single tile */
+#define IIP_DECODER_SCALED       0x02
+
+/* A single image handle may be used concurrently from several threads */
+#define IIP_DECODER_THREADSAFE   0x04
+
+/* get_tile() can return tiles already encoded in the requested encoding (eg. JPEG) without decoding */
+#define IIP_DECODER_PASSTHROUGH  0x08
+
+
+/* Encodings - values match those of the ImageEncoding enum used within iipsrv */
+#define IIP_ENCODING_RAW   1
+#define IIP_ENCODING_JPEG  4
+#define IIP_ENCODING_PNG   6
+#define IIP_ENCODING_WEBP  7
+
+
+/* Sample formats */
+#define IIP_SAMPLE_FIXEDPOINT     0
+#define IIP_SAMPLE_FLOATINGPOINT  1
+
+
+/* Colour spaces - values match those of the ColorSpace enum used within iipsrv */
+#define IIP_COLORSPACE_GREYSCALE  1
+#define IIP_COLORSPACE_SRGB       2
+#define IIP_COLORSPACE_CIELAB     3
+
+
+/* Basic image information filled in by open() */
+typedef struct iip_image_info {
+  uint32_t num_resolutions;   /* Number of stored resolutions, full resolution being resolution 0 */
+  uint32_t tile_width;        /* Native tile width */
+  uint32_t tile_height;       /* Native tile height */
+  uint32_t channels;          /* Number of channels */
+  uint32_t bpc;               /* Bits per channel: 8, 16 or 32 */
+  uint32_t sample_format;     /* IIP_SAMPLE_FIXEDPOINT or IIP_SAMPLE_FLOATINGPOINT */
+  uint32_t colorspace;        /* One of the IIP_COLORSPACE values */
+  float dpi_x, dpi_y;         /* Physical resolution */
+  uint32_t dpi_units;         /* 0=unknown, 1=pixels/inch, 2=pixels/cm */
+} iip_image_info;
+
+
+/* Decoded or encoded pixel data returned by get_tile() and get_region(). The data buffer is
+   owned by the module and is released by iipsrv through free_buffer() */
+typedef struct iip_buffer {
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  uint32_t bpc;
+  uint32_t encoding;          /* IIP_ENCODING_RAW or, for pass-through tiles, the encoding of the data */
+  uint32_t quality;           /* Encoding quality for pass-through tiles */
+  void *data;
+  size_t length;              /* Length of data in bytes */
+} iip_buffer;
+
+
+/* Decoder function table. Resolution numbers count from 0 for the full resolution image.
+   Functions returning int return 0 on success and non-zero on error, in which case get_error()
+   should return a description of the error */
+typedef struct iip_decoder {
+
+  uint32_t abi_version;       /* Must be IIP_DECODER_ABI_VERSION */
+  uint32_t capabilities;      /* Bitwise OR of the IIP_DECODER capability flags */
+  const char *description;    /* Human readable module description */
+  const char *extensions;     /* Comma-delimited list of file extensions handled, eg. "ecw,sid" */
+
+  /* Open an image and fill in its basic information. Returns an opaque handle or NULL on error */
+  void* (*open)( const char *path, iip_image_info *info );
+
+  /* Close an image handle */
+  void (*close)( void *handle );
+
+  /* Get the size of a given resolution */
+  int (*get_resolution_size)( void *handle, uint32_t resolution, uint32_t *width, uint32_t *height );
+
+  /* Get a tile. Tiles are numbered in raster order at the given resolution. The requested encoding is
+     always IIP_ENCODING_RAW unless the module has the IIP_DECODER_PASSTHROUGH capability. Raw buffers
+     returned by get_tile() and get_region() must have the channels and bpc of the image, be no larger
+     than the tile or region and hold at least width*height*channels*bpc/8 bytes. Other raw buffers
+     are released and the request fails with a decoder error */
+  int (*get_tile)( void *handle, uint32_t resolution, uint32_t tile, int layers,
+		   uint32_t encoding, iip_buffer *out );
+
+  /* Get an arbitrary region at a given resolution. Only required with the IIP_DECODER_REGION capability */
+  int (*get_region)( void *handle, uint32_t resolution, int layers,
+		     uint32_t x, uint32_t y, uint32_t width, uint32_t height, iip_buffer *out );
+
+  /* Release a buffer returned by get_tile() or get_region() */
+  void (*free_buffer)( void *handle, iip_buffer *buffer );
+
+  /* Return a description of the last error. Handle may be NULL for errors within open() */
+  const char* (*get_error)( void *handle );
+
+} iip_decoder;
+
+
+/* Entry point exported by each module */
+typedef const iip_decoder* (*iip_decoder_entry_func)( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
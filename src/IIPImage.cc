@@ -53,6 +53,7 @@ void IIPImage::swap( IIPImage& first, IIPImage& second ) // nothrow
 {
   // Swap the members of the two objects
   std::swap( first.imagePath, second.imagePath );
+  std::swap( first.imageId, second.imageId );
   std::swap( first.isFile, second.isFile );
   std::swap( first.suffix, second.suffix );
   std::swap( first.virtual_levels, second.virtual_levels );
@@ -78,15 +79,19 @@ void IIPImage::swap( IIPImage& first, IIPImage& second ) // nothrow
   std::swap( first.channels, second.channels );
   std::swap( first.sampleType, second.sampleType );
   std::swap( first.quality_layers, second.quality_layers );
+  std::swap( first.ycbcr_output, second.ycbcr_output );
   std::swap( first.colorspace, second.colorspace );
   std::swap( first.isSet, second.isSet );
   std::swap( first.currentX, second.currentX );
   std::swap( first.currentY, second.currentY );
   std::swap( first.histogram, second.histogram );
+  std::swap( first.statistics, second.statistics );
   std::swap( first.metadata, second.metadata );
+  std::swap( first.metadata_loaded, second.metadata_loaded );
   std::swap( first.timestamp, second.timestamp );
   std::swap( first.min, second.min );
   std::swap( first.max, second.max );
+  std::swap( first.default_range, second.default_range );
 }
 
 
@@ -137,6 +142,9 @@ void IIPImage::testImageType()
     static const unsigned char lbigtiff[4] = {0x4D,0x4D,0x00,0x2B}; // Little Endian BigTIFF
     static const unsigned char bbigtiff[4] = {0x49,0x49,0x2B,0x00}; // Big Endian BigTIFF
 
+    // Magic file signature for JPEG: SOI marker followed by the start of another marker
+    static const unsigned char jpeg[3] = {0xFF,0xD8,0xFF};
+
     // Compare our header sequence to our magic byte signatures
     if( memcmp( header, j2k, 10 ) == 0 ) format = ImageEncoding::JPEG2000;
     else if( memcmp( header, stdtiff, 3 ) == 0
@@ -144,6 +152,7 @@ void IIPImage::testImageType()
 	     || memcmp( header, lbigtiff, 4 ) == 0 || memcmp( header, bbigtiff, 4 ) == 0 ){
       format = ImageEncoding::TIFF;
     }
+    else if( memcmp( header, jpeg, 3 ) == 0 ) format = ImageEncoding::JPEG;
     else format = ImageEncoding::UNSUPPORTED;
 
   }
@@ -177,6 +186,7 @@ void IIPImage::testImageType()
     suffix = tmp.substr( dot + 1, len );
     if( suffix == "jp2" || suffix == "jpx" || suffix == "j2k" ) format = ImageEncoding::JPEG2000;
     else if( suffix == "tif" || suffix == "tiff" ) format = ImageEncoding::TIFF;
+    else if( suffix == "jpg" || suffix == "jpeg" ) format = ImageEncoding::JPEG;
     else format = ImageEncoding::UNSUPPORTED;
 
     updateTimestamp( tmp );
@@ -38,6 +38,8 @@
 #include <stdexcept>
 
 #include "RawTile.h"
+#include "ImageRegistry.h"
+#include "Statistics.h"
 
 
 /// Define our own derived exception class for file errors
@@ -68,11 +70,17 @@ struct Stack {
 
 class IIPImage {
 
+  /// Allow our persistent metadata index to serialise our internal state
+  friend class MetadataIndex;
+
  private:
 
   /// Image path supplied
   std::string imagePath;
 
+  /// Interned identifier of our image path
+  uint32_t imageId;
+
   /// Prefix to add to paths
   std::string fileSystemPrefix;
 
@@ -127,6 +135,9 @@ class IIPImage {
   /// List of IFD offsets for each resolution
   std::vector <uint32_t> resolution_ids;
 
+  /// Whether optional metadata (XMP, ICC, descriptive tags) has been loaded
+  bool metadata_loaded;
+
 
  public:
 
@@ -161,9 +172,15 @@ class IIPImage {
   /// The min and max sample value for each channel
   std::vector <float> min, max;
 
+  /// Whether our min and max are defaults rather than values given by the image itself
+  bool default_range;
+
   /// Quality layers
   unsigned int quality_layers;
 
+  /// Whether decoded JPEG-encoded tiles may be returned as YCbCr because they will be directly re-encoded as JPEG
+  bool ycbcr_output;
+
   /// Indicate whether we have opened and initialised some parameters for this image
   bool isSet;
 
@@ -173,6 +190,9 @@ class IIPImage {
   /// Image histogram
   std::vector<unsigned int> histogram;
 
+  /// Per-band image statistics
+  std::vector<BandStatistics> statistics;
+
   /// STL map to hold string metadata
   std::map <const std::string, std::string> metadata;
 
@@ -190,10 +210,12 @@ class IIPImage {
 
   /// Default Constructor
   IIPImage() :
+    imageId( 0 ),
     isFile( false ),
     virtual_levels( 0 ),
     format( ImageEncoding::UNSUPPORTED ),
     pyramid( NORMAL ),
+    metadata_loaded( false ),
     colorspace( ColorSpace::NONE ),
     dpi_x( 0 ),
     dpi_y( 0 ),
@@ -202,7 +224,9 @@ class IIPImage {
     bpc( 0 ),
     channels( 0 ),
     sampleType( SampleType::FIXEDPOINT ),
+    default_range( false ),
     quality_layers( 0 ),
+    ycbcr_output( false ),
     isSet( false ),
     currentX( 0 ),
     currentY( 90 ),
@@ -213,10 +237,12 @@ class IIPImage {
    */
   IIPImage( const std::string& s ) :
     imagePath( s ),
+    imageId( ImageRegistry::intern( s ) ),
     isFile( false ),
     virtual_levels( 0 ),
     format( ImageEncoding::UNSUPPORTED ),
     pyramid( NORMAL ),
+    metadata_loaded( false ),
     colorspace( ColorSpace::NONE ),
     dpi_x( 0 ),
     dpi_y( 0 ),
@@ -225,7 +251,9 @@ class IIPImage {
     bpc( 0 ),
     channels( 0 ),
     sampleType( SampleType::FIXEDPOINT ),
+    default_range( false ),
     quality_layers( 0 ),
+    ycbcr_output( false ),
     isSet( false ),
     currentX( 0 ),
     currentY( 90 ),
@@ -236,6 +264,7 @@ class IIPImage {
    */
   IIPImage( const IIPImage& image ) :
     imagePath( image.imagePath ),
+    imageId( image.imageId ),
     fileSystemPrefix( image.fileSystemPrefix ),
     fileSystemSuffix( image.fileSystemSuffix ),
     fileNamePattern( image.fileNamePattern ),
@@ -249,6 +278,7 @@ class IIPImage {
     pyramid( image.pyramid ),
     stack( image.stack ),
     resolution_ids( image.resolution_ids ),
+    metadata_loaded( image.metadata_loaded ),
     image_widths( image.image_widths ),
     image_heights( image.image_heights ),
     tile_widths( image.tile_widths ),
@@ -263,11 +293,14 @@ class IIPImage {
     sampleType( image.sampleType ),
     min( image.min ),
     max( image.max ),
+    default_range( image.default_range ),
     quality_layers( image.quality_layers ),
+    ycbcr_output( image.ycbcr_output ),
     isSet( image.isSet ),
     currentX( image.currentX ),
     currentY( image.currentY ),
     histogram( image.histogram ),
+    statistics( image.statistics ),
     metadata( image.metadata ),
     timestamp( image.timestamp ) {};
 
@@ -292,6 +325,9 @@ class IIPImage {
   /// Return the image path
   const std::string& getImagePath() const { return imagePath; };
 
+  /// Return the interned identifier of our image path
+  uint32_t getImageId() const { return imageId; };
+
   /// Return the full file path for a particular horizontal and vertical angle
   /** @param x horizontal sequence angle
       @param y vertical sequence angle
@@ -393,9 +429,13 @@ class IIPImage {
   /// Return image metadata
   /** @param index metadata field name */
   const std::string& getMetadata( const std::string& index ){
+    if( !metadata_loaded ) loadMetadata();
     return metadata[index];
   };
 
+  /// Return whether optional metadata has been loaded
+  bool metadataLoaded() const { return metadata_loaded; };
+
   /// Return physical resolution (DPI) in pixels/meter horizontally
   float getHorizontalDPI() const { return (dpi_units==2) ? dpi_x*100.0 : ( (dpi_units==1) ? dpi_x/0.0254 : dpi_x ); };
 
@@ -405,12 +445,6 @@ class IIPImage {
   /// Return whether this image type directly handles region decoding
   virtual bool regionDecoding(){ return false; };
 
-  /// Load the appropriate codec module for this image type
-  /** Used only for dynamically loading codec modules. Overloaded by DSOImage class.
-      @param module the codec module path
-   */
-  virtual void Load( const std::string& module ) {};
-
   /// Return codec description: Overloaded by child class.
   virtual std::string getDescription() const { return std::string( "IIPImage Base Class" ); };
 
@@ -423,6 +457,10 @@ class IIPImage {
    */
   virtual void loadImageInfo( int x, int y ) {};
 
+  /// Load optional metadata such as XMP, ICC profiles and descriptive tags
+  /** Overloaded by child classes which load these on demand rather than within loadImageInfo() */
+  virtual void loadMetadata() { metadata_loaded = true; };
+
   /// Close the image: Overloaded by child class.
   virtual void closeImage() {};
 
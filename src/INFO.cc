@@ -0,0 +1,139 @@
+/*
+    IIP Bulk Image Information Command Handler Class Member Function
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <ctime>
+#include "Task.h"
+
+
+// Maximum number of images that can be requested at once
+#define MAX_INFO_IMAGES 1000
+
+
+using namespace std;
+
+
+/// Return a short name for an image format
+static const char* formatName( ImageEncoding format ){
+  switch( format ){
+    case ImageEncoding::TIFF: return "tiff";
+    case ImageEncoding::JPEG: return "jpeg";
+    case ImageEncoding::JPEG2000: return "jp2";
+    default: return "other";
+  }
+}
+
+
+
+/* Return a compact JSON summary of the dimensions, resolution levels, tile size and format
+   of a list of images given as a comma-delimited list of URL-encoded image paths. Metadata is
+   taken from our metadata cache or persistent metadata index wherever possible, and images
+   not found in either are opened in parallel. Images that cannot be opened are reported
+   individually with an error message rather than causing the whole request to fail.
+*/
+void INFO::run( Session* session, const string& argument ){
+
+  if( session->loglevel >= 3 ) *(session->logfile) << "INFO handler reached" << endl;
+
+  // Time this command
+  if( session->loglevel >= 2 ) command_timer.start();
+
+
+  // Extract our list of image paths, only resolving each distinct image once
+  vector<ImageEntry> entries;
+  vector<unsigned int> order;
+  parseImageList( argument, entries, order, MAX_INFO_IMAGES );
+
+  if( entries.empty() ) throw invalid_argument( "INFO :: no images specified" );
+
+  if( session->loglevel >= 2 ){
+    *(session->logfile) << "INFO :: Request for " << order.size() << " images of which " << entries.size() << " distinct" << endl;
+  }
+
+
+  // Resolve the metadata of all our images
+  this->session = session;
+  unsigned int errors = resolveImages( entries );
+
+
+  // Create our JSON summary in our requested order
+  stringstream json;
+  time_t latest = 0;
+
+  json << "{" << endl
+       << "  \"images\" : [";
+
+  for( unsigned int k = 0; k < order.size(); k++ ){
+
+    ImageEntry& e = entries[order[k]];
+
+    json << ( (k > 0) ? "," : "" ) << endl
+	 << "    { \"id\" : \"" << escapeJSON( e.path ) << "\", ";
+
+    if( !e.resolved ){
+      json << "\"error\" : \"" << escapeJSON( e.error ) << "\" }";
+      continue;
+    }
+
+    IIPImage& image = e.image;
+    if( image.timestamp > latest ) latest = image.timestamp;
+
+    unsigned int tw = ( session->tileSize > 0 ) ? session->tileSize : image.getTileWidth();
+    unsigned int th = ( session->tileSize > 0 ) ? session->tileSize : image.getTileHeight();
+
+    json << "\"format\" : \"" << formatName( image.getImageFormat() ) << "\", "
+	 << "\"width\" : " << image.getImageWidth() << ", "
+	 << "\"height\" : " << image.getImageHeight() << ", "
+	 << "\"levels\" : " << image.getNumResolutions() << ", "
+	 << "\"tileWidth\" : " << tw << ", "
+	 << "\"tileHeight\" : " << th << ", "
+	 << "\"channels\" : " << image.getNumChannels() << ", "
+	 << "\"bitsPerSample\" : " << image.getNumBitsPerPixel() << ", "
+	 << "\"modified\" : \"" << image.getTimestamp() << "\" }";
+  }
+
+  json << endl << "  ]" << endl << "}";
+
+
+  // Our modification time is that of the most recently modified image
+  char timestamp[64];
+  strftime( timestamp, 64, "%a, %d %b %Y %H:%M:%S GMT", gmtime( &latest ) );
+
+  stringstream header;
+  header << session->response->createHTTPHeader( "json", timestamp )
+	 << json.str();
+
+  session->out->putStr( header.str().c_str(), (int) header.tellp() );
+  session->response->setImageSent();
+
+  // Images may change independently of each other, so never store these replies in Memcached
+  session->response->setCachability( false );
+
+  if( session->loglevel >= 2 ){
+    *(session->logfile) << "INFO :: " << entries.size() - errors << " images resolved";
+    if( errors ) *(session->logfile) << " and " << errors << " could not be opened";
+    *(session->logfile) << endl
+			<< "INFO :: Total command time " << command_timer.getTime() << " microseconds" << endl;
+  }
+
+}
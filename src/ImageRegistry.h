@@ -0,0 +1,98 @@
+/*
+    IIPImage Server - Interned image identifiers
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _IMAGEREGISTRY_H
+#define _IMAGEREGISTRY_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+
+
+/// Process-wide table mapping image paths to small integer identifiers
+/** Tiles and cache keys refer to their image by identifier rather than by carrying a copy of the
+    full image path. Identifiers start at 1, with 0 reserved for tiles not associated with an image.
+    They are only valid within the current process, so keys shared between processes, such as those
+    used for memcached, must continue to use the image path. The table is never pruned, as it only
+    grows with the number of distinct images requested. Access is serialised, as tiles may be
+    decoded from several threads.
+ */
+class ImageRegistry {
+
+ private:
+
+  /// Our table: a path index and the list of paths in order of identifier
+  struct Table {
+    std::mutex mutex;
+    std::unordered_map < std::string, uint32_t > ids;
+    std::vector < std::string > paths;
+  };
+
+  /// Return our single process-wide table
+  static Table& table(){
+    static Table t;
+    return t;
+  };
+
+
+ public:
+
+  /// Return the identifier for an image path, allocating a new identifier if necessary
+  /** @param path image path
+      @return identifier or 0 for an empty path
+   */
+  static uint32_t intern( const std::string& path ){
+    if( path.empty() ) return 0;
+    Table& t = table();
+    std::lock_guard<std::mutex> lock( t.mutex );
+    std::unordered_map < std::string, uint32_t >::const_iterator i = t.ids.find( path );
+    if( i != t.ids.end() ) return i->second;
+    t.paths.push_back( path );
+    uint32_t id = t.paths.size();
+    t.ids[path] = id;
+    return id;
+  };
+
+  /// Return the image path for an identifier
+  /** @param id identifier
+      @return image path or an empty string if unknown
+   */
+  static std::string path( uint32_t id ){
+    Table& t = table();
+    std::lock_guard<std::mutex> lock( t.mutex );
+    return ( id > 0 && id <= t.paths.size() ) ? t.paths[id-1] : std::string();
+  };
+
+  /// Return the number of interned images
+  static size_t size(){
+    Table& t = table();
+    std::lock_guard<std::mutex> lock( t.mutex );
+    return t.paths.size();
+  };
+
+};
+
+
+#endif
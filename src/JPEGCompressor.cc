@@ -399,7 +399,8 @@ unsigned int JPEGCompressor::Compress( RawTile& rawtile )
   cinfo.image_width = width;
   cinfo.image_height = height;
   cinfo.input_components = channels;
-  cinfo.in_color_space = ( channels == 3 ? JCS_RGB : JCS_GRAYSCALE );
+  // Tiles decoded directly from JPEG can be supplied as YCbCr, avoiding a round trip through RGB
+  cinfo.in_color_space = ( channels == 3 ? (rawtile.ycbcr ? JCS_YCbCr : JCS_RGB) : JCS_GRAYSCALE );
   jpeg_set_defaults( &cinfo );
 
   // Set our physical output resolution (JPEG only supports integers)
@@ -459,6 +460,7 @@ unsigned int JPEGCompressor::Compress( RawTile& rawtile )
   rawtile.dataLength = dataLength;
   rawtile.compressionType = ImageEncoding::JPEG;
   rawtile.quality = Q;
+  rawtile.ycbcr = false;
 
 
   // Return the size of the data we have compressed
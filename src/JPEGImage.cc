@@ -0,0 +1,410 @@
+// Member functions for JPEGImage.h
+
+/*  IIP Server: JPEG source image handler
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include "JPEGImage.h"
+#include "DecodeCache.h"
+#include "Logger.h"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+extern "C"{
+/* Undefine this to prevent compiler warning
+ */
+#undef HAVE_STDLIB_H
+#include <jpeglib.h>
+}
+
+
+using namespace std;
+
+
+// Reference our logging object
+extern Logger logfile;
+
+
+// Definitions of our class constants
+const unsigned int JPEGImage::tile_size;
+const unsigned int JPEGImage::dct_levels;
+
+
+// Maximum memory in bytes used to cache decoded bands
+static const size_t band_cache_size = 64 * 1024 * 1024;
+
+// Decoded bands shared by all JPEG images within this process
+static DecodeCache band_cache( band_cache_size );
+
+// Markers containing metadata
+#define ICC_MARKER  (JPEG_APP0 + 2)
+#define XMP_MARKER  (JPEG_APP0 + 1)
+
+
+
+/* Handle libjpeg errors as exceptions and log warnings to our Logger
+ */
+METHODDEF(void) iip_jpeg_error_exit( j_common_ptr cinfo )
+{
+  char buffer[ JMSG_LENGTH_MAX ];
+  (*cinfo->err->format_message) ( cinfo, buffer );
+  throw file_error( "JPEGImage :: JPEG error: " + string( buffer ) );
+}
+
+METHODDEF(void) iip_jpeg_output_message( j_common_ptr cinfo )
+{
+  if( IIPImage::logging ){
+    char buffer[ JMSG_LENGTH_MAX ];
+    (*cinfo->err->format_message) ( cinfo, buffer );
+    logfile << "JPEGImage :: JPEG warning: " << buffer << endl;
+  }
+}
+
+
+
+/// Decompression object which releases its resources when going out of scope, including when an error is thrown
+class JPEGDecompressor {
+
+ public:
+
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  FILE *file;
+
+  JPEGDecompressor( const string& filename ){
+    file = fopen( filename.c_str(), "rb" );
+    if( !file ) throw file_error( "JPEGImage :: Unable to open file: " + filename );
+    cinfo.err = jpeg_std_error( &jerr );
+    jerr.error_exit = iip_jpeg_error_exit;
+    jerr.output_message = iip_jpeg_output_message;
+    jpeg_create_decompress( &cinfo );
+    jpeg_stdio_src( &cinfo, file );
+  };
+
+  ~JPEGDecompressor(){
+    jpeg_destroy_decompress( &cinfo );
+    fclose( file );
+  };
+
+};
+
+
+
+void JPEGImage::openImage()
+{
+  string filename = getFileName( currentX, currentY );
+
+  // Update our timestamp
+  updateTimestamp( filename );
+
+  // Load our metadata if not already loaded
+  if( bpc == 0 ) loadImageInfo( currentX, currentY );
+
+  isSet = true;
+}
+
+
+
+void JPEGImage::loadImageInfo( int seq, int ang )
+{
+  currentX = seq;
+  currentY = ang;
+
+  JPEGDecompressor jpeg( getFileName( seq, ang ) );
+  jpeg_read_header( &jpeg.cinfo, TRUE );
+
+  // Colour JPEGs are decoded to RGB. CMYK JPEGs would require colour conversion, which we do not support
+  switch( jpeg.cinfo.jpeg_color_space ){
+    case JCS_GRAYSCALE:
+      channels = 1;
+      colorspace = ColorSpace::GREYSCALE;
+      break;
+    case JCS_RGB:
+    case JCS_YCbCr:
+      channels = 3;
+      colorspace = ColorSpace::sRGB;
+      break;
+    default:
+      throw file_error( "JPEGImage :: Unsupported JPEG colour space for " + getFileName( seq, ang ) );
+  }
+
+  bpc = 8;
+  sampleType = SampleType::FIXEDPOINT;
+
+  // Physical resolution from the JFIF header: units are 1=pixels/inch and 2=pixels/cm as for iipsrv
+  if( jpeg.cinfo.saw_JFIF_marker && (jpeg.cinfo.density_unit == 1 || jpeg.cinfo.density_unit == 2) ){
+    dpi_x = jpeg.cinfo.X_density;
+    dpi_y = jpeg.cinfo.Y_density;
+    dpi_units = jpeg.cinfo.density_unit;
+  }
+  else{
+    dpi_x = dpi_y = 0;
+    dpi_units = 0;
+  }
+
+  // Our resolution levels: successive halvings down to the level which fits within a single tile.
+  // The first levels correspond to the DCT scaling factors of libjpeg, which rounds up sizes
+  unsigned int w = jpeg.cinfo.image_width;
+  unsigned int h = jpeg.cinfo.image_height;
+
+  image_widths.clear();
+  image_heights.clear();
+  tile_widths.clear();
+  tile_heights.clear();
+  resolution_ids.clear();
+
+  image_widths.push_back( w );
+  image_heights.push_back( h );
+  tile_widths.push_back( tile_size );
+  tile_heights.push_back( tile_size );
+  resolution_ids.push_back( 0 );
+
+  while( w > tile_size || h > tile_size ){
+    w = (w+1) / 2;
+    h = (h+1) / 2;
+    image_widths.push_back( w );
+    image_heights.push_back( h );
+    tile_widths.push_back( tile_size );
+    tile_heights.push_back( tile_size );
+  }
+
+  numResolutions = image_widths.size();
+
+  // Levels beyond the 1/8 DCT scale are synthesised by subsampling
+  virtual_levels = ( numResolutions > dct_levels ) ? numResolutions - dct_levels : 0;
+
+  min.assign( channels, 0.0 );
+  max.assign( channels, 255.0 );
+
+  // Comments, XMP and ICC profiles are only loaded on demand
+  metadata.clear();
+  metadata_loaded = false;
+}
+
+
+
+void JPEGImage::loadMetadata()
+{
+  if( metadata_loaded ) return;
+
+  JPEGDecompressor jpeg( getFileName( currentX, currentY ) );
+  jpeg_save_markers( &jpeg.cinfo, JPEG_COM, 0xFFFF );
+  jpeg_save_markers( &jpeg.cinfo, XMP_MARKER, 0xFFFF );
+  jpeg_save_markers( &jpeg.cinfo, ICC_MARKER, 0xFFFF );
+  jpeg_read_header( &jpeg.cinfo, TRUE );
+
+  // ICC profiles can be split over several markers, each of which has a sequence number
+  static const char icc_id[] = "ICC_PROFILE";
+  static const char xmp_id[] = "http://ns.adobe.com/xap/1.0/";
+  map<int,string> icc;
+
+  for( jpeg_saved_marker_ptr m = jpeg.cinfo.marker_list; m; m = m->next ){
+    const char* data = (const char*) m->data;
+    if( m->marker == JPEG_COM ){
+      metadata["description"] = string( data, m->data_length );
+    }
+    else if( m->marker == XMP_MARKER && m->data_length > sizeof(xmp_id) &&
+	     memcmp( data, xmp_id, sizeof(xmp_id) ) == 0 ){
+      metadata["xmp"] = string( data + sizeof(xmp_id), m->data_length - sizeof(xmp_id) );
+    }
+    else if( m->marker == ICC_MARKER && m->data_length > sizeof(icc_id) + 2 &&
+	     memcmp( data, icc_id, sizeof(icc_id) ) == 0 ){
+      int sequence = (unsigned char) data[ sizeof(icc_id) ];
+      icc[sequence] = string( data + sizeof(icc_id) + 2, m->data_length - sizeof(icc_id) - 2 );
+    }
+  }
+
+  if( !icc.empty() ){
+    string profile;
+    for( map<int,string>::const_iterator i = icc.begin(); i != icc.end(); i++ ) profile += i->second;
+    metadata["icc"] = profile;
+  }
+
+  metadata_loaded = true;
+}
+
+
+
+void JPEGImage::decodeBand( unsigned int vipsres, unsigned int top, unsigned int rows,
+			    unsigned int left, unsigned int width, vector<unsigned char>& band )
+{
+  // Use DCT scaling for the first levels and subsample the 1/8 scale for any further levels
+  unsigned int level = ( vipsres < dct_levels ) ? vipsres : dct_levels - 1;
+  unsigned int factor = 1 << ( vipsres - level );
+
+  JPEGDecompressor jpeg( getFileName( currentX, currentY ) );
+  jpeg_read_header( &jpeg.cinfo, TRUE );
+
+  jpeg.cinfo.scale_num = 1;
+  jpeg.cinfo.scale_denom = 1 << level;
+  jpeg.cinfo.out_color_space = ( channels == 1 ) ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_start_decompress( &jpeg.cinfo );
+
+  unsigned int scaled_width = jpeg.cinfo.output_width;
+  unsigned int scaled_height = jpeg.cinfo.output_height;
+  unsigned int components = jpeg.cinfo.output_components;
+
+  // Rows and columns of the decoded scale covered by our band
+  unsigned int first_row = top * factor;
+  unsigned int last_row = ( top + rows - 1 ) * factor;
+  if( last_row >= scaled_height ) last_row = scaled_height - 1;
+  unsigned int first_column = left * factor;
+  unsigned int offset = 0;
+  unsigned int row_width = scaled_width;
+
+#ifdef HAVE_JPEG_PARTIAL_DECODING
+  // Only decode the columns we need. The crop is widened by the library to a whole number of iMCUs.
+  // Request an extra column on either side, as chroma upsampling differs at the edges of the crop
+  if( left > 0 || (left + width) * factor < scaled_width ){
+    JDIMENSION xoffset = ( first_column > 0 ) ? first_column - 1 : 0;
+    JDIMENSION crop_width = ( (left + width - 1) * factor ) - xoffset + 2;
+    if( xoffset + crop_width > scaled_width ) crop_width = scaled_width - xoffset;
+    jpeg_crop_scanline( &jpeg.cinfo, &xoffset, &crop_width );
+    offset = first_column - xoffset;
+    row_width = crop_width;
+  }
+  else offset = first_column;
+
+  // Skip the scanlines above our band without performing the inverse DCT
+  if( first_row > 0 ) jpeg_skip_scanlines( &jpeg.cinfo, first_row );
+#else
+  offset = first_column;
+#endif
+
+  vector<unsigned char> line( (size_t) row_width * components );
+  JSAMPROW row_pointer[1] = { line.data() };
+  band.resize( (size_t) width * rows * components );
+
+  unsigned int n = 0;
+  while( jpeg.cinfo.output_scanline <= last_row ){
+
+    unsigned int row = jpeg.cinfo.output_scanline;
+    jpeg_read_scanlines( &jpeg.cinfo, row_pointer, 1 );
+
+    // Ignore rows above our band or in between our subsampled rows
+    if( row < first_row || (row - first_row) % factor != 0 ) continue;
+
+    unsigned char* out = &band[ (size_t) n * width * components ];
+    if( factor == 1 ) memcpy( out, &line[ (size_t) offset * components ], (size_t) width * components );
+    else{
+      for( unsigned int i = 0; i < width; i++ ){
+	unsigned int column = offset + i * factor;
+	if( column >= row_width ) column = row_width - 1;
+	memcpy( &out[ (size_t) i * components ], &line[ (size_t) column * components ], components );
+      }
+    }
+    if( ++n == rows ) break;
+  }
+
+  // Repeat the final row if the subsampled band extends beyond the decoded image
+  for( ; n < rows && n > 0; n++ ){
+    memcpy( &band[ (size_t) n * width * components ], &band[ (size_t)(n-1) * width * components ], (size_t) width * components );
+  }
+
+  // No need to decode the remainder of the image
+  jpeg_abort_decompress( &jpeg.cinfo );
+}
+
+
+
+RawTile JPEGImage::getTile( int x, int y, unsigned int res, int layers, unsigned int tile, ImageEncoding requested_encoding )
+{
+  // Check the resolution exists
+  if( res >= numResolutions ){
+    ostringstream error;
+    error << "JPEGImage :: Asked for non-existent resolution: " << res;
+    throw file_error( error.str() );
+  }
+
+  int vipsres = ( numResolutions - 1 ) - res;
+
+  unsigned int im_width = image_widths[vipsres];
+  unsigned int im_height = image_heights[vipsres];
+  unsigned int tw = tile_widths[vipsres];
+  unsigned int th = tile_heights[vipsres];
+  unsigned int ntlx = (im_width / tw) + (im_width % tw == 0 ? 0 : 1);
+  unsigned int ntly = (im_height / th) + (im_height % th == 0 ? 0 : 1);
+
+  if( tile >= ntlx * ntly ){
+    ostringstream tile_no;
+    tile_no << "JPEGImage :: Asked for non-existent tile: " << tile;
+    throw file_error( tile_no.str() );
+  }
+
+  // Position and size of our tile
+  unsigned int left = (tile % ntlx) * tw;
+  unsigned int top = (tile / ntlx) * th;
+  if( left + tw > im_width ) tw = im_width - left;
+  if( top + th > im_height ) th = im_height - top;
+
+  RawTile rawtile( tile, res, x, y, tw, th, channels, 8 );
+  rawtile.imageId = getImageId();
+  rawtile.timestamp = timestamp;
+  rawtile.sampleType = SampleType::FIXEDPOINT;
+  rawtile.compressionType = ImageEncoding::RAW;
+  rawtile.allocate();
+  rawtile.dataLength = (size_t) tw * th * channels;
+  unsigned char* output = (unsigned char*) rawtile.data;
+
+  size_t band_bytes = (size_t) im_width * th * channels;
+
+  // Decode the full width band for this row of tiles if it is small enough to cache
+  if( band_bytes <= band_cache.getMaxSize() / 4 ){
+
+    ostringstream key;
+    key << getFileName( x, y ) << ":" << timestamp << ":" << vipsres << ":" << top;
+
+    // Our band cache is shared between threads, so copy our tile out of it while it is locked
+    bool cached = false;
+#if defined(_OPENMP)
+#pragma omp critical(band_cache)
+#endif
+    {
+      const vector<unsigned char>* band = band_cache.find( key.str() );
+      if( band ){
+	for( unsigned int j = 0; j < th; j++ ){
+	  memcpy( &output[ (size_t) j * tw * channels ], &(*band)[ ( (size_t) j * im_width + left ) * channels ], (size_t) tw * channels );
+	}
+	cached = true;
+      }
+    }
+
+    if( !cached ){
+      vector<unsigned char> buffer;
+      decodeBand( vipsres, top, th, 0, im_width, buffer );
+      for( unsigned int j = 0; j < th; j++ ){
+	memcpy( &output[ (size_t) j * tw * channels ], &buffer[ ( (size_t) j * im_width + left ) * channels ], (size_t) tw * channels );
+      }
+#if defined(_OPENMP)
+#pragma omp critical(band_cache)
+#endif
+      band_cache.insert( key.str(), buffer );
+      if( IIPImage::logging ) logfile << "JPEGImage :: Decoded band at resolution " << res << " rows " << top << "-" << top+th-1 << endl;
+    }
+  }
+  // Otherwise only decode the columns of our tile
+  else{
+    vector<unsigned char> buffer;
+    decodeBand( vipsres, top, th, left, tw, buffer );
+    memcpy( output, buffer.data(), rawtile.dataLength );
+  }
+
+  return rawtile;
+}
@@ -0,0 +1,114 @@
+// JPEG image class interface
+
+/*  IIPImage JPEG Source Image Class
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _JPEGIMAGE_H
+#define _JPEGIMAGE_H
+
+
+#include "IIPImage.h"
+#include <vector>
+
+
+
+/// Image class for plain (non-pyramidal) JPEG images: Inherits from IIPImage. Uses libjpeg
+/** Tiles are served through a virtual tiling of the image. Reduced resolutions of 1/2, 1/4 and 1/8
+    are decoded directly using the DCT scaling of libjpeg, and any smaller resolutions are
+    synthesised by subsampling the 1/8 scale. Each tile request decodes the horizontal band of
+    scanlines containing its row of tiles, skipping preceding scanlines where supported by the
+    library, and the decoded band is cached so that neighbouring tiles do not rescan the file.
+    Bands too large to cache are instead cropped to the columns of the requested tile.
+ */
+class JPEGImage : public IIPImage {
+
+ private:
+
+  /// Decode the band of scanlines for a row of tiles
+  /** @param vipsres resolution level counting from the full resolution image
+      @param top first row of the band at this resolution
+      @param rows number of rows in the band
+      @param left first column to decode at this resolution
+      @param width number of columns to decode
+      @param band buffer to fill with 8 bit interleaved pixel data
+   */
+  void decodeBand( unsigned int vipsres, unsigned int top, unsigned int rows,
+		   unsigned int left, unsigned int width, std::vector<unsigned char>& band );
+
+
+ public:
+
+  /// Size of our virtual tiles
+  static const unsigned int tile_size = 256;
+
+  /// Maximum number of resolution levels decoded directly via DCT scaling (1/1, 1/2, 1/4 and 1/8)
+  static const unsigned int dct_levels = 4;
+
+
+  /// Constructor
+  JPEGImage() : IIPImage() {};
+
+  /// Constructor
+  /** @param path image path
+   */
+  JPEGImage( const std::string& path ) : IIPImage( path ) {};
+
+  /// Copy Constructor
+  /** @param image JPEGImage object
+   */
+  JPEGImage( const JPEGImage& image ) : IIPImage( image ) {};
+
+  /// Construct from an IIPImage object
+  /** @param image IIPImage object
+   */
+  JPEGImage( const IIPImage& image ) : IIPImage( image ) {};
+
+  /// Destructor
+  ~JPEGImage() { closeImage(); };
+
+  /// Overloaded function for opening a JPEG image
+  void openImage();
+
+  /// Overloaded function for loading JPEG image information
+  /** @param x horizontal sequence angle
+      @param y vertical sequence angle
+   */
+  void loadImageInfo( int x, int y );
+
+  /// Overloaded function for loading optional metadata on demand: comments, XMP and ICC profile
+  void loadMetadata();
+
+  /// Overloaded function for closing a JPEG image
+  void closeImage() {};
+
+  /// Overloaded function for getting a particular tile
+  /** @param x horizontal sequence angle
+      @param y vertical sequence angle
+      @param r resolution
+      @param l quality layers (unused)
+      @param t tile number
+      @param e requested image encoding
+   */
+  RawTile getTile( int x, int y, unsigned int r, int l, unsigned int t, ImageEncoding e = ImageEncoding::RAW );
+
+};
+
+
+#endif
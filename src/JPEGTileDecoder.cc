@@ -0,0 +1,181 @@
+/*
+    IIPImage Server - Direct decoder for JPEG-encoded TIFF tiles
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include "JPEGTileDecoder.h"
+#include <cstring>
+
+
+using namespace std;
+
+
+
+/* Throw errors as exceptions so that control returns to the caller, as for our JPEGCompressor
+ */
+METHODDEF(void) iip_decoder_error_exit( j_common_ptr cinfo )
+{
+  char buffer[ JMSG_LENGTH_MAX ];
+  (*cinfo->err->format_message) ( cinfo, buffer );
+  throw string( "JPEGTileDecoder: " ) + buffer;
+}
+
+/* Ignore warnings such as premature ends of data, which libtiff would also tolerate
+ */
+METHODDEF(void) iip_decoder_output_message( j_common_ptr cinfo ) {}
+
+
+
+/* Source manager reading from a memory buffer. Older versions of libjpeg do not provide jpeg_mem_src()
+ */
+METHODDEF(void) iip_init_source( j_decompress_ptr cinfo ) {}
+
+METHODDEF(boolean) iip_fill_input_buffer( j_decompress_ptr cinfo )
+{
+  // Insert a fake EOI marker if we run out of data
+  static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+  cinfo->src->next_input_byte = eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+METHODDEF(void) iip_skip_input_data( j_decompress_ptr cinfo, long num_bytes )
+{
+  if( num_bytes <= 0 ) return;
+  if( (size_t) num_bytes > cinfo->src->bytes_in_buffer ) iip_fill_input_buffer( cinfo );
+  else{
+    cinfo->src->next_input_byte += num_bytes;
+    cinfo->src->bytes_in_buffer -= num_bytes;
+  }
+}
+
+METHODDEF(void) iip_term_source( j_decompress_ptr cinfo ) {}
+
+
+
+/* Check whether a JPEG stream defines any quantization (DQT) or Huffman (DHT) tables of its own
+   before its first scan, which would replace those loaded into our decompressor
+ */
+static bool definesTables( const unsigned char* input, unsigned int length )
+{
+  unsigned int i = 2;  // Skip SOI
+  while( i + 4 <= length ){
+    if( input[i] != 0xFF ){ i++; continue; }
+    unsigned char marker = input[i+1];
+    if( marker == 0xFF ){ i++; continue; }
+    if( marker == 0xDB || marker == 0xC4 ) return true;
+    if( marker == 0xDA || marker == 0xD9 ) return false;  // SOS or EOI
+    i += 2 + ( (input[i+2] << 8) | input[i+3] );
+  }
+  return false;
+}
+
+
+
+JPEGTileDecoder::JPEGTileDecoder()
+{
+  cinfo.err = jpeg_std_error( &jerr );
+  jerr.error_exit = iip_decoder_error_exit;
+  jerr.output_message = iip_decoder_output_message;
+  jpeg_create_decompress( &cinfo );
+
+  // Our source manager persists for the lifetime of the decompressor
+  cinfo.src = (struct jpeg_source_mgr*)
+    (*cinfo.mem->alloc_small) ( (j_common_ptr) &cinfo, JPOOL_PERMANENT, sizeof(struct jpeg_source_mgr) );
+  cinfo.src->init_source = iip_init_source;
+  cinfo.src->fill_input_buffer = iip_fill_input_buffer;
+  cinfo.src->skip_input_data = iip_skip_input_data;
+  cinfo.src->resync_to_restart = jpeg_resync_to_restart;
+  cinfo.src->term_source = iip_term_source;
+  cinfo.src->bytes_in_buffer = 0;
+  cinfo.src->next_input_byte = NULL;
+}
+
+
+
+JPEGTileDecoder::~JPEGTileDecoder()
+{
+  jpeg_destroy_decompress( &cinfo );
+}
+
+
+
+void JPEGTileDecoder::decode( const unsigned char* jpeg_tables, unsigned int tables_length,
+			      const unsigned char* input, unsigned int input_length,
+			      unsigned int width, unsigned int height, unsigned int channels,
+			      bool ycbcr_input, bool ycbcr_output, unsigned char* output )
+{
+  try{
+
+    // Load our tables if they differ from those already loaded. Tables persist in the decompressor
+    // across images until replaced, which is how libjpeg handles abbreviated datastreams
+    if( tables_length > 0 && ( tables.size() != tables_length || memcmp( tables.data(), jpeg_tables, tables_length ) != 0 ) ){
+      tables.clear();
+      cinfo.src->next_input_byte = jpeg_tables;
+      cinfo.src->bytes_in_buffer = tables_length;
+      if( jpeg_read_header( &cinfo, FALSE ) != JPEG_HEADER_TABLES_ONLY ){
+	throw string( "JPEGTileDecoder: Invalid JPEG tables" );
+      }
+      tables.assign( jpeg_tables, jpeg_tables + tables_length );
+    }
+
+    // Tables within the tile stream itself replace those loaded, so ours no longer describe our decompressor
+    if( tables_length == 0 || definesTables( input, input_length ) ) tables.clear();
+
+    cinfo.src->next_input_byte = input;
+    cinfo.src->bytes_in_buffer = input_length;
+    jpeg_read_header( &cinfo, TRUE );
+
+    if( cinfo.image_width != width || cinfo.image_height != height || cinfo.num_components != (int) channels ){
+      throw string( "JPEGTileDecoder: JPEG tile dimensions do not match the TIFF tile" );
+    }
+
+    // TIFF streams carry no JFIF or Adobe markers, so set the colour spaces explicitly as libtiff does:
+    // only YCbCr data is colour converted and any other data is passed through unchanged
+    if( channels == 3 && ycbcr_input ){
+      cinfo.jpeg_color_space = JCS_YCbCr;
+      cinfo.out_color_space = ycbcr_output ? JCS_YCbCr : JCS_RGB;
+    }
+    else{
+      cinfo.jpeg_color_space = (channels == 1) ? JCS_GRAYSCALE : JCS_UNKNOWN;
+      cinfo.out_color_space = cinfo.jpeg_color_space;
+    }
+
+    jpeg_start_decompress( &cinfo );
+
+    // Decode directly into our output buffer
+    JSAMPROW rows[4];
+    while( cinfo.output_scanline < cinfo.output_height ){
+      unsigned int n = 0;
+      while( n < 4 && cinfo.output_scanline + n < cinfo.output_height ){
+	rows[n] = &output[ (size_t)(cinfo.output_scanline + n) * width * channels ];
+	n++;
+      }
+      jpeg_read_scanlines( &cinfo, rows, n );
+    }
+
+    jpeg_finish_decompress( &cinfo );
+  }
+  catch( const string& error ){
+    // Reset our decompressor and force the tables to be reloaded for the next tile
+    jpeg_abort_decompress( &cinfo );
+    tables.clear();
+    throw;
+  }
+}
@@ -0,0 +1,87 @@
+/*
+    IIPImage Server - Direct decoder for JPEG-encoded TIFF tiles
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _JPEGTILEDECODER_H
+#define _JPEGTILEDECODER_H
+
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+extern "C"{
+/* Undefine this to prevent compiler warning
+ */
+#undef HAVE_STDLIB_H
+#include <jpeglib.h>
+}
+
+
+
+/// Decoder for the abbreviated JPEG streams stored within JPEG-compressed TIFF tiles
+/** libtiff's JPEG codec sets up its decompressor and re-parses the quantization and Huffman tables
+    in the JPEGTABLES tag for each directory of each opened file. This class instead keeps a single
+    decompressor for the lifetime of the process, into which the tables are only loaded when they
+    differ from those last used, and decodes raw tile data read with TIFFReadRawTile() directly into
+    the tile buffer. Colour tiles can optionally be left as YCbCr if they are to be re-encoded as JPEG.
+    Errors are thrown as strings.
+ */
+class JPEGTileDecoder {
+
+ private:
+
+  /// libjpeg decompression object and error handler
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+
+  /// Copy of the tables currently loaded into our decompressor
+  std::vector<unsigned char> tables;
+
+
+ public:
+
+  /// Constructor
+  JPEGTileDecoder();
+
+  /// Destructor
+  ~JPEGTileDecoder();
+
+  /// Decode a tile
+  /** @param jpeg_tables contents of the TIFF JPEGTABLES tag
+      @param tables_length length of the tables in bytes
+      @param input raw tile data
+      @param input_length length of the raw tile data in bytes
+      @param width tile width
+      @param height tile height
+      @param channels number of channels: 1 or 3
+      @param ycbcr_input whether 3 channel data is encoded as YCbCr rather than RGB
+      @param ycbcr_output whether YCbCr encoded data should be left as YCbCr rather than converted to RGB
+      @param output buffer of at least width x height x channels bytes
+   */
+  void decode( const unsigned char* jpeg_tables, unsigned int tables_length,
+	       const unsigned char* input, unsigned int input_length,
+	       unsigned int width, unsigned int height, unsigned int channels,
+	       bool ycbcr_input, bool ycbcr_output, unsigned char* output );
+
+};
+
+
+#endif
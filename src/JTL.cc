@@ -20,6 +20,8 @@
 
 #include "Task.h"
 #include "Transforms.h"
+#include "TileFastPath.h"
+#include "SequencePrefetch.h"
 
 #include <cmath>
 #include <sstream>
@@ -27,7 +29,7 @@
 using namespace std;
 
 
-void JTL::send( Session* session, int resolution, int tile ){
+void JTL::send( Session* session, int resolution, int tile, unsigned int tw, unsigned int th ){
 
   Timer function_timer;
 
@@ -58,8 +60,10 @@ void JTL::send( Session* session, int resolution, int tile ){
     int vipsres = (*session->image)->getNativeResolution( resolution );
     unsigned int im_width = (*session->image)->image_widths[vipsres];
     unsigned int im_height = (*session->image)->image_heights[vipsres];
-    unsigned int tw = (*session->image)->tile_widths[vipsres];
-    unsigned int th = (*session->image)->tile_heights[vipsres];
+    if( tw == 0 || th == 0 ){
+      tw = (*session->image)->tile_widths[vipsres];
+      th = (*session->image)->tile_heights[vipsres];
+    }
     int ntiles = (int) ceil( (double)im_width/tw ) * (int) ceil( (double)im_height/th );
     tile = ntiles - tile - 1;
   }
@@ -82,48 +86,53 @@ void JTL::send( Session* session, int resolution, int tile ){
 #endif
 #ifdef HAVE_WEBP
   else if( session->view->output_format == ImageEncoding::WEBP ) compressor = session->webp;
+#endif
+#ifdef HAVE_ZLIB
+  else if( session->view->output_format == ImageEncoding::DEFLATE ) compressor = session->tiff;
 #endif
   else compressor = session->jpeg;
 
 
-  TileManager tilemanager( session->tileCache, *session->image, session->watermark, compressor, session->logfile, session->loglevel );
-
-
-  // First calculate histogram if we have asked for either binarization,
-  //  histogram equalization or contrast stretching
-  if( session->view->requireHistogram() && (*session->image)->histogram.empty() ){
+  TileManager tilemanager( session->tileCache, *session->image, session->watermark, compressor, session->logfile, session->loglevel, session->memcached );
+  tilemanager.setOverload( session->overload );
+  tilemanager.setTileSize( tw, th );
 
-    if( session->loglevel >= 4 ) function_timer.start();
 
-    // Retrieve an uncompressed version of our smallest tile
-    // which should be sufficient for calculating the histogram
-    RawTile thumbnail = tilemanager.getTile( 0, 0, 0, session->view->yangle, session->view->getLayers(), ImageEncoding::RAW );
+  // Request uncompressed tile if raw pixel data is required for processing. Deflate compressed TIFF
+  // output carries any bit depth and number of channels, so only needs raw data for processing
+  if( ( ct != ImageEncoding::DEFLATE &&
+	( (*session->image)->getNumBitsPerPixel() > 8 || (*session->image)->getColorSpace() == ColorSpace::CIELAB
+	  || (*session->image)->getNumChannels() == 2 || (*session->image)->getNumChannels() > 3 ) )
+      || ( (session->view->colorspace==ColorSpace::GREYSCALE || session->view->colorspace==ColorSpace::BINARY) &&
+	   (*session->image)->getNumChannels()==3 && (*session->image)->getNumBitsPerPixel()==8 )
+      || session->view->floatProcessing() || session->view->equalization
+      || session->view->getRotation() != 0.0 || session->view->flip != 0
+      ) ct = ImageEncoding::RAW;
 
-    // Calculate histogram
-    (*session->image)->histogram =
-      session->processor->histogram( thumbnail, (*session->image)->max, (*session->image)->min );
 
-    if( session->loglevel >= 4 ){
-      *(session->logfile) << "JTL :: Calculated histogram in "
-			  << function_timer.getTime() << " microseconds" << endl;
+  // Processed tiles are cached after encoding using a key derived from our processing parameters
+  string processing;
+  if( ct != session->view->output_format ){
+    processing = session->view->getProcessingKey( (*session->image)->min, (*session->image)->max );
+    RawTile processed;
+    if( tilemanager.getProcessedTile( resolution, tile, session->view->xangle, session->view->yangle,
+				      session->view->output_format, processing, processed ) ){
+      this->sendTile( session, processed, compressor->getMimeType() );
+      TileFastPath::record( session, processed, processing + tilemanager.servedKey( resolution ), compressor->getMimeType() );
+      if( session->loglevel >= 2 ){
+	*(session->logfile) << "JTL :: Total command time " << command_timer.getTime() << " microseconds" << endl;
+      }
+      return;
     }
-
-    // Insert the histogram into our image cache
-    const string key = (*session->image)->getImagePath();
-    imageCacheMapType::iterator i = session->imageCache->find(key);
-    if( i != session->imageCache->end() ) (i->second).histogram = (*session->image)->histogram;
   }
 
 
+  // Calculate our image statistics and histogram if we have asked for either binarization, histogram
+  // equalization or contrast stretching or if we need a sample range for floating point data
+  if( session->view->requireHistogram() || (*session->image)->default_range ){
+    this->loadStatistics( tilemanager );
+  }
 
-  // Request uncompressed tile if raw pixel data is required for processing
-  if( (*session->image)->getNumBitsPerPixel() > 8 || (*session->image)->getColorSpace() == ColorSpace::CIELAB
-      || (*session->image)->getNumChannels() == 2 || (*session->image)->getNumChannels() > 3
-      || ( (session->view->colorspace==ColorSpace::GREYSCALE || session->view->colorspace==ColorSpace::BINARY) &&
-	   (*session->image)->getNumChannels()==3 && (*session->image)->getNumBitsPerPixel()==8 )
-      || session->view->floatProcessing() || session->view->equalization
-      || session->view->getRotation() != 0.0 || session->view->flip != 0
-      ) ct = ImageEncoding::RAW;
 
 
   // Set the physical output resolution for this particular view and zoom level
@@ -142,6 +151,7 @@ void JTL::send( Session* session, int resolution, int tile ){
 
 
   // Embed ICC profile
+  if( session->view->embedICC() ) loadMetadata();
   if( session->view->embedICC() && ((*session->image)->getMetadata("icc").size()>0) ){
     if( session->loglevel >= 3 ){
       *(session->logfile) << "JTL :: Embedding ICC profile with size "
@@ -151,8 +161,9 @@ void JTL::send( Session* session, int resolution, int tile ){
   }
 
 
-  RawTile rawtile = tilemanager.getTile( resolution, tile, session->view->xangle,
-					 session->view->yangle, session->view->getLayers(), ct );
+  // Reduce the bands of an image stack if requested
+  RawTile rawtile = ( session->view->reduction != REDUCE_NONE ) ? this->reduceStack( tilemanager, resolution, tile ) :
+    tilemanager.getTile( resolution, tile, session->view->xangle, session->view->yangle, session->view->getLayers(), ct );
 
 
   int len = rawtile.dataLength;
@@ -165,6 +176,18 @@ void JTL::send( Session* session, int resolution, int tile ){
   }
 
 
+  // Full precision tiles without any processing are sent exactly as encoded by our tile manager
+  if( rawtile.compressionType == ImageEncoding::DEFLATE ){
+    this->sendTile( session, rawtile, compressor->getMimeType() );
+    TileFastPath::record( session, rawtile, tilemanager.servedKey( resolution ), compressor->getMimeType() );
+    if( session->view->reduction == REDUCE_NONE ) SequencePrefetch::record( session, rawtile, compressor, tw, th );
+    if( session->loglevel >= 2 ){
+      *(session->logfile) << "JTL :: Total command time " << command_timer.getTime() << " microseconds" << endl;
+    }
+    return;
+  }
+
+
   // Convert CIELAB to sRGB
   if( (*session->image)->getColorSpace() == ColorSpace::CIELAB ){
 
@@ -186,6 +209,12 @@ void JTL::send( Session* session, int resolution, int tile ){
     vector <float> min = (*session->image)->min;
     vector <float> max = (*session->image)->max;
 
+    // Stack reductions have their own range unless one has been given explicitly
+    if( session->view->reduction != REDUCE_NONE && !session->view->minmax ){
+      session->processor->reductionRange( session->view->reduction,
+					  (*session->image)->getHorizontalViewsList().size(), min, max );
+    }
+
     // Change our image max and min if we have asked for a contrast stretch
     if( session->view->contrast == -1 ){
 
@@ -216,6 +245,17 @@ void JTL::send( Session* session, int resolution, int tile ){
     }
 
 
+    // Drop any bands not used by a color twist so that they are neither normalized nor processed
+    vector< vector<float> > ctw = session->view->ctw;
+    if( ctw.size() && !session->view->shaded ){
+      session->processor->twistBands( rawtile, ctw, min, max );
+      if( session->loglevel >= 5 ){
+	*(session->logfile) << "JTL :: Color twist uses " << rawtile.channels << " band"
+			    << ((rawtile.channels>1)?"s":"") << endl;
+      }
+    }
+
+
     // Apply normalization and float conversion
     if( session->loglevel >= 4 ){
       *(session->logfile) << "JTL :: Normalizing and converting to float";
@@ -241,12 +281,12 @@ void JTL::send( Session* session, int resolution, int tile ){
 
 
     // Apply color twist if requested
-    if( session->view->ctw.size() ){
+    if( ctw.size() ){
       if( session->loglevel >= 4 ){
 	*(session->logfile) << "JTL :: Applying color twist";
 	function_timer.start();
       }
-      session->processor->twist( rawtile, session->view->ctw );
+      session->processor->twist( rawtile, ctw );
       if( session->loglevel >= 4 ){
 	*(session->logfile) << " in " << function_timer.getTime() << " microseconds" << endl;
       }
@@ -424,11 +464,43 @@ void JTL::send( Session* session, int resolution, int tile ){
   }
 
 
+  // Cache our processed and encoded tile unless it has been degraded due to overload
+  if( !processing.empty() && !session->overload ) tilemanager.storeProcessedTile( rawtile, processing );
+
+
+  this->sendTile( session, rawtile, compressor->getMimeType() );
+
+
+  // Record the cache key of our tile so that repeat requests can be answered before the image is opened
+  if( rawtile.compressionType == session->view->output_format ){
+    TileFastPath::record( session, rawtile, processing + tilemanager.servedKey( resolution ), compressor->getMimeType() );
+  }
+
+
+  // Unprocessed tiles of image sequences and stacks are prefetched for adjacent angles or bands
+  if( processing.empty() && session->view->reduction == REDUCE_NONE ){
+    SequencePrefetch::record( session, rawtile, compressor, tw, th );
+  }
+
+
+  // Total JTL response time
+  if( session->loglevel >= 2 ){
+    *(session->logfile) << "JTL :: Total command time " << command_timer.getTime() << " microseconds" << endl;
+  }
+
+}
+
+
+
+void JTL::sendTile( Session* session, const RawTile& rawtile, const string& mimeType ){
+
+  int len = rawtile.dataLength;
+
 #ifndef DEBUG
 
   // Send HTTP header
   stringstream header;
-  header << session->response->createHTTPHeader( compressor->getMimeType(), (*session->image)->getTimestamp(), len );
+  header << session->response->createHTTPHeader( mimeType, (*session->image)->getTimestamp(), len );
   if( session->out->putStr( header.str().c_str(), (int) header.tellp() ) == -1 ){
     if( session->loglevel >= 1 ){
       *(session->logfile) << "JTL :: Error writing HTTP header" << endl;
@@ -455,9 +527,4 @@ void JTL::send( Session* session, int resolution, int tile ){
   // Inform our response object that we have sent something to the client
   session->response->setImageSent();
 
-  // Total JTL response time
-  if( session->loglevel >= 2 ){
-    *(session->logfile) << "JTL :: Total command time " << command_timer.getTime() << " microseconds" << endl;
-  }
-
 }
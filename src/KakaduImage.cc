@@ -506,7 +506,7 @@ RawTile KakaduImage::getTile( int seq, int ang, unsigned int res, int layers, un
 
   // Create our Rawtile object and initialize with data
   RawTile rawtile( tile, res, seq, ang, tw, th, channels, obpc );
-  rawtile.filename = getImagePath();
+  rawtile.imageId = getImageId();
   rawtile.timestamp = timestamp;
   rawtile.allocate();
 
@@ -541,7 +541,7 @@ RawTile KakaduImage::getRegion( int seq, int ang, unsigned int res, int layers,
   if( !( (obpc == 8) || (obpc == 16) ) ) throw file_error( "Kakadu :: Unsupported number of bits" );
 
   RawTile rawtile( 0, res, seq, ang, w, h, channels, obpc );
-  rawtile.filename = getImagePath();
+  rawtile.imageId = getImageId();
   rawtile.timestamp = timestamp;
   rawtile.allocate();
 
@@ -39,6 +39,10 @@
 #include "View.h"
 #include "Timer.h"
 #include "TileManager.h"
+#include "MetadataIndex.h"
+#include "AdmissionControl.h"
+#include "TileFastPath.h"
+#include "SequencePrefetch.h"
 #include "Task.h"
 #include "Environment.h"
 #include "Writer.h"
@@ -125,6 +129,28 @@ void IIPReloadCache( int signal )
 
 
 
+/* Determine whether a request is of a type which is never stored in memcached, so that we can
+   avoid an unnecessary memcached lookup: IIIF info.json (see IIIF.cc), INFO and SHEET replies
+*/
+bool neverCached( const string& request )
+{
+  const string info = "info.json";
+  Tokenizer izer( request, "&" );
+  while( izer.hasMoreTokens() ){
+    string token = izer.nextToken();
+    size_t n = token.find( '=' );
+    if( n == string::npos ) continue;
+    string command = token.substr( 0, n );
+    transform( command.begin(), command.end(), command.begin(), ::tolower );
+    if( command == "info" || command == "sheet" ) return true;
+    if( command == "iiif" && token.length() >= info.length() &&
+	token.compare( token.length() - info.length(), info.length(), info ) == 0 ) return true;
+  }
+  return false;
+}
+
+
+
 /* Handle a termination signal - print out some stats and exit
  */
 void IIPSignalHandler( int signal )
@@ -284,18 +310,53 @@ int main( int argc, char *argv[] )
   FIF::filesystem_suffix = Environment::getFileSystemSuffix();
 
 
+  // Open our persistent metadata index if we have one
+  string metadata_index_path = Environment::getMetadataIndex();
+  MetadataIndex metadata_index( metadata_index_path );
+  if( metadata_index.isOpen() ) FIF::metadata_index = &metadata_index;
+
+
+  // Set up admission control between request classes if enabled
+  string admission_path = Environment::getAdmissionControl();
+  AdmissionControl admission( admission_path, Environment::getAdmissionLimits(),
+			      Environment::getAdmissionBudgets(), Environment::getAdmissionRetryAfter(),
+			      Environment::getMemoryBudget() );
+  admission.setLatencyTarget( Environment::getOverloadLatency() );
+  int overload_quality = Environment::getOverloadQuality();
+
+
+  // Get the tile size served by the IIIF, DeepZoom and Zoomify protocols
+  unsigned int tile_size = Environment::getTileSize();
+
+
+  // Get the interval between image modification checks for our tile fast path
+  TileFastPath::setInterval( Environment::getTileFastPath() );
+
+
+  // Get the number of tiles to prefetch for image sequences and stacks, which requires a tile cache
+  SequencePrefetch::setLimit( (max_image_cache_size > 0) ? Environment::getSequencePrefetch() : 0 );
+
+
   // Get our default quality variable
   int jpeg_quality = Environment::getJPEGQuality();
 
 
   // Get our default PNG compression level
+#ifdef HAVE_PNG
   int png_quality = Environment::getPNGQuality();
+#endif
 
 
   // Get our default WebP compression level
   int webp_quality = Environment::getWebPQuality();
 
 
+  // Get our default Deflate compression level for full precision TIFF output
+#ifdef HAVE_ZLIB
+  int deflate_quality = Environment::getDeflateQuality();
+#endif
+
+
   // Get our max CVT size
   int max_CVT = Environment::getMaxCVT();
 
@@ -383,6 +444,38 @@ int main( int argc, char *argv[] )
 
     logfile << "Setting filesystem prefix to '" << FIF::filesystem_prefix << "'" << endl;
     logfile << "Setting filesystem suffix to '" << FIF::filesystem_suffix << "'" << endl;
+    if( !metadata_index_path.empty() ){
+      if( FIF::metadata_index ){
+	logfile << "Setting persistent metadata index to '" << metadata_index_path << "' containing "
+		<< FIF::metadata_index->size() << " images" << endl;
+      }
+      else logfile << "Unable to open persistent metadata index '" << metadata_index_path << "'" << endl;
+    }
+    if( !admission_path.empty() ){
+      if( admission.isEnabled() ){
+	logfile << "Setting admission control state file to '" << admission_path << "' with limits "
+		<< admission.getConfiguration() << endl;
+      }
+      else logfile << "Unable to open admission control state file '" << admission_path << "'" << endl;
+    }
+    if( admission.getLatencyTarget() > 0 ){
+      logfile << "Setting overload latency target to " << admission.getLatencyTarget() << " ms with degraded quality "
+	      << overload_quality << endl;
+    }
+    if( admission.getMemoryBudget() > 0 ){
+      logfile << "Setting memory budget for region exports to " << admission.getMemoryBudget() << " MB "
+	      << (admission.isEnabled() ? "shared between processes" : "per process") << endl;
+    }
+    if( tile_size > 0 ){
+      logfile << "Setting served tile size for IIIF, DeepZoom and Zoomify to " << tile_size << endl;
+    }
+    if( TileFastPath::isEnabled() ){
+      logfile << "Setting tile fast path image modification check interval to " << TileFastPath::getInterval() << " seconds" << endl;
+    }
+    else logfile << "Tile fast path disabled" << endl;
+    if( SequencePrefetch::isEnabled() ){
+      logfile << "Setting prefetch of adjacent angles and bands of image sequences to " << SequencePrefetch::getLimit() << " tiles" << endl;
+    }
     logfile << "Setting default JPEG quality to " << jpeg_quality << endl;
 #ifdef HAVE_PNG
     logfile << "Setting default PNG compression level to " << png_quality << endl;
@@ -391,6 +484,9 @@ int main( int argc, char *argv[] )
     logfile << "Setting default WebP compression level to ";
     if( webp_quality == -1 ) logfile << "lossless" << endl;
     else logfile << webp_quality << endl;
+#endif
+#ifdef HAVE_ZLIB
+    logfile << "Setting default Deflate compression level to " << deflate_quality << endl;
 #endif
     logfile << "Setting maximum CVT size to " << max_CVT << endl;
     logfile << "Setting HTTP Cache-Control header to '" << cache_control << "'" << endl;
@@ -484,17 +580,29 @@ int main( int argc, char *argv[] )
   // Get our list of memcached servers if we have any and the timeout
   string memcached_servers = Environment::getMemcachedServers();
   unsigned int memcached_timeout = Environment::getMemcachedTimeout();
+  unsigned int memcached_queue = Environment::getMemcachedQueue();
 
   // Create our memcached object
-  Memcache memcached( memcached_servers, memcached_timeout );
+  Memcache memcached( memcached_servers, memcached_timeout, memcached_queue );
   if( loglevel >= 1 ){
     if( memcached.connected() ){
       logfile << "Memcached support enabled. Connected to servers: '" << memcached_servers
 	      << "' with timeout " << memcached_timeout << endl;
+      if( memcached.asynchronous() ){
+	logfile << "Memcached writes performed in background with a maximum queue of "
+		<< memcached_queue << " MB" << endl;
+      }
     }
     else logfile << "Unable to connect to Memcached servers: '" << memcached.error() << "'" << endl;
   }
 
+  // Whether to also share individual encoded tiles via memcached
+  bool memcached_tiles = Environment::getMemcachedTiles();
+  Memcache* tile_store = ( memcached_tiles && memcached.connected() ) ? &memcached : NULL;
+  if( loglevel >= 1 && tile_store ){
+    logfile << "Memcached tile sharing enabled" << endl;
+  }
+
 #endif
 
 
@@ -509,38 +617,35 @@ int main( int argc, char *argv[] )
 
 #ifdef ENABLE_DL
 
-  map <string, string> moduleList;
-  string modulePath;
-  envpara = getenv( "DECODER_MODULES" );
+  unsigned int modules = 0;
+  const char* envpara = getenv( "DECODER_MODULES" );
 
   if( envpara ){
 
-    modulePath = string( envpara );
+    string modulePath = string( envpara );
 
-    // Try to open the module
+    // Load each module and register the file extensions it handles
 
     Tokenizer izer( modulePath, "," );
-  
+
     while( izer.hasMoreTokens() ){
-      
+
+      string token = izer.nextToken();
       try{
-	string token = izer.nextToken();
-	DSOImage module;
-	module.Load( token );
-	string type = module.getImageType();
+	string description = DSOImage::loadModule( token );
 	if( loglevel >= 1 ){
-	  logfile << "Loading external module: " << module.getDescription() << endl;
+	  logfile << "Loading external module: " << description << " (" << token << ")" << endl;
 	}
-	moduleList[ type ] = token;
+	modules++;
       }
       catch( const string& error ){
-	if( loglevel >= 1 ) logfile << error << endl;
+	if( loglevel >= 1 ) logfile << "Unable to load module " << token << ": " << error << endl;
       }
 
     }
-    
+
     // Tell us what's happened
-    if( loglevel >= 1 ) logfile << moduleList.size() << " external modules loaded" << endl;
+    if( loglevel >= 1 ) logfile << modules << " external modules loaded" << endl;
 
   }
 
@@ -597,13 +702,16 @@ int main( int argc, char *argv[] )
     FILE *f = fopen( "iipsrv.debug", "w" );
     if( f == NULL ) exit( 1 );
     FileWriter writer( f );
+    Cancellation cancellation;
 
 #else
 
   // In FCGI mode, listen for FCGI requests
   while( FCGX_Accept_r( &request ) >= 0 ){
 
-    FCGIWriter writer( request.out );
+    // Track whether our client disconnects while we process the request
+    Cancellation cancellation( request.ipcFd );
+    FCGIWriter writer( request.out, &cancellation );
     request_string.clear();
 
 #endif
@@ -613,15 +721,25 @@ int main( int argc, char *argv[] )
     if( loglevel >= 2 ) request_timer.start();
 
 
+    // Check whether we are overloaded. If so, use faster and lower quality encoding
+    bool overload = admission.overloaded();
+    Timer latency_timer;
+    latency_timer.start();
+    AdmissionControl::RequestClass request_class = AdmissionControl::INFO;
+
+
     // Declare our image pointer here outside of the try scope
     //  so that we can close the image on exceptions
     IIPImage *image = NULL;
-    JPEGCompressor jpeg( jpeg_quality );
+    JPEGCompressor jpeg( overload ? std::min( jpeg_quality, overload_quality ) : jpeg_quality );
 #ifdef HAVE_PNG
-    PNGCompressor png( png_quality );
+    PNGCompressor png( overload ? std::min( png_quality, 1 ) : png_quality );
 #endif
 #ifdef HAVE_WEBP
-    WebPCompressor webp( webp_quality );
+    WebPCompressor webp( ( overload && (webp_quality == -1 || webp_quality > overload_quality) ) ? overload_quality : webp_quality );
+#endif
+#ifdef HAVE_ZLIB
+    TIFFCompressor tiff( overload ? std::min( deflate_quality, 1 ) : deflate_quality );
 #endif
 
 
@@ -639,6 +757,12 @@ int main( int argc, char *argv[] )
     response.setCORS( cors );
     response.setCacheControl( cache_control );
 
+    // Degraded responses must not be cached
+    if( overload ){
+      response.setCacheControl( "no-store" );
+      response.setCachability( false );
+    }
+
 
     try{
 
@@ -653,11 +777,23 @@ int main( int argc, char *argv[] )
 #endif
 #ifdef HAVE_WEBP
       session.webp = &webp;
+#endif
+#ifdef HAVE_ZLIB
+      session.tiff = &tiff;
 #endif
       session.loglevel = loglevel;
       session.logfile = &logfile;
       session.imageCache = &imageCache;
       session.tileCache = &tileCache;
+#ifdef HAVE_MEMCACHED
+      session.memcached = tile_store;
+#else
+      session.memcached = NULL;
+#endif
+      session.admission = &admission;
+      session.overload = overload;
+      session.cancellation = &cancellation;
+      session.tileSize = tile_size;
       session.out = &writer;
       session.watermark = &watermark;
       session.headers.clear();
@@ -774,11 +910,19 @@ int main( int argc, char *argv[] )
       if( !copyright.empty() ) session.headers["COPYRIGHT"] = copyright;
 
 
+      // Answer repeated tile requests directly from our tile cache if possible, but only if we haven't had
+      // an if_modified_since request, which requires the image timestamp to be checked
+      if( session.headers.find( "HTTP_IF_MODIFIED_SINCE" ) == session.headers.end() &&
+	  TileFastPath::serve( &session, request_string ) ){
+	throw( TILE_FAST_PATH_HIT );
+      }
+
+
 #ifdef HAVE_MEMCACHED
 #ifndef DEBUG
       // Check whether this exists in memcached, but only if we haven't had an if_modified_since
-      // request, which should always be faster to send
-      if( !header || session.headers["HTTP_IF_MODIFIED_SINCE"].empty() ){
+      // request, which should always be faster to send. Skip requests which are never stored
+      if( (!header || session.headers["HTTP_IF_MODIFIED_SINCE"].empty()) && neverCached( request_string ) == false ){
 	char* memcached_response = NULL;
 	if( (memcached_response = memcached.retrieve( request_string )) ){
 	  writer.putStr( memcached_response, memcached.length() );
@@ -791,6 +935,24 @@ int main( int argc, char *argv[] )
 #endif
 
 
+      // Admit this request according to its class, rejecting it if no slot becomes free in time
+      request_class = AdmissionControl::classify( request_string );
+      if( admission.isEnabled() ){
+	if( !admission.admit( request_class ) ){
+	  if( loglevel >= 1 ){
+	    logfile << "Admission control :: rejecting " << AdmissionControl::className( request_class ) << " request" << endl;
+	  }
+	  throw( 503 );
+	}
+	if( loglevel >= 3 ){
+	  logfile << "Admission control :: admitted " << AdmissionControl::className( request_class ) << " request" << endl;
+	}
+      }
+      if( overload && loglevel >= 2 ){
+	logfile << "Overload mode :: serving degraded response" << endl;
+      }
+
+
       // Parse up the command list
       list < pair<string,string> > requests;
       list < pair<string,string> > :: const_iterator commands;
@@ -878,8 +1040,10 @@ int main( int argc, char *argv[] )
 	memcached_timer.start();
 	memcached.store( session.headers["QUERY_STRING"], writer.buffer, writer.sz );
 	if( loglevel >= 3 ){
-	  logfile << "Memcached :: stored " << writer.sz << " bytes in "
-		  << memcached_timer.getTime() << " microseconds" << endl;
+	  logfile << "Memcached :: " << (memcached.asynchronous() ? "queued " : "stored ") << writer.sz
+		  << " bytes in " << memcached_timer.getTime() << " microseconds";
+	  if( memcached.dropped() > 0 ) logfile << " (" << memcached.dropped() << " writes dropped)";
+	  logfile << endl;
 	}
       }
 #endif
@@ -925,6 +1089,33 @@ int main( int argc, char *argv[] )
 	  }
 	  break;
 
+        case TILE_FAST_PATH_HIT:
+	  if( loglevel >= 2 ){
+	    logfile << "Tile fast path hit" << endl;
+	  }
+	  break;
+
+        case 503:
+	  // Shed load when admission control rejects a request
+	  status = "Status: 503 Service Unavailable\r\nServer: iipsrv/" + version +
+	    "\r\nRetry-After: " + to_string( admission.getRetryAfter() ) +
+	    "\r\nContent-Type: text/plain; charset=utf-8" +
+	    (response.getCORS().length() ? "\r\n" + response.getCORS() : "") +
+	    "\r\n\r\nServer busy";
+	  writer.putS( status.c_str() );
+	  writer.flush();
+	  if( loglevel >= 2 ){
+	    logfile << "Sending HTTP 503 Service Unavailable" << endl;
+	  }
+	  break;
+
+        case CLIENT_DISCONNECTED:
+	  // Client has gone away, so there is nobody to send a response to
+	  if( loglevel >= 2 ){
+	    logfile << "Client disconnected: request abandoned" << endl;
+	  }
+	  break;
+
         default:
           if( loglevel >= 1 ){
 	    logfile << "Unsupported HTTP status code: " << code << endl << endl;
@@ -1026,6 +1217,8 @@ int main( int argc, char *argv[] )
     }
     delete image;
     image = NULL;
+    admission.release();
+    if( request_class == AdmissionControl::TILE ) admission.recordLatency( latency_timer.getTime() );
     IIPcount ++;
 
 
@@ -1042,6 +1235,23 @@ int main( int argc, char *argv[] )
     }
 
 
+    // Once our response is complete, decode the tiles of the angles or bands adjacent to those just
+    // requested for an image sequence or stack, giving way as soon as another request arrives
+    if( SequencePrefetch::isPending() && !admission.overloaded() ){
+#ifdef HAVE_MEMCACHED
+      Memcache* shared = tile_store;
+#else
+      Memcache* shared = NULL;
+#endif
+#ifndef DEBUG
+      FCGX_Finish_r( &request );
+      SequencePrefetch::run( &tileCache, &watermark, shared, &logfile, loglevel, request.listen_sock, request.ipcFd );
+#else
+      SequencePrefetch::run( &tileCache, &watermark, shared, &logfile, loglevel, -1, -1 );
+#endif
+    }
+
+
 
     ///////// End of FCGI_ACCEPT while loop or while loop in debug mode //////////
   }
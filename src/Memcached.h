@@ -23,6 +23,16 @@
 #define _MEMCACHED_H
 
 #include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "RawTile.h"
 
 // Need to undefine _WIN32 on Windows to avoid compilation problems with winsock2.h and ws2def.h
 // includes when using libmemcached-awesome                                                                           
@@ -35,6 +45,28 @@
 typedef memcached_return memcached_return_t;
 #endif
 
+
+/// Header stored in front of tile data within memcached
+/** Contains the minimum set of RawTile fields needed to reconstruct a tile on any node.
+    The magic value also guards against nodes with different byte orders or versions.
+ */
+struct MemcachedTileHeader {
+  uint32_t magic;
+  uint32_t width;
+  uint32_t height;
+  int32_t channels;
+  int32_t bpc;
+  int32_t sampleType;
+  int32_t compressionType;
+  int32_t quality;
+  int64_t timestamp;
+  uint64_t keyHash;         ///< 64 bit FNV-1a hash of the full tile key
+  uint32_t keyLength;       ///< Length of the full tile key
+  uint32_t dataLength;
+};
+
+#define MEMCACHED_TILE_MAGIC 0x49495032  // "IIP2"
+
 /// Cache to store raw tile data
 
 class Memcache {
@@ -60,16 +92,117 @@ class Memcache {
   /// Flag whether we are connected
   bool _connected;
 
+  /// Separate memcached structure used by our background writer thread
+  memcached_st *_writer_memc;
+
+  /// Background writer thread
+  std::thread _writer;
+
+  /// Mutex protecting our write queue
+  std::mutex _queue_mutex;
+
+  /// Condition variable used to wake up our writer thread
+  std::condition_variable _queue_condition;
+
+  /// Queue of pending writes: key and data
+  std::deque< std::pair<std::string,std::string> > _queue;
+
+  /// Number of bytes currently in our write queue
+  size_t _queued;
+
+  /// Maximum number of bytes allowed in our write queue. Zero for synchronous writes
+  size_t _max_queued;
+
+  /// Number of writes dropped because our queue was full
+  unsigned long _dropped;
+
+  /// Flag to tell our writer thread to exit
+  bool _stop;
+
+
+  /// Background writer loop: pops queued items and sends them to memcached
+  void writerLoop(){
+    while( true ){
+      std::pair<std::string,std::string> item;
+      {
+	std::unique_lock<std::mutex> lock( _queue_mutex );
+	while( !_stop && _queue.empty() ) _queue_condition.wait( lock );
+	if( _queue.empty() ) return;   // Only exit once our queue has been flushed
+	item.swap( _queue.front() );
+	_queue.pop_front();
+	_queued -= item.first.length() + item.second.length();
+      }
+      memcached_set( _writer_memc, item.first.c_str(), item.first.length(),
+		     item.second.data(), item.second.length(), _timeout, 0 );
+    }
+  }
+
+
+  /// 64 bit FNV-1a hash, which unlike std::hash is the same for every process and build
+  static uint64_t hashKey( const std::string& key ){
+    uint64_t hash = 14695981039346656037ULL;
+    for( size_t i = 0; i < key.length(); i++ ){
+      hash ^= (unsigned char) key[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+
+  /// Decode a tile stored with storeTile()
+  /** @param key tile key under which the tile was requested
+      @param buffer data returned from memcached
+      @param length length of data
+      @param tile tile to be filled
+      @return true on success, false if the data is invalid or belongs to another tile key
+  */
+  static bool decodeTile( const std::string& key, const char* buffer, size_t length, RawTile& tile ){
+
+    MemcachedTileHeader header;
+    if( length < sizeof(MemcachedTileHeader) ) return false;
+    memcpy( &header, buffer, sizeof(MemcachedTileHeader) );
+
+    // Hashed memcached keys may collide, so check the identity of our tile
+    if( header.magic != MEMCACHED_TILE_MAGIC ||
+	header.keyLength != key.length() || header.keyHash != hashKey( key ) ||
+	length != sizeof(MemcachedTileHeader) + header.dataLength ) return false;
+
+    // Free any existing buffer before changing the data type
+    if( tile.memoryManaged ) tile.deallocate( tile.data );
+
+    tile.width = header.width;
+    tile.height = header.height;
+    tile.channels = header.channels;
+    tile.bpc = header.bpc;
+    tile.sampleType = (SampleType) header.sampleType;
+    tile.compressionType = (ImageEncoding) header.compressionType;
+    tile.quality = header.quality;
+    tile.timestamp = (time_t) header.timestamp;
+
+    // Round up our allocation to a whole number of samples
+    tile.allocate( (header.dataLength + 3) & ~3u );
+    memcpy( tile.data, buffer + sizeof(MemcachedTileHeader), header.dataLength );
+    tile.dataLength = header.dataLength;
+
+    return true;
+  }
+
 
  public:
 
   /// Constructor
   /** @param servernames list of memcached servers
       @param timeout memcached timeout - defaults to 1 hour (3600 seconds)
+      @param queue maximum size in MB of the background write queue - 0 for synchronous writes
   */
-  Memcache( const std::string& servernames = "localhost", unsigned int timeout = 3600 ) {
+  Memcache( const std::string& servernames = "localhost", unsigned int timeout = 3600, unsigned int queue = 0 ) {
 
     _length = 0;
+    _writer_memc = NULL;
+    _queued = 0;
+    _max_queued = (size_t) queue * 1024000;
+    _dropped = 0;
+    _stop = false;
 
     // Set our timeout
     _timeout =  timeout;
@@ -94,11 +227,28 @@ class Memcache {
 
     if( memcached_server_count(_memc) > 0 ) _connected = true;
     else _connected = false;
+
+    // Start our background writer with its own connection as memcached_st objects are not thread-safe
+    if( _connected && _max_queued > 0 ){
+      _writer_memc = memcached_clone( NULL, _memc );
+      if( _writer_memc ) _writer = std::thread( &Memcache::writerLoop, this );
+    }
   };
 
 
   /// Destructor
   ~Memcache() {
+    // Flush and stop our writer thread
+    if( _writer.joinable() ){
+      {
+	std::lock_guard<std::mutex> lock( _queue_mutex );
+	_stop = true;
+      }
+      _queue_condition.notify_one();
+      _writer.join();
+    }
+    if( _writer_memc ) memcached_free(_writer_memc);
+
     // Disconnect from our servers and free our memcached structure
     if( _servers ) memcached_server_free(_servers); 
     if( _memc ) memcached_free(_memc);
@@ -106,7 +256,9 @@ class Memcache {
 
 
   /// Insert data into our cache
-  /** @param key key used for cache
+  /** If a background write queue is available, the data is copied onto the queue and
+      this function returns immediately. If the queue is full, the write is dropped.
+      @param key key used for cache
       @param data pointer to the data to be stored
       @param length length of data to be stored
   */
@@ -115,6 +267,21 @@ class Memcache {
     if( !_connected ) return;
  
     std::string k = "iipsrv::" + key;
+
+    if( _writer.joinable() ){
+      {
+	std::lock_guard<std::mutex> lock( _queue_mutex );
+	if( _queued + k.length() + length > _max_queued ){
+	  _dropped++;
+	  return;
+	}
+	_queue.push_back( std::make_pair( k, std::string( (const char*) data, length ) ) );
+	_queued += k.length() + length;
+      }
+      _queue_condition.notify_one();
+      return;
+    }
+
     _rc = memcached_set( _memc, k.c_str(), k.length(),
                         (char*) data, length,
                         _timeout, 0 );
@@ -135,6 +302,100 @@ class Memcache {
   }
 
 
+  /// Insert an encoded tile into our cache
+  /** The tile is stored as a compact header followed by the encoded data
+      @param key tile key (as generated by Cache::getSharedIndex)
+      @param tile tile to be stored
+  */
+  void storeTile( const std::string& key, const RawTile& tile ){
+
+    if( !_connected || !tile.data || tile.dataLength == 0 ) return;
+
+    MemcachedTileHeader header;
+    header.magic = MEMCACHED_TILE_MAGIC;
+    header.width = tile.width;
+    header.height = tile.height;
+    header.channels = tile.channels;
+    header.bpc = tile.bpc;
+    header.sampleType = (int32_t) tile.sampleType;
+    header.compressionType = (int32_t) tile.compressionType;
+    header.quality = tile.quality;
+    header.timestamp = (int64_t) tile.timestamp;
+    header.keyHash = hashKey( key );
+    header.keyLength = key.length();
+    header.dataLength = tile.dataLength;
+
+    unsigned int length = sizeof(MemcachedTileHeader) + tile.dataLength;
+    char* buffer = new char[length];
+    memcpy( buffer, &header, sizeof(MemcachedTileHeader) );
+    memcpy( buffer + sizeof(MemcachedTileHeader), tile.data, tile.dataLength );
+
+    this->store( tileKey( key ), buffer, length );
+    delete[] buffer;
+  }
+
+
+  /// Retrieve an encoded tile from our cache
+  /** @param key tile key (as generated by Cache::getSharedIndex)
+      @param tile tile to be filled: image identifier, resolution, tile number and sequence numbers
+             should already be set by the caller
+      @return true on success, false if the tile was not found or is invalid
+  */
+  bool retrieveTile( const std::string& key, RawTile& tile ){
+
+    char* buffer = this->retrieve( tileKey( key ) );
+    if( !buffer ) return false;
+
+    bool status = decodeTile( key, buffer, _length, tile );
+    free( buffer );
+    return status;
+  }
+
+
+  /// Retrieve several encoded tiles from our cache in a single round trip
+  /** @param keys list of tile keys (as generated by Cache::getSharedIndex)
+      @param tiles list of tiles of the same size as keys with image identifier, resolution, tile number
+             and sequence numbers already set. Tiles that are found are filled in with their data
+      @return number of tiles found
+  */
+  unsigned int retrieveTiles( const std::vector<std::string>& keys, std::vector<RawTile>& tiles ){
+
+    if( !_connected || keys.empty() ) return 0;
+
+    // Build our list of memcached keys and map these back to our tile indices
+    std::vector<std::string> k;
+    std::vector<const char*> kp;
+    std::vector<size_t> kl;
+    std::map<std::string,size_t> index;
+    k.reserve( keys.size() );
+    for( size_t n = 0; n < keys.size(); n++ ){
+      k.push_back( "iipsrv::" + tileKey( keys[n] ) );
+      index[ k.back() ] = n;
+    }
+    for( size_t n = 0; n < k.size(); n++ ){
+      kp.push_back( k[n].c_str() );
+      kl.push_back( k[n].length() );
+    }
+
+    _rc = memcached_mget( _memc, &kp[0], &kl[0], kp.size() );
+    if( _rc != MEMCACHED_SUCCESS ) return 0;
+
+    unsigned int found = 0;
+    memcached_result_st *result;
+    while( (result = memcached_fetch_result( _memc, NULL, &_rc )) ){
+      std::string key( memcached_result_key_value(result), memcached_result_key_length(result) );
+      std::map<std::string,size_t>::iterator i = index.find( key );
+      if( i != index.end() &&
+	  decodeTile( keys[i->second], memcached_result_value(result), memcached_result_length(result), tiles[i->second] ) ){
+	found++;
+      }
+      memcached_result_free( result );
+    }
+
+    return found;
+  }
+
+
   /// Get error string
   const char* error(){
     return memcached_strerror( _memc, _rc );
@@ -149,6 +410,39 @@ class Memcache {
   bool connected(){ return _connected; };
 
 
+  /// Tell us whether writes are performed asynchronously
+  bool asynchronous(){ return _writer.joinable(); };
+
+
+  /// Return the number of writes dropped because our write queue was full
+  unsigned long dropped(){ return _dropped; };
+
+
+ private:
+
+  /// Create a memcached-safe key for a tile
+  /** Memcached keys are limited to 250 characters and may not contain spaces or control characters,
+      so hash over-long keys and those containing such characters, such as from file paths. The full
+      key is checked against the stored tile on retrieval
+      @param key tile key
+      @return key suitable for memcached
+  */
+  std::string tileKey( const std::string& key ){
+    std::string k = "tile::" + key;
+    bool safe = ( k.length() <= 200 );
+    for( size_t i = 0; safe && i < key.length(); i++ ){
+      unsigned char c = key[i];
+      if( c <= 0x20 || c == 0x7f ) safe = false;
+    }
+    if( !safe ){
+      char tmp[64];
+      snprintf( tmp, 64, "tile::%016llx:%zu", (unsigned long long) hashKey( key ), key.length() );
+      k = std::string( tmp );
+    }
+    return k;
+  }
+
+
 };
 
 
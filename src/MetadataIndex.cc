@@ -0,0 +1,522 @@
+/*
+    IIPImage Server - Persistent image metadata index
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include "MetadataIndex.h"
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#endif
+
+
+using namespace std;
+
+
+// File header and record identifiers. The version must be incremented whenever the
+// serialised layout of IIPImage changes. Each record is followed by a checksum of its
+// key and data, so that records only count once they have been written in full
+static const char index_header[8] = { 'I','I','P','M','I','D','X','1' };
+static const uint32_t record_magic = 0x53504949;   // "IIPS"
+static const uint32_t record_version = 2;
+static const size_t record_header_size = 3 * sizeof(uint32_t);
+static const size_t record_trailer_size = sizeof(uint32_t);
+
+// Minimum size of our index file before it is compacted
+static const size_t compaction_size = 1048576;
+
+
+
+/// FNV-1a checksum of a block of data
+static uint32_t checksum( const char* data, size_t length ){
+  uint32_t h = 2166136261u;
+  for( size_t i = 0; i < length; i++ ){
+    h ^= (unsigned char) data[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+
+
+/// Return the end of a complete record with a valid checksum starting at offset or 0 if there is none
+static size_t recordEnd( const char* map, size_t mapped, size_t offset ){
+
+  if( offset + record_header_size > mapped ) return 0;
+
+  uint32_t magic, key_length, data_length;
+  memcpy( &magic, map + offset, sizeof(uint32_t) );
+  if( magic != record_magic ) return 0;
+  memcpy( &key_length, map + offset + sizeof(uint32_t), sizeof(uint32_t) );
+  memcpy( &data_length, map + offset + 2*sizeof(uint32_t), sizeof(uint32_t) );
+
+  size_t length = (size_t) key_length + (size_t) data_length;
+  if( length > mapped ) return 0;
+  size_t end = offset + record_header_size + length + record_trailer_size;
+  if( end > mapped ) return 0;
+
+  uint32_t sum;
+  memcpy( &sum, map + end - record_trailer_size, sizeof(uint32_t) );
+  if( sum != checksum( map + offset + record_header_size, length ) ) return 0;
+
+  return end;
+}
+
+
+
+/*  Serialisation helpers: values are stored in native byte order as the index
+    is only ever shared between processes on the same host or architecture
+*/
+
+static void put( string& b, uint32_t v ){ b.append( (const char*) &v, sizeof(v) ); }
+static void put( string& b, int64_t v ){ b.append( (const char*) &v, sizeof(v) ); }
+static void put( string& b, float v ){ b.append( (const char*) &v, sizeof(v) ); }
+static void put( string& b, const string& s ){ put( b, (uint32_t) s.length() ); b.append( s ); }
+
+template <class T> static void put( string& b, const vector<T>& v ){
+  put( b, (uint32_t) v.size() );
+  for( typename vector<T>::const_iterator i = v.begin(); i != v.end(); i++ ) put( b, *i );
+}
+
+static void put( string& b, const list<int>& l ){
+  put( b, (uint32_t) l.size() );
+  for( list<int>::const_iterator i = l.begin(); i != l.end(); i++ ) put( b, (uint32_t) *i );
+}
+
+
+
+/// Bounds-checked reader for serialised records
+class RecordReader {
+
+ private:
+  const char *_p, *_end;
+  bool _ok;
+
+  bool take( void* v, size_t n ){
+    if( !_ok || (size_t)(_end - _p) < n ){ _ok = false; return false; }
+    memcpy( v, _p, n );
+    _p += n;
+    return true;
+  }
+
+ public:
+  RecordReader( const char* data, size_t length ) : _p( data ), _end( data + length ), _ok( true ) {};
+
+  bool ok() const { return _ok; };
+
+  uint32_t u32(){ uint32_t v = 0; take( &v, sizeof(v) ); return v; };
+  int64_t i64(){ int64_t v = 0; take( &v, sizeof(v) ); return v; };
+  float f32(){ float v = 0; take( &v, sizeof(v) ); return v; };
+
+  string str(){
+    uint32_t n = u32();
+    if( !_ok || (size_t)(_end - _p) < n ){ _ok = false; return string(); }
+    string s( _p, n );
+    _p += n;
+    return s;
+  }
+
+  template <class T> void get( vector<T>& v, T (RecordReader::*f)() ){
+    uint32_t n = u32();
+    v.clear();
+    for( uint32_t i = 0; i < n && _ok; i++ ) v.push_back( (this->*f)() );
+  }
+
+  void get( list<int>& l ){
+    uint32_t n = u32();
+    l.clear();
+    for( uint32_t i = 0; i < n && _ok; i++ ) l.push_back( (int) u32() );
+  }
+
+};
+
+
+
+MetadataIndex::MetadataIndex( const string& path ) :
+  _path( path ), _fd( -1 ), _map( NULL ), _mapped( 0 ), _scanned( 0 ), _live( 0 )
+{
+#ifndef WIN32
+  if( path.empty() ) return;
+
+  // Create our file with a header if it doesn't already exist. Use O_EXCL so that only a single process writes the header
+  _fd = open( path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_EXCL, 0644 );
+  if( _fd >= 0 ){
+    if( write( _fd, index_header, sizeof(index_header) ) != sizeof(index_header) ){
+      close( _fd );
+      _fd = -1;
+      return;
+    }
+  }
+  else _fd = open( path.c_str(), O_RDWR | O_APPEND );
+
+  if( _fd >= 0 ) refresh();
+#endif
+}
+
+
+
+MetadataIndex::~MetadataIndex()
+{
+#ifndef WIN32
+  unmap();
+  if( _fd >= 0 ) close( _fd );
+#endif
+}
+
+
+
+void MetadataIndex::unmap()
+{
+#ifndef WIN32
+  if( _map ) munmap( _map, _mapped );
+#endif
+  _map = NULL;
+  _mapped = 0;
+}
+
+
+
+bool MetadataIndex::replaced() const
+{
+#ifndef WIN32
+  struct stat a, b;
+  if( stat( _path.c_str(), &a ) != 0 || fstat( _fd, &b ) != 0 ) return false;
+  return ( a.st_ino != b.st_ino || a.st_dev != b.st_dev );
+#else
+  return false;
+#endif
+}
+
+
+
+void MetadataIndex::reopen()
+{
+#ifndef WIN32
+  unmap();
+  close( _fd );
+  _index.clear();
+  _scanned = 0;
+  _live = 0;
+  _fd = open( _path.c_str(), O_RDWR | O_APPEND );
+#endif
+}
+
+
+
+void MetadataIndex::compact()
+{
+#ifndef WIN32
+  // Prevent other processes from appending while we copy our records. If another process has
+  // already replaced our file, there is nothing to do
+  flock( _fd, LOCK_EX );
+  if( replaced() ){
+    flock( _fd, LOCK_UN );
+    return;
+  }
+  refresh();
+
+  string tmp = _path + "." + to_string( (long long) getpid() );
+  int fd = open( tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+  bool ok = ( fd >= 0 );
+
+  // Copy the most recent record for each image including its header and checksum
+  string buffer( index_header, sizeof(index_header) );
+  for( HASHMAP <string, pair<size_t,size_t> >::const_iterator i = _index.begin(); ok && i != _index.end(); i++ ){
+    size_t start = i->second.first - i->first.length() - record_header_size;
+    buffer.append( _map + start, record_header_size + i->first.length() + i->second.second + record_trailer_size );
+    if( buffer.length() >= compaction_size || next( i ) == _index.end() ){
+      ok = ( write( fd, buffer.data(), buffer.length() ) == (ssize_t) buffer.length() );
+      buffer.clear();
+    }
+  }
+  if( ok && _index.empty() ) ok = ( write( fd, buffer.data(), buffer.length() ) == (ssize_t) buffer.length() );
+  if( fd >= 0 && close( fd ) != 0 ) ok = false;
+
+  if( ok ) ok = ( rename( tmp.c_str(), _path.c_str() ) == 0 );
+  else if( fd >= 0 ) unlink( tmp.c_str() );
+
+  flock( _fd, LOCK_UN );
+  if( ok ){
+    reopen();
+    refresh();
+  }
+#endif
+}
+
+
+
+void MetadataIndex::refresh()
+{
+#ifndef WIN32
+  if( _fd < 0 ) return;
+
+  // Start afresh if our file has been compacted by another process
+  if( replaced() ){
+    reopen();
+    if( _fd < 0 ) return;
+  }
+
+  struct stat sb;
+  if( fstat( _fd, &sb ) != 0 ) return;
+  size_t size = (size_t) sb.st_size;
+
+  // Nothing new or header not yet written by another process
+  if( size <= _mapped || size < sizeof(index_header) ) return;
+
+  unmap();
+  void *m = mmap( NULL, size, PROT_READ, MAP_SHARED, _fd, 0 );
+  if( m == MAP_FAILED ) return;
+  _map = (char*) m;
+  _mapped = size;
+
+  // Check our header on first use. If it is not one of our files, ignore the contents
+  if( _scanned == 0 ){
+    if( memcmp( _map, index_header, sizeof(index_header) ) != 0 ){
+      _scanned = _mapped;
+      return;
+    }
+    _scanned = sizeof(index_header);
+  }
+
+  // Scan any complete records we haven't yet seen. Later records supersede earlier ones
+  while( _scanned + record_header_size <= _mapped ){
+
+    size_t end = recordEnd( _map, _mapped, _scanned );
+
+    // Either a record still being written or the remains of a failed or partial write. Such
+    // remains are only skipped once a complete record is found beyond them
+    if( end == 0 ){
+      size_t next = _scanned + 1;
+      while( next + record_header_size <= _mapped && recordEnd( _map, _mapped, next ) == 0 ) next++;
+      if( next + record_header_size > _mapped ) break;
+      _scanned = next;
+      continue;
+    }
+
+    uint32_t key_length, data_length;
+    memcpy( &key_length, _map + _scanned + sizeof(uint32_t), sizeof(uint32_t) );
+    memcpy( &data_length, _map + _scanned + 2*sizeof(uint32_t), sizeof(uint32_t) );
+
+    string key( _map + _scanned + record_header_size, key_length );
+    pair<size_t,size_t>& entry = _index[key];
+    if( entry.second > 0 ) _live -= record_header_size + key_length + entry.second + record_trailer_size;
+    entry = make_pair( _scanned + record_header_size + key_length, (size_t) data_length );
+    _live += end - _scanned;
+    _scanned = end;
+  }
+#endif
+}
+
+
+
+bool MetadataIndex::retrieve( const string& key, IIPImage& image )
+{
+  if( _fd < 0 ) return false;
+
+  HASHMAP <string, pair<size_t,size_t> >::iterator i = _index.find( key );
+  if( i == _index.end() ){
+    // Check whether any other process has added this image
+    refresh();
+    i = _index.find( key );
+    if( i == _index.end() ) return false;
+  }
+
+  RecordReader r( _map + i->second.first, i->second.second );
+  if( r.u32() != record_version ) return false;
+
+  IIPImage tmp( image );
+  tmp.isFile = r.u32();
+  tmp.suffix = r.str();
+  tmp.format = (ImageEncoding) r.u32();
+  tmp.pyramid = (IIPImage::PyramidType) r.u32();
+  tmp.virtual_levels = r.u32();
+  r.get( tmp.horizontalAnglesList );
+  r.get( tmp.verticalAnglesList );
+
+  vector<uint32_t> lut;
+  r.get( lut, &RecordReader::u32 );
+  tmp.lut.assign( lut.begin(), lut.end() );
+
+  uint32_t n = r.u32();
+  tmp.stack.clear();
+  for( uint32_t k = 0; k < n && r.ok(); k++ ){
+    Stack s;
+    s.name = r.str();
+    s.scale = r.f32();
+    tmp.stack.push_back( s );
+  }
+
+  r.get( tmp.resolution_ids, &RecordReader::u32 );
+
+  vector<uint32_t> v;
+  r.get( v, &RecordReader::u32 ); tmp.image_widths.assign( v.begin(), v.end() );
+  r.get( v, &RecordReader::u32 ); tmp.image_heights.assign( v.begin(), v.end() );
+  r.get( v, &RecordReader::u32 ); tmp.tile_widths.assign( v.begin(), v.end() );
+  r.get( v, &RecordReader::u32 ); tmp.tile_heights.assign( v.begin(), v.end() );
+
+  tmp.colorspace = (ColorSpace) r.u32();
+  tmp.dpi_x = r.f32();
+  tmp.dpi_y = r.f32();
+  tmp.dpi_units = (int) r.u32();
+  tmp.numResolutions = r.u32();
+  tmp.bpc = r.u32();
+  tmp.channels = r.u32();
+  tmp.sampleType = (SampleType) r.u32();
+  r.get( tmp.min, &RecordReader::f32 );
+  r.get( tmp.max, &RecordReader::f32 );
+  tmp.default_range = r.u32();
+  tmp.quality_layers = r.u32();
+  tmp.timestamp = (time_t) r.i64();
+
+  tmp.metadata_loaded = r.u32();
+  n = r.u32();
+  tmp.metadata.clear();
+  for( uint32_t k = 0; k < n && r.ok(); k++ ){
+    string name = r.str();
+    tmp.metadata[name] = r.str();
+  }
+
+  r.get( tmp.histogram, &RecordReader::u32 );
+  n = r.u32();
+  tmp.statistics.clear();
+  for( uint32_t k = 0; k < n && r.ok(); k++ ){
+    BandStatistics b;
+    b.minimum = r.f32();
+    b.maximum = r.f32();
+    b.low = r.f32();
+    b.high = r.f32();
+    r.get( b.histogram, &RecordReader::u32 );
+    tmp.statistics.push_back( b );
+  }
+
+  if( !r.ok() || !tmp.isFile || tmp.numResolutions == 0 ) return false;
+
+  // Make sure the image file has not been modified since the record was written
+  struct stat sb;
+  string path = tmp.fileSystemPrefix + tmp.imagePath + tmp.fileSystemSuffix;
+  if( (stat( path.c_str(), &sb ) != 0) || !S_ISREG(sb.st_mode) || (sb.st_mtime != tmp.timestamp) ) return false;
+
+  image = tmp;
+  return true;
+}
+
+
+
+void MetadataIndex::store( const string& key, const IIPImage& image )
+{
+#ifndef WIN32
+  if( _fd < 0 || !image.isFile || image.numResolutions == 0 ) return;
+
+  string data;
+  put( data, record_version );
+  put( data, (uint32_t) image.isFile );
+  put( data, image.suffix );
+  put( data, (uint32_t) image.format );
+  put( data, (uint32_t) image.pyramid );
+  put( data, (uint32_t) image.virtual_levels );
+  put( data, image.horizontalAnglesList );
+  put( data, image.verticalAnglesList );
+
+  vector<uint32_t> lut( image.lut.begin(), image.lut.end() );
+  put( data, lut );
+
+  put( data, (uint32_t) image.stack.size() );
+  for( list<Stack>::const_iterator s = image.stack.begin(); s != image.stack.end(); s++ ){
+    put( data, s->name );
+    put( data, s->scale );
+  }
+
+  put( data, image.resolution_ids );
+  put( data, vector<uint32_t>( image.image_widths.begin(), image.image_widths.end() ) );
+  put( data, vector<uint32_t>( image.image_heights.begin(), image.image_heights.end() ) );
+  put( data, vector<uint32_t>( image.tile_widths.begin(), image.tile_widths.end() ) );
+  put( data, vector<uint32_t>( image.tile_heights.begin(), image.tile_heights.end() ) );
+
+  put( data, (uint32_t) image.colorspace );
+  put( data, image.dpi_x );
+  put( data, image.dpi_y );
+  put( data, (uint32_t) image.dpi_units );
+  put( data, (uint32_t) image.numResolutions );
+  put( data, (uint32_t) image.bpc );
+  put( data, (uint32_t) image.channels );
+  put( data, (uint32_t) image.sampleType );
+  put( data, image.min );
+  put( data, image.max );
+  put( data, (uint32_t) image.default_range );
+  put( data, (uint32_t) image.quality_layers );
+  put( data, (int64_t) image.timestamp );
+
+  put( data, (uint32_t) image.metadata_loaded );
+  put( data, (uint32_t) image.metadata.size() );
+  for( map<const string,string>::const_iterator m = image.metadata.begin(); m != image.metadata.end(); m++ ){
+    put( data, m->first );
+    put( data, m->second );
+  }
+
+  put( data, image.histogram );
+  put( data, (uint32_t) image.statistics.size() );
+  for( vector<BandStatistics>::const_iterator b = image.statistics.begin(); b != image.statistics.end(); b++ ){
+    put( data, b->minimum );
+    put( data, b->maximum );
+    put( data, b->low );
+    put( data, b->high );
+    put( data, b->histogram );
+  }
+
+  // Nothing to do if our most recent record is identical, such as when an image is reloaded unchanged
+  refresh();
+  HASHMAP <string, pair<size_t,size_t> >::const_iterator i = _index.find( key );
+  if( i != _index.end() && i->second.second == data.length() &&
+      memcmp( _map + i->second.first, data.data(), data.length() ) == 0 ) return;
+
+  // Assemble our record and append it with a single write so that records from concurrent processes do not interleave
+  string record;
+  put( record, record_magic );
+  put( record, (uint32_t) key.length() );
+  put( record, (uint32_t) data.length() );
+  record.append( key );
+  record.append( data );
+  put( record, checksum( record.data() + record_header_size, key.length() + data.length() ) );
+
+  // A failed or partial write leaves a record without a valid checksum, which is skipped when scanning.
+  // Hold a shared lock so that we do not append to a file which is being compacted
+  if( _fd < 0 ) return;
+  flock( _fd, LOCK_SH );
+  if( replaced() ){
+    flock( _fd, LOCK_UN );
+    reopen();
+    if( _fd < 0 ) return;
+    flock( _fd, LOCK_SH );
+  }
+  ssize_t written = write( _fd, record.data(), record.length() );
+  (void) written;
+  flock( _fd, LOCK_UN );
+
+  // Every reload and statistics calculation appends a new record, so rewrite our file with only
+  // the most recent record for each image once more than half of it is taken up by older records
+  refresh();
+  if( _mapped > compaction_size && _mapped > 2 * ( _live + sizeof(index_header) ) ) compact();
+#endif
+}
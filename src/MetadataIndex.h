@@ -0,0 +1,122 @@
+/*
+    IIPImage Server - Persistent image metadata index
+
+    Stores the metadata of images on disk so that it survives server restarts
+    and can be shared between several iipsrv processes.
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _METADATAINDEX_H
+#define _METADATAINDEX_H
+
+
+#include <string>
+#include "IIPImage.h"
+#include "Cache.h"
+
+
+
+/// Persistent index of image metadata
+/** The index is a single append-only file consisting of a header followed by a sequence of
+    records, each holding an image path and the serialised contents of its IIPImage object.
+    The file is memory mapped and scanned once at startup to build an in-memory table of
+    record offsets. New records are appended, so that several processes can share the same
+    file, and any records added by other processes are picked up when a lookup misses.
+    Records are validated against the modification time of the image file, so stale entries
+    are ignored and superseded by newer records. Each record ends with a checksum, so that
+    the remains of a partial write are skipped rather than hiding the records that follow.
+    Unchanged records are not appended again and, once older records take up more than half of
+    the file, it is rewritten with only the most recent record for each image and replaced.
+ */
+class MetadataIndex {
+
+ private:
+
+  /// Path to our index file
+  std::string _path;
+
+  /// File descriptor for our index file
+  int _fd;
+
+  /// Pointer to our memory mapped index file
+  char *_map;
+
+  /// Size of the mapped region
+  size_t _mapped;
+
+  /// Offset up to which our index file has been scanned
+  size_t _scanned;
+
+  /// Offset and length of the most recent record for each image
+  HASHMAP <std::string, std::pair<size_t,size_t> > _index;
+
+  /// Total size of the most recent records in bytes
+  size_t _live;
+
+
+  /// Map any new data appended to our index file and add new records to our table
+  void refresh();
+
+  /// Release our memory mapping
+  void unmap();
+
+  /// Return whether our index file has been replaced by another process since we opened it
+  bool replaced() const;
+
+  /// Reopen our index file after it has been replaced, discarding our table
+  void reopen();
+
+  /// Rewrite our index file with only the most recent record for each image
+  void compact();
+
+
+ public:
+
+  /// Constructor
+  /** @param path path to index file, which is created if it does not exist. Disabled if empty */
+  MetadataIndex( const std::string& path );
+
+  /// Destructor
+  ~MetadataIndex();
+
+  /// Return whether our index file is available
+  bool isOpen() const { return _fd >= 0; };
+
+  /// Return the number of images in our index
+  unsigned int size() const { return _index.size(); };
+
+  /// Retrieve image metadata from the index
+  /** The record is only used if the image file still has the same modification time
+      @param key image path as supplied to FIF
+      @param image IIPImage object with file system prefix, suffix and pattern already set
+      @return whether a valid record was found
+   */
+  bool retrieve( const std::string& key, IIPImage& image );
+
+  /// Append image metadata to the index
+  /** Only single file images are stored
+      @param key image path as supplied to FIF
+      @param image fully initialised IIPImage object
+   */
+  void store( const std::string& key, const IIPImage& image );
+
+};
+
+
+#endif
@@ -112,6 +112,8 @@ void OBJ::run( Session* s, const std::string& a )
     stringstream json;
     json << "{ ";
 
+    checkImage();
+    loadMetadata();
     map <const string, string> metadata = (*session->image)->metadata;
     map<const string,string> :: const_iterator i;
     for( i = metadata.begin(); i != metadata.end(); i++ ){
@@ -346,6 +348,7 @@ void OBJ::colorspace( std::string arg ){
 void OBJ::metadata( string field ){
 
   checkImage();
+  loadMetadata();
 
   string metadata = (*session->image)->metadata[field];
 
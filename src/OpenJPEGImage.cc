@@ -349,7 +349,7 @@ RawTile OpenJPEGImage::getTile( int seq, int ang, unsigned int res, int layers,
 
   // Create our Rawtile object and initialize with data
   RawTile rawtile( tile, res, seq, ang, tw, th, channels, obpc );
-  rawtile.filename = getImagePath();
+  rawtile.imageId = getImageId();
   rawtile.timestamp = timestamp;
   rawtile.allocate();
 
@@ -382,7 +382,7 @@ RawTile OpenJPEGImage::getRegion( int ha, int va, unsigned int res, int layers,
   if( !( (obpc == 8) || (obpc == 16) ) ) throw file_error( "OpenJPEG :: Unsupported number of bits" );
 
   RawTile rawtile( 0, res, ha, va, w, h, channels, obpc );
-  rawtile.filename = getImagePath();
+  rawtile.imageId = getImageId();
   rawtile.timestamp = timestamp;
   rawtile.allocate();
 
@@ -119,6 +119,7 @@ void PFL::run( Session* session, const std::string& argument ){
 
   // Create our tilemanager object
   TileManager tilemanager( session->tileCache, *session->image, session->watermark, session->jpeg, session->logfile, session->loglevel );
+  tilemanager.setCancellation( session->cancellation );
 
 
   // Use our horizontal views function to get a list of available spectral images
@@ -148,6 +149,9 @@ void PFL::run( Session* session, const std::string& argument ){
     string name;
     float scale = 1.0;
 
+    // Stop if our client has gone away
+    if( session->cancellation ) session->cancellation->check();
+
     // Get details from our stack if we have one
     if( haveStack ){
       if( j != stack.end() ){
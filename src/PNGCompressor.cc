@@ -19,6 +19,7 @@
 
 
 #include "PNGCompressor.h"
+#include <algorithm>
 
 using namespace std;
 
@@ -132,21 +133,9 @@ void PNGCompressor::InitCompression( const RawTile& rawtile, unsigned int strip_
   png_set_write_fn( dest.png_ptr, (png_voidp) &dest, png_write_data, png_flush );
 
 
-  // Set basic metadata
-  png_set_IHDR(
-	       dest.png_ptr, dest.info_ptr,
-	       width, height,
-	       rawtile.bpc,
-	       ( (channels<3) ? ( (channels==2) ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_GRAY): ( (channels==4) ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB)),
-	       PNG_INTERLACE_NONE,
-	       PNG_COMPRESSION_TYPE_BASE, 
-	       PNG_FILTER_TYPE_BASE
-		);
-
-
-  // Set compression parameters - Deflate compression level (0-9) and a pre-processing filter
-  png_set_compression_level( dest.png_ptr, Q );
-  png_set_filter( dest.png_ptr, 0, filterType );
+  // Set basic metadata, using a compact bitonal or paletted output where possible
+  analyse( rawtile );
+  setHeader( rawtile );
 
 
   // Set physical resolution - convert from inches or cm to meters
@@ -212,7 +201,7 @@ unsigned int PNGCompressor::CompressStrip( unsigned char* input, unsigned char*
 
   // Compress row by row
   for( unsigned int i = 0; i < strip_height; i++ ) {
-    png_write_row( dest.png_ptr, (png_byte*) &input[i*ulRowBytes] ); 
+    png_write_row( dest.png_ptr, pack( &input[i*ulRowBytes] ) );
   }
 
   return dest.written;
@@ -286,22 +275,11 @@ unsigned int PNGCompressor::Compress( RawTile& rawtile )
   png_set_write_fn( dest.png_ptr, (png_voidp) &dest, png_write_data, png_flush );
 
 
-  // Set basic metadata
-  png_set_IHDR( 
-	       dest.png_ptr, dest.info_ptr,
-	       width, height,
-	       rawtile.bpc,
-	       ( (channels<3) ? ( (channels==2) ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_GRAY): ( (channels==4) ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB)), 
-	       PNG_INTERLACE_NONE, 
-	       PNG_COMPRESSION_TYPE_BASE, 
-	       PNG_FILTER_TYPE_BASE 
-		);
+  // Set basic metadata, using a compact bitonal or paletted output where possible
+  analyse( rawtile );
+  setHeader( rawtile );
 
 
-  // Set compression parameters - Deflate compression level (0-9) and a pre-processing filter
-  png_set_compression_level( dest.png_ptr, Q );
-  png_set_filter( dest.png_ptr, 0, filterType );
-
   // Set physical resolution - convert from inches or cm to meters
   if( dpi_x || dpi_y ){
     png_uint_32 res_x = (dpi_units==2) ? dpi_x*10 : ( (dpi_units==1) ? dpi_x*25.4 : dpi_x );
@@ -345,7 +323,7 @@ unsigned int PNGCompressor::Compress( RawTile& rawtile )
   // Compress row by row
   unsigned char* data = (unsigned char*) rawtile.data;
   for( unsigned int i = 0; i < height; i++ ) {
-    png_write_row( dest.png_ptr, (png_byte*) &data[i*ulRowBytes] );
+    png_write_row( dest.png_ptr, pack( &data[i*ulRowBytes] ) );
   }  
   
   // Write the additional chunks to the PNG file
@@ -377,6 +355,125 @@ unsigned int PNGCompressor::Compress( RawTile& rawtile )
 
 
 
+void PNGCompressor::analyse( const RawTile& rawtile )
+{
+  bit_depth = rawtile.bpc;
+  colours.clear();
+
+  // Only 8 bit greyscale and RGB images without alpha can be reduced
+  if( rawtile.bpc != 8 || !(rawtile.channels == 1 || rawtile.channels == 3) || !rawtile.data ) return;
+
+  // Limit the number of colours: a palette is only worthwhile for greyscale if it reduces the bit depth
+  const unsigned int limit = (rawtile.channels == 1) ? 16 : 256;
+  const size_t np = (size_t) rawtile.width * rawtile.height;
+  const unsigned char* data = (const unsigned char*) rawtile.data;
+
+  // Gather the sorted set of distinct colours, giving up as soon as we exceed our limit.
+  // Neighbouring pixels are usually identical, so first check against the last colour seen
+  png_uint_32 last = 0;
+  for( size_t i = 0; i < np; i++ ){
+    png_uint_32 c = (rawtile.channels == 1) ? data[i] :
+      ( (png_uint_32) data[3*i] << 16 ) | ( (png_uint_32) data[3*i+1] << 8 ) | data[3*i+2];
+    if( i > 0 && c == last ) continue;
+    last = c;
+    vector<png_uint_32>::iterator it = lower_bound( colours.begin(), colours.end(), c );
+    if( it != colours.end() && *it == c ) continue;
+    if( colours.size() == limit ){
+      colours.clear();
+      return;
+    }
+    colours.insert( it, c );
+  }
+
+  // Bitonal greyscale images containing only black and white can be written as 1 bit greyscale without a palette
+  if( rawtile.channels == 1 && colours.size() <= 2 &&
+      ( colours.front() == 0 || colours.front() == 255 ) && ( colours.back() == 0 || colours.back() == 255 ) ){
+    colours.clear();
+    colours.push_back( 0 );
+    colours.push_back( 255 );
+    bit_depth = 1;
+    return;
+  }
+
+  // Otherwise use a palette with the smallest bit depth that can index all our colours
+  if( colours.size() <= 2 ) bit_depth = 1;
+  else if( colours.size() <= 4 ) bit_depth = 2;
+  else if( colours.size() <= 16 ) bit_depth = 4;
+  else bit_depth = 8;
+}
+
+
+
+void PNGCompressor::setHeader( const RawTile& rawtile )
+{
+  // Bitonal output is greyscale, whereas other reduced bit depth output is paletted
+  const bool bitonal = ( bit_depth == 1 && channels == 1 && colours.size() == 2 && colours[0] == 0 && colours[1] == 255 );
+  const bool paletted = ( colours.size() > 0 && !bitonal );
+
+  png_set_IHDR(
+	       dest.png_ptr, dest.info_ptr,
+	       width, height,
+	       bit_depth,
+	       paletted ? PNG_COLOR_TYPE_PALETTE :
+	       ( (channels<3) ? ( (channels==2) ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_GRAY): ( (channels==4) ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB)),
+	       PNG_INTERLACE_NONE,
+	       PNG_COMPRESSION_TYPE_BASE,
+	       PNG_FILTER_TYPE_BASE
+		);
+
+  if( paletted ){
+    vector<png_color> palette( colours.size() );
+    for( unsigned int i = 0; i < colours.size(); i++ ){
+      palette[i].red = (png_byte)( (channels == 1) ? colours[i] : (colours[i] >> 16) & 0xff );
+      palette[i].green = (png_byte)( (channels == 1) ? colours[i] : (colours[i] >> 8) & 0xff );
+      palette[i].blue = (png_byte)( colours[i] & 0xff );
+    }
+    png_set_PLTE( dest.png_ptr, dest.info_ptr, &palette[0], palette.size() );
+  }
+
+  // Set compression parameters - Deflate compression level (0-9) and a pre-processing filter.
+  // Filtering does not help with palette indices or packed pixels
+  png_set_compression_level( dest.png_ptr, Q );
+  png_set_filter( dest.png_ptr, 0, ( paletted || bit_depth < 8 ) ? PNG_FILTER_NONE : filterType );
+
+  // Allocate our row buffer for packed pixels
+  if( colours.size() > 0 ) row.resize( ( (size_t) width * bit_depth + 7 ) / 8 );
+}
+
+
+
+png_bytep PNGCompressor::pack( unsigned char* input )
+{
+  if( colours.empty() ) return (png_bytep) input;
+
+  // Pack pixels most significant bits first into our row buffer
+  fill( row.begin(), row.end(), 0 );
+  const unsigned int per_byte = 8 / bit_depth;
+  const bool bitonal = ( bit_depth == 1 && channels == 1 && colours[0] == 0 && colours[1] == 255 );
+
+  png_uint_32 last = colours[0];
+  png_byte index = 0;
+  for( unsigned int i = 0; i < width; i++ ){
+    png_byte v;
+    if( bitonal ) v = input[i] ? 1 : 0;
+    else{
+      png_uint_32 c = (channels == 1) ? input[i] :
+	( (png_uint_32) input[3*i] << 16 ) | ( (png_uint_32) input[3*i+1] << 8 ) | input[3*i+2];
+      // Look up the palette index, re-using the last one for runs of the same colour
+      if( c != last || i == 0 ){
+	index = (png_byte)( lower_bound( colours.begin(), colours.end(), c ) - colours.begin() );
+	last = c;
+      }
+      v = index;
+    }
+    row[i/per_byte] |= (png_byte)( v << ( 8 - bit_depth * ( i%per_byte + 1 ) ) );
+  }
+
+  return &row[0];
+}
+
+
+
 void PNGCompressor::writeXMPMetadata(){
 
   unsigned int len = xmp.size();
@@ -26,6 +26,7 @@
 
 #include "Compressor.h"
 #include <png.h>
+#include <vector>
 
 
 // Define ourselves a set of fast filters if necessary
@@ -67,6 +68,24 @@ class PNGCompressor : public Compressor {
 
   // The Compressor class Q parameter stores the zlib compression level (0-9)
   int filterType;             ///< PNG compression filter type - see png.h
+
+  int bit_depth;                      ///< output bit depth: less than 8 for bitonal and small palette images
+  std::vector<png_uint_32> colours;   ///< sorted grey or packed RGB values of our palette or empty if not paletted
+  std::vector<png_byte> row;          ///< buffer for rows packed to our output bit depth
+
+  /// Choose a compact output for 8 bit images: 1 bit greyscale for bitonal images or a palette for few colours
+  /** @param rawtile the complete tile or region to be encoded */
+  void analyse( const RawTile& rawtile );
+
+  /// Set the PNG header fields for our output
+  /** @param rawtile the tile or region to be encoded */
+  void setHeader( const RawTile& rawtile );
+
+  /// Pack a row of 8 bit pixels into our output bit depth or palette indices if necessary
+  /** @param input row of pixels
+      @return the row to be written
+   */
+  png_bytep pack( unsigned char* input );
   
   /// Write ICC profile
   void writeICCProfile();
@@ -91,6 +110,7 @@ class PNGCompressor : public Compressor {
     width = 0;
     height = 0;
     channels = 0;
+    bit_depth = 8;
 
     // Filters are an optional pre-processing step before Deflate compression
     //  - set this to the fastest set of filters
@@ -46,8 +46,8 @@ class RawTile {
 
  public:
 
-  /// Name of the file from which this tile comes
-  std::string filename;
+  /// Interned identifier of the image from which this tile comes (see ImageRegistry.h)
+  uint32_t imageId;
 
   /// The width in pixels of this tile
   unsigned int width;
@@ -70,6 +70,9 @@ class RawTile {
   /// Compression rate or quality
   int quality;
 
+  /// Whether 3 channel raw data is YCbCr rather than RGB. Only set for tiles passed directly to the JPEG encoder
+  bool ycbcr;
+
   /// Tile timestamp
   time_t timestamp;
 
@@ -112,13 +115,15 @@ class RawTile {
   */
   RawTile( int tn = 0, int res = 0, int hs = 0, int vs = 0,
 	   int w = 0, int h = 0, int c = 0, int b = 0 )
-    : width( w ),
+    : imageId( 0 ),
+      width( w ),
       height( h ),
       channels( c ),
       bpc( b ),
       sampleType( SampleType::FIXEDPOINT ),
       compressionType( ImageEncoding::RAW ),
       quality( 0 ),
+      ycbcr( false ),
       timestamp( 0 ),
       tileNum( tn ),
       resolution( res ),
@@ -140,7 +145,7 @@ class RawTile {
 
   /// Copy constructor - handles copying of data buffer
   RawTile( const RawTile& tile )
-    : filename( tile.filename ),
+    : imageId( tile.imageId ),
       width( tile.width ),
       height( tile.height ),
       channels( tile.channels ),
@@ -148,6 +153,7 @@ class RawTile {
       sampleType( tile.sampleType ),
       compressionType( tile.compressionType ),
       quality( tile.quality ),
+      ycbcr( tile.ycbcr ),
       timestamp( tile.timestamp ),
       tileNum( tile.tileNum ),
       resolution( tile.resolution ),
@@ -180,7 +186,8 @@ class RawTile {
       vSequence = tile.vSequence;
       compressionType = tile.compressionType;
       quality = tile.quality;
-      filename = tile.filename;
+      ycbcr = tile.ycbcr;
+      imageId = tile.imageId;
       timestamp = tile.timestamp;
       memoryManaged = tile.memoryManaged;
       dataLength = tile.dataLength;
@@ -210,13 +217,15 @@ class RawTile {
 
     if( size == 0 ) size = (uint32_t) width * height * channels * (bpc/8);
 
+    // Round up, as encoded data, such as Deflate compressed TIFF, keeps the bit depth of the
+    // raw data, but need not be a whole number of samples
     switch( bpc ){
       case 32:
-	if( sampleType == SampleType::FLOATINGPOINT ) data = new float[size/4];
-	else data = new int[size/4];
+	if( sampleType == SampleType::FLOATINGPOINT ) data = new float[(size+3)/4];
+	else data = new int[(size+3)/4];
 	break;
       case 16:
-	data = new unsigned short[size/2];
+	data = new unsigned short[(size+1)/2];
 	break;
       default:
 	data = new unsigned char[size];
@@ -293,6 +302,18 @@ class RawTile {
 
 
 
+  /// Whether every pixel of an uncompressed tile has the same value
+  /** Comparing the data with itself offset by one pixel compares each pixel with its predecessor.
+      memcmp() is vectorized and stops at the first difference, so non-uniform tiles are rejected quickly.
+   */
+  bool isUniform() const {
+    unsigned int pixel = channels * (bpc/8);
+    if( compressionType != ImageEncoding::RAW || !data || pixel == 0 || dataLength <= pixel ) return false;
+    return memcmp( data, (const unsigned char*) data + pixel, dataLength - pixel ) == 0;
+  };
+
+
+
   /// Overloaded equality operator
   friend int operator == ( const RawTile& A, const RawTile& B ) {
     if( (A.tileNum == B.tileNum) &&
@@ -301,7 +322,7 @@ class RawTile {
 	(A.vSequence == B.vSequence) &&
 	(A.compressionType == B.compressionType) &&
 	(A.quality == B.quality) &&
-	(A.filename == B.filename) ){
+	(A.imageId == B.imageId) ){
       return 1;
     }
     else return 0;
@@ -317,7 +338,7 @@ class RawTile {
 	(A.vSequence == B.vSequence) &&
 	(A.compressionType == B.compressionType) &&
 	(A.quality == B.quality) &&
-	(A.filename == B.filename) ){
+	(A.imageId == B.imageId) ){
       return 0;
     }
     else return 1;
@@ -330,7 +351,7 @@ class RawTile {
 
   /// Move constructor
   RawTile( RawTile&& tile ) noexcept
-    : filename( tile.filename ),
+    : imageId( tile.imageId ),
       width( tile.width ),
       height( tile.height ),
       channels( tile.channels ),
@@ -338,6 +359,7 @@ class RawTile {
       sampleType( tile.sampleType ),
       compressionType( tile.compressionType ),
       quality( tile.quality ),
+      ycbcr( tile.ycbcr ),
       timestamp( tile.timestamp ),
       tileNum( tile.tileNum ),
       resolution( tile.resolution ),
@@ -377,14 +399,14 @@ class RawTile {
 
       if( data && dataLength>0 ) delete this;
 
-      // Use move for std::string. The other fields are of basic type
-      filename = std::move( tile.filename );
+      imageId = tile.imageId;
       tileNum = tile.tileNum;
       resolution = tile.resolution;
       hSequence = tile.hSequence;
       vSequence = tile.vSequence;
       compressionType = tile.compressionType;
       quality = tile.quality;
+      ycbcr = tile.ycbcr;
       timestamp = tile.timestamp;
       memoryManaged = tile.memoryManaged;
       capacity = tile.capacity;
@@ -0,0 +1,480 @@
+/*
+    IIP Contact Sheet Command Handler Class Member Function
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <cctype>
+#include <algorithm>
+#include <functional>
+#include "Task.h"
+#include "AdmissionControl.h"
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+
+// Maximum number of images and maximum cell size of a contact sheet
+#define MAX_SHEET_IMAGES 256
+#define MAX_SHEET_CELL 1024
+
+
+using namespace std;
+
+
+/// A thumbnail within our contact sheet
+struct SheetCell {
+  int resolution;             ///< Resolution from which our thumbnail is resampled
+  unsigned int width;         ///< Width of our thumbnail
+  unsigned int height;        ///< Height of our thumbnail
+  RawTile source;             ///< Source tile taken from our tile cache if available
+  RawTile tile;               ///< Our 8 bit thumbnail
+  bool ready;                 ///< Whether our thumbnail is available
+  bool cached;                ///< Whether our thumbnail came from our tile cache
+  SheetCell() : resolution( 0 ), width( 0 ), height( 0 ), ready( false ), cached( false ) {};
+};
+
+
+
+/// Convert a tile to 8 bits and at most 3 channels and resample it to the size of our cell
+static void makeThumbnail( Transform* processor, const IIPImage& image, RawTile& tile, SheetCell& cell ){
+
+  if( tile.sampleType == SampleType::FLOATINGPOINT ){
+    processor->normalize( tile, image.max, image.min );
+    processor->contrast( tile, 1.0 );
+  }
+  else if( tile.bpc > 8 ) processor->scale_to_8bit( tile );
+
+  // Drop any alpha or extra bands
+  if( tile.channels == 2 ) processor->flatten( tile, 1 );
+  else if( tile.channels > 3 ) processor->flatten( tile, 3 );
+
+  if( tile.width != cell.width || tile.height != cell.height ){
+    processor->interpolate_bilinear( tile, cell.width, cell.height );
+  }
+
+  cell.tile = tile;
+  cell.ready = true;
+}
+
+
+
+/* Compose thumbnails of a list of images into a single contact sheet image. The argument is of the form
+   [<format>:]<cell size>[,<columns>]:<path>,<path>,... where format is one of jpg (the default), png, webp
+   or json. Each image is scaled to fit within a square cell and centred within it. Cells are laid out
+   row by row with the square root of the number of images as the default number of columns. The json
+   format returns the layout of the sheet, which only requires the image metadata.
+*/
+void SHEET::run( Session* session, const string& argument ){
+
+  if( session->loglevel >= 3 ) *(session->logfile) << "SHEET handler reached" << endl;
+
+  // Time this command
+  if( session->loglevel >= 2 ) command_timer.start();
+
+  this->session = session;
+
+
+  // Parse our format, cell size and number of columns
+  string arg = argument;
+  size_t pos = arg.find( ":" );
+  if( pos == string::npos ) throw invalid_argument( "SHEET :: syntax is [<format>:]<size>[,<columns>]:<path>,<path>,..." );
+
+  string format = "jpg";
+  if( !isdigit( arg[0] ) ){
+    format = arg.substr( 0, pos );
+    transform( format.begin(), format.end(), format.begin(), ::tolower );
+    arg = arg.substr( pos + 1 );
+    pos = arg.find( ":" );
+    if( pos == string::npos ) throw invalid_argument( "SHEET :: no images specified" );
+  }
+
+  string size = arg.substr( 0, pos );
+  string list = arg.substr( pos + 1 );
+
+  unsigned int cell_size = atoi( size.c_str() );
+  unsigned int columns = 0;
+  if( (pos = size.find( "," )) != string::npos ) columns = atoi( size.substr( pos + 1 ).c_str() );
+
+  if( cell_size == 0 || cell_size > MAX_SHEET_CELL ){
+    throw invalid_argument( "SHEET :: cell size must be between 1 and " + to_string( MAX_SHEET_CELL ) );
+  }
+
+
+  // Select our output encoder
+  Compressor* compressor = NULL;
+  if( format == "jpg" || format == "jpeg" ) compressor = session->jpeg;
+#ifdef HAVE_PNG
+  else if( format == "png" ) compressor = session->png;
+#endif
+#ifdef HAVE_WEBP
+  else if( format == "webp" ) compressor = session->webp;
+#endif
+  else if( format != "json" ) throw invalid_argument( "SHEET :: unsupported output format: " + format );
+
+
+  // Extract our list of images and resolve their metadata
+  vector<ImageEntry> entries;
+  vector<unsigned int> order;
+  parseImageList( list, entries, order, MAX_SHEET_IMAGES );
+  if( entries.empty() ) throw invalid_argument( "SHEET :: no images specified" );
+
+  unsigned int errors = resolveImages( entries );
+
+
+  // Calculate our layout
+  if( columns == 0 ) columns = (unsigned int) ceil( sqrt( (double) order.size() ) );
+  if( columns > order.size() ) columns = order.size();
+  unsigned int rows = ( order.size() + columns - 1 ) / columns;
+  unsigned int sheet_width = columns * cell_size;
+  unsigned int sheet_height = rows * cell_size;
+
+  int max_size = session->view->getMaxSize();
+  if( max_size > 0 && ( sheet_width > (unsigned int) max_size || sheet_height > (unsigned int) max_size ) ){
+    throw invalid_argument( "SHEET :: contact sheet of " + to_string( sheet_width ) + "x" + to_string( sheet_height ) +
+			    " exceeds maximum size of " + to_string( max_size ) );
+  }
+
+  if( session->loglevel >= 2 ){
+    *(session->logfile) << "SHEET :: " << order.size() << " images in " << columns << "x" << rows
+			<< " cells of " << cell_size << " pixels" << endl;
+  }
+
+
+  // Fit each image within its cell without upscaling and choose the smallest resolution
+  // at least as large as our thumbnail
+  vector<SheetCell> cells( entries.size() );
+  time_t latest = 0;
+
+  for( unsigned int i = 0; i < entries.size(); i++ ){
+
+    if( !entries[i].resolved ) continue;
+
+    IIPImage& image = entries[i].image;
+    if( image.timestamp > latest ) latest = image.timestamp;
+
+    unsigned int width = image.getImageWidth();
+    unsigned int height = image.getImageHeight();
+    float scale = min( 1.0f, min( (float) cell_size / (float) width, (float) cell_size / (float) height ) );
+
+    SheetCell& cell = cells[i];
+    cell.width = max( 1, (int) round( width * scale ) );
+    cell.height = max( 1, (int) round( height * scale ) );
+
+    unsigned int n = image.getNumResolutions();
+    cell.resolution = n - 1;
+    for( unsigned int r = 0; r < n; r++ ){
+      unsigned int k = n - r - 1;
+      if( image.image_widths[k] >= cell.width && image.image_heights[k] >= cell.height ){
+	cell.resolution = r;
+	break;
+      }
+    }
+  }
+
+
+  // Our layout only requires the metadata of our images
+  if( format == "json" ){
+
+    stringstream json;
+    json << "{" << endl
+	 << "  \"width\" : " << sheet_width << "," << endl
+	 << "  \"height\" : " << sheet_height << "," << endl
+	 << "  \"cell\" : " << cell_size << "," << endl
+	 << "  \"columns\" : " << columns << "," << endl
+	 << "  \"rows\" : " << rows << "," << endl
+	 << "  \"images\" : [";
+
+    for( unsigned int k = 0; k < order.size(); k++ ){
+      ImageEntry& e = entries[order[k]];
+      SheetCell& cell = cells[order[k]];
+      json << ( (k > 0) ? "," : "" ) << endl
+	   << "    { \"id\" : \"" << escapeJSON( e.path ) << "\", ";
+      if( !e.resolved ){
+	json << "\"error\" : \"" << escapeJSON( e.error ) << "\" }";
+	continue;
+      }
+      json << "\"x\" : " << (k % columns) * cell_size + (cell_size - cell.width) / 2 << ", "
+	   << "\"y\" : " << (k / columns) * cell_size + (cell_size - cell.height) / 2 << ", "
+	   << "\"width\" : " << cell.width << ", "
+	   << "\"height\" : " << cell.height << " }";
+    }
+
+    json << endl << "  ]" << endl << "}";
+
+    char timestamp[64];
+    strftime( timestamp, 64, "%a, %d %b %Y %H:%M:%S GMT", gmtime( &latest ) );
+
+    stringstream header;
+    header << session->response->createHTTPHeader( "json", timestamp )
+	   << json.str();
+
+    session->out->putStr( header.str().c_str(), (int) header.tellp() );
+    session->response->setImageSent();
+    session->response->setCachability( false );
+
+    if( session->loglevel >= 2 ){
+      *(session->logfile) << "SHEET :: Total command time " << command_timer.getTime() << " microseconds" << endl;
+    }
+    return;
+  }
+
+
+  // Look in our tile cache for thumbnails from previous contact sheets and for complete
+  // source resolutions consisting of a single tile. Neither may be accessed concurrently
+  Timer function_timer;
+  if( session->loglevel >= 3 ) function_timer.start();
+
+  const int xangle = session->view->xangle;
+  const int yangle = session->view->yangle;
+  const int layers = session->view->getLayers();
+  unsigned int thumbnail_hits = 0, tile_hits = 0;
+
+  for( unsigned int i = 0; i < entries.size(); i++ ){
+
+    if( !entries[i].resolved ) continue;
+
+    IIPImage& image = entries[i].image;
+    SheetCell& cell = cells[i];
+    string key = "sheet:" + to_string( cell.width ) + "x" + to_string( cell.height );
+
+    RawTile* rawtile = session->tileCache->getTile( image.getImageId(), cell.resolution, 0, xangle, yangle,
+						     ImageEncoding::RAW, 0, key );
+    if( rawtile && rawtile->timestamp == image.timestamp ){
+      cell.tile = *rawtile;
+      cell.ready = true;
+      cell.cached = true;
+      thumbnail_hits++;
+      continue;
+    }
+
+    int k = image.getNativeResolution( cell.resolution );
+    if( image.tile_widths[k] >= image.image_widths[k] && image.tile_heights[k] >= image.image_heights[k] ){
+      rawtile = session->tileCache->getTile( image.getImageId(), cell.resolution, 0, xangle, yangle,
+					     ImageEncoding::RAW, 0 );
+      if( rawtile && rawtile->timestamp == image.timestamp && !rawtile->ycbcr &&
+	  rawtile->width == image.image_widths[k] && rawtile->height == image.image_heights[k] ){
+	cell.source = *rawtile;
+	tile_hits++;
+      }
+    }
+  }
+
+  if( session->loglevel >= 3 ){
+    *(session->logfile) << "SHEET :: " << thumbnail_hits << " thumbnail and " << tile_hits << " tile cache hits in "
+			<< function_timer.getTime() << " microseconds" << endl;
+  }
+
+  if( session->cancellation ) session->cancellation->check();
+
+
+  // Decode and resample our remaining thumbnails in parallel. Each image has its own tile manager
+  // with an empty private cache as our tile cache may not be accessed concurrently. Decoder modules
+  // may not be thread-safe and codec logging is not synchronised, so work sequentially in these cases
+  if( session->loglevel >= 3 ) function_timer.start();
+
+#if defined(_OPENMP)
+  bool parallel = !IIPImage::logging;
+  for( unsigned int i = 0; i < entries.size(); i++ ){
+    if( entries[i].resolved && entries[i].image.getImageFormat() == ImageEncoding::UNSUPPORTED ) parallel = false;
+  }
+#endif
+
+  // Reserve our estimated peak memory use before decoding: the source resolutions decoded at the
+  // same time, which are at most the largest of them for each thread, and their floating point copies
+  if( session->admission ){
+    vector<size_t> sizes;
+    for( unsigned int i = 0; i < entries.size(); i++ ){
+      if( !entries[i].resolved || cells[i].ready || cells[i].source.dataLength > 0 ) continue;
+      IIPImage& image = entries[i].image;
+      int k = image.getNativeResolution( cells[i].resolution );
+      size_t pixels = (size_t) image.image_widths[k] * image.image_heights[k];
+      size_t bytes = pixels * image.getNumChannels() * ( image.getNumBitsPerPixel() / 8 );
+      if( image.getSampleType() == SampleType::FLOATINGPOINT ) bytes += pixels * image.getNumChannels() * sizeof(float);
+      sizes.push_back( bytes );
+    }
+
+    size_t threads = 1;
+#if defined(_OPENMP)
+    if( parallel ) threads = (size_t) omp_get_max_threads();
+#endif
+    sort( sizes.begin(), sizes.end(), greater<size_t>() );
+    size_t bytes = 0;
+    for( size_t n = 0; n < sizes.size() && n < threads; n++ ) bytes += sizes[n];
+
+    if( bytes > 0 && !session->admission->reserve( bytes ) ){
+      if( session->loglevel >= 1 ){
+	*(session->logfile) << "SHEET :: Unable to reserve " << bytes << " bytes of memory for thumbnails" << endl;
+      }
+      throw( 503 );
+    }
+    if( session->loglevel >= 4 ){
+      *(session->logfile) << "SHEET :: Reserved " << bytes << " bytes of memory for thumbnails" << endl;
+    }
+  }
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) if( parallel )
+#endif
+  for( int i = 0; i < (int) entries.size(); i++ ){
+
+    ImageEntry& e = entries[i];
+    SheetCell& cell = cells[i];
+    if( !e.resolved || cell.ready ) continue;
+
+    try{
+
+      if( cell.source.dataLength > 0 ){
+	makeThumbnail( session->processor, e.image, cell.source, cell );
+	continue;
+      }
+
+      IIPImage* image = FIF::createImage( session, e.image, false );
+      try{
+	image->openImage();
+	Cache cache( 0 );
+	TileManager tilemanager( &cache, image, NULL, session->jpeg, session->logfile, 0 );
+	int k = image->getNativeResolution( cell.resolution );
+	RawTile tile = tilemanager.getRegion( cell.resolution, xangle, yangle, layers, 0, 0,
+					      image->image_widths[k], image->image_heights[k] );
+	makeThumbnail( session->processor, e.image, tile, cell );
+      }
+      catch( ... ){
+	delete image;
+	throw;
+      }
+      delete image;
+    }
+    catch( const exception& error ){
+      e.error = error.what();
+    }
+    catch( const string& error ){
+      e.error = error;
+    }
+    catch( ... ){
+      e.error = "Unable to decode image";
+    }
+  }
+
+  if( session->loglevel >= 3 ){
+    *(session->logfile) << "SHEET :: Thumbnails created in " << function_timer.getTime() << " microseconds" << endl;
+  }
+
+  if( session->cancellation ) session->cancellation->check();
+
+
+  // Store our new thumbnails in our tile cache and compose our contact sheet. Our sheet is
+  // greyscale only if all our thumbnails are greyscale
+  unsigned int channels = 1;
+  for( unsigned int i = 0; i < entries.size(); i++ ){
+    SheetCell& cell = cells[i];
+    if( !cell.ready ){
+      if( entries[i].resolved ){
+	errors++;
+	if( session->loglevel >= 1 ) *(session->logfile) << "SHEET :: " << entries[i].path << ": " << entries[i].error << endl;
+      }
+      continue;
+    }
+    if( cell.tile.channels == 3 ) channels = 3;
+    if( cell.cached ) continue;
+
+    cell.tile.imageId = entries[i].image.getImageId();
+    cell.tile.resolution = cell.resolution;
+    cell.tile.tileNum = 0;
+    cell.tile.hSequence = xangle;
+    cell.tile.vSequence = yangle;
+    cell.tile.compressionType = ImageEncoding::RAW;
+    cell.tile.quality = 0;
+    cell.tile.timestamp = entries[i].image.timestamp;
+    session->tileCache->insert( cell.tile, "sheet:" + to_string( cell.width ) + "x" + to_string( cell.height ) );
+  }
+
+  RawTile sheet( 0, 0, 0, 0, sheet_width, sheet_height, channels, 8 );
+  sheet.allocate();
+  sheet.dataLength = sheet.capacity;
+  memset( sheet.data, 0, sheet.dataLength );
+
+  for( unsigned int k = 0; k < order.size(); k++ ){
+
+    SheetCell& cell = cells[order[k]];
+    if( !cell.ready ) continue;
+
+    unsigned int x0 = (k % columns) * cell_size + (cell_size - cell.width) / 2;
+    unsigned int y0 = (k / columns) * cell_size + (cell_size - cell.height) / 2;
+    const unsigned char* in = (const unsigned char*) cell.tile.data;
+
+    for( unsigned int j = 0; j < cell.height; j++ ){
+      unsigned char* out = (unsigned char*) sheet.data + ( (size_t)(y0 + j) * sheet_width + x0 ) * channels;
+      const unsigned char* row = in + (size_t) j * cell.width * cell.tile.channels;
+      if( (unsigned int) cell.tile.channels == channels ) memcpy( out, row, cell.width * channels );
+      else{
+	// Greyscale thumbnail within a colour sheet
+	for( unsigned int i = 0; i < cell.width; i++ ) out[3*i] = out[3*i+1] = out[3*i+2] = row[i];
+      }
+    }
+  }
+
+
+  // Encode our sheet in one go
+  if( session->loglevel >= 3 ) function_timer.start();
+  compressor->setResolution( 0, 0, 0 );
+  compressor->setICCProfile( string() );
+  compressor->setXMPMetadata( string() );
+  unsigned int len = compressor->Compress( sheet );
+  if( session->loglevel >= 3 ){
+    *(session->logfile) << "SHEET :: " << sheet_width << "x" << sheet_height << " contact sheet encoded to " << len
+			<< " bytes in " << function_timer.getTime() << " microseconds" << endl;
+  }
+
+
+  // Send out our image
+  char timestamp[64];
+  strftime( timestamp, 64, "%a, %d %b %Y %H:%M:%S GMT", gmtime( &latest ) );
+
+  session->response->setContentDisposition( string( "contact_sheet." ) + compressor->getSuffix(),
+					    ((session->headers["REQUEST_METHOD"]=="POST")?"attachment":"inline") );
+  string header = session->response->createHTTPHeader( compressor->getMimeType(), timestamp, len );
+  if( session->out->putS( header.c_str() ) == -1 ){
+    if( session->loglevel >= 1 ) *(session->logfile) << "SHEET :: Error writing HTTP header" << endl;
+  }
+  if( session->out->putStr( (const char*) sheet.data, len ) != (int) len ){
+    if( session->loglevel >= 1 ) *(session->logfile) << "SHEET :: Error writing image" << endl;
+  }
+  if( session->out->flush() == -1 ){
+    if( session->loglevel >= 1 ) *(session->logfile) << "SHEET :: Error flushing output" << endl;
+  }
+
+  session->response->setImageSent();
+
+  // Contact sheets depend on many images, each of which may change, so never store them in Memcached
+  session->response->setCachability( false );
+
+  if( session->loglevel >= 2 ){
+    if( errors ) *(session->logfile) << "SHEET :: " << errors << " images could not be included" << endl;
+    *(session->logfile) << "SHEET :: Total command time " << command_timer.getTime() << " microseconds" << endl;
+  }
+
+}
@@ -79,6 +79,7 @@ void SPECTRA::run( Session* session, const std::string& argument ){
   
 
   TileManager tilemanager( session->tileCache, *session->image, session->watermark, session->jpeg, session->logfile, session->loglevel );
+  tilemanager.setCancellation( session->cancellation );
 
   // Use our horizontal views function to get a list of available spectral images
   list <int> views = (*session->image)->getHorizontalViewsList();
@@ -110,6 +111,9 @@ void SPECTRA::run( Session* session, const std::string& argument ){
 
     int n = *i;
 
+    // Stop if our client has gone away
+    if( session->cancellation ) session->cancellation->check();
+
     RawTile rawtile = tilemanager.getTile( resolution, tile, n, session->view->yangle, session->view->getLayers(), ImageEncoding::RAW );
 
     // Make sure our x,y coordinates are within the tile dimensions
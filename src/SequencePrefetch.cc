@@ -0,0 +1,289 @@
+/*
+    IIPImage Server - Prefetching of adjacent angles and bands of image sequences
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include "SequencePrefetch.h"
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+#ifndef WIN32
+#include <poll.h>
+#endif
+
+
+using namespace std;
+
+
+// Initialize our static members
+const size_t SequencePrefetch::max_sequences;
+unsigned int SequencePrefetch::limit = 0;
+list<SequencePrefetch::Sequence> SequencePrefetch::sequences;
+bool SequencePrefetch::pending = false;
+
+
+
+vector<int> SequencePrefetch::adjacent( const list<int>& angles, int angle, int step, bool wrap ){
+
+  vector<int> result;
+  vector<int> ordered( angles.begin(), angles.end() );
+  int n = (int) ordered.size();
+  if( n < 2 ) return result;
+
+  vector<int>::const_iterator i = find( ordered.begin(), ordered.end(), angle );
+  if( i == ordered.end() ) return result;
+  int k = (int)( i - ordered.begin() );
+
+  // Continue in the direction of motion first and then check the other side
+  int candidates[2] = { k + step, k - step };
+  for( int c = 0; c < 2; c++ ){
+    int j = candidates[c];
+    if( wrap ) j = (j + n) % n;
+    if( j < 0 || j >= n || j == k ) continue;
+    if( find( result.begin(), result.end(), ordered[j] ) == result.end() ) result.push_back( ordered[j] );
+  }
+
+  return result;
+}
+
+
+
+int SequencePrefetch::direction( const list<int>& angles, int from, int to, bool wrap ){
+
+  list<int>::const_iterator f = find( angles.begin(), angles.end(), from );
+  list<int>::const_iterator t = find( angles.begin(), angles.end(), to );
+  if( f == angles.end() || t == angles.end() ) return 1;
+
+  int d = (int) distance( angles.begin(), t ) - (int) distance( angles.begin(), f );
+
+  // Stepping across the join of a closed loop reverses the apparent direction
+  int n = (int) angles.size();
+  if( wrap && 2*abs(d) > n ) d = -d;
+
+  return ( d < 0 ) ? -1 : 1;
+}
+
+
+
+bool SequencePrefetch::requestWaiting( int listen_fd, int connection_fd ){
+#ifndef WIN32
+  struct pollfd p[2];
+  int n = 0;
+  if( listen_fd >= 0 ){ p[n].fd = listen_fd; p[n].events = POLLIN; p[n].revents = 0; n++; }
+  if( connection_fd >= 0 ){ p[n].fd = connection_fd; p[n].events = POLLIN; p[n].revents = 0; n++; }
+  if( n == 0 ) return false;
+  return ( ::poll( p, n, 0 ) > 0 );
+#else
+  return false;
+#endif
+}
+
+
+
+void SequencePrefetch::record( Session* session, const RawTile& rawtile, Compressor* compressor, unsigned int tw, unsigned int th ){
+
+  // Degraded tiles are not cached and only tiles encoded without any processing can be prefetched
+  if( limit == 0 || session->overload || rawtile.compressionType != compressor->getImageEncoding() ) return;
+
+  IIPImage* image = *session->image;
+  const list<int> horizontal = image->getHorizontalViewsList();
+  const list<int> vertical = image->getVerticalViewsList();
+  if( horizontal.size() < 2 && vertical.size() < 2 ) return;
+
+  const string path = image->getImagePath();
+  const bool wrap = !image->isStack();
+
+
+  // Find this sequence, creating it if necessary, and move it to the front of our list
+  list<Sequence>::iterator s = sequences.begin();
+  while( s != sequences.end() && s->image.getImagePath() != path ) s++;
+
+  bool created = ( s == sequences.end() );
+  if( created ){
+    sequences.push_front( Sequence() );
+    if( sequences.size() > max_sequences ) sequences.pop_back();
+  }
+  else sequences.splice( sequences.begin(), sequences, s );
+
+  Sequence& sequence = sequences.front();
+  const int xangle = session->view->xangle;
+  const int yangle = session->view->yangle;
+  const int layers = session->view->getLayers();
+  const int quality = compressor->getQuality();
+
+
+  // A new set of tiles begins whenever the resolution, encoding, embedded metadata or tiling changes
+  if( created || sequence.resolution != rawtile.resolution || sequence.layers != layers ||
+      sequence.ctype != rawtile.compressionType || sequence.quality != quality ||
+      sequence.icc.size() != compressor->getICCProfile().size() ||
+      sequence.xmp.size() != compressor->getXMPMetadata().size() ||
+      sequence.tw != tw || sequence.th != th || sequence.image.timestamp != image->timestamp ){
+    sequence.image = *image;
+    sequence.codecOptions = session->codecOptions;
+    sequence.resolution = rawtile.resolution;
+    sequence.layers = layers;
+    sequence.ctype = rawtile.compressionType;
+    sequence.quality = quality;
+    sequence.default_quality = compressor->defaultQuality();
+    sequence.icc = compressor->getICCProfile();
+    sequence.xmp = compressor->getXMPMetadata();
+    sequence.tw = tw;
+    sequence.th = th;
+    sequence.xstep = sequence.ystep = 1;
+    sequence.tiles.clear();
+  }
+  // Otherwise keep track of the direction in which our viewer is moving
+  else{
+    if( xangle != sequence.xangle ) sequence.xstep = direction( horizontal, sequence.xangle, xangle, wrap );
+    if( yangle != sequence.yangle ) sequence.ystep = direction( vertical, sequence.yangle, yangle, false );
+  }
+
+  sequence.xangle = xangle;
+  sequence.yangle = yangle;
+  compressor->getResolution( sequence.dpi_x, sequence.dpi_y, sequence.dpi_units );
+
+
+  // Keep the most recently requested tiles, which are those visible in our viewer
+  sequence.tiles.remove( rawtile.tileNum );
+  sequence.tiles.push_front( rawtile.tileNum );
+  if( sequence.tiles.size() > limit ) sequence.tiles.pop_back();
+
+  pending = true;
+}
+
+
+
+unsigned int SequencePrefetch::run( Cache* tileCache, Watermark* watermark, Memcache* memcached,
+				    Logger* logfile, int loglevel, int listen_fd, int connection_fd ){
+
+  if( !pending || limit == 0 || sequences.empty() ) return 0;
+  pending = false;
+
+  Sequence& sequence = sequences.front();
+
+  Timer timer;
+  if( loglevel >= 2 ) timer.start();
+
+
+  // Our adjacent angles, those in the direction of motion first, followed by adjacent vertical angles
+  vector< pair<int,int> > views;
+  vector<int> angles = adjacent( sequence.image.getHorizontalViewsList(), sequence.xangle, sequence.xstep,
+				 !sequence.image.isStack() );
+  for( vector<int>::const_iterator a = angles.begin(); a != angles.end(); a++ ){
+    views.push_back( make_pair( *a, sequence.yangle ) );
+  }
+  angles = adjacent( sequence.image.getVerticalViewsList(), sequence.yangle, sequence.ystep, false );
+  for( vector<int>::const_iterator a = angles.begin(); a != angles.end(); a++ ){
+    views.push_back( make_pair( sequence.xangle, *a ) );
+  }
+
+  if( views.empty() ) return 0;
+
+
+  // Encode with the same settings as the recorded tiles so that our tiles are found under the same cache keys
+  // A quality set explicitly by the client disables the pass-through of source tiles by our tile manager
+  JPEGCompressor jpeg( sequence.quality );
+  if( !sequence.default_quality ) jpeg.setQuality( sequence.quality );
+  Compressor* compressor = &jpeg;
+#ifdef HAVE_PNG
+  PNGCompressor png( sequence.quality );
+  if( !sequence.default_quality ) png.setQuality( sequence.quality );
+  if( sequence.ctype == ImageEncoding::PNG ) compressor = &png;
+#endif
+#ifdef HAVE_WEBP
+  WebPCompressor webp( sequence.quality );
+  if( !sequence.default_quality ) webp.setQuality( sequence.quality );
+  if( sequence.ctype == ImageEncoding::WEBP ) compressor = &webp;
+#endif
+#ifdef HAVE_ZLIB
+  TIFFCompressor tiff( sequence.quality );
+  if( !sequence.default_quality ) tiff.setQuality( sequence.quality );
+  if( sequence.ctype == ImageEncoding::DEFLATE ) compressor = &tiff;
+#endif
+  if( compressor->getImageEncoding() != sequence.ctype ) return 0;
+
+  // Embed the same physical resolution, ICC profile and XMP metadata as our recorded tiles
+  compressor->setResolution( sequence.dpi_x, sequence.dpi_y, sequence.dpi_units );
+  compressor->setICCProfile( sequence.icc );
+  compressor->setXMPMetadata( sequence.xmp );
+
+
+  // Key under which our served tiles are cached
+  TileManager tiling( tileCache, &sequence.image, watermark, compressor, logfile, 0 );
+  tiling.setTileSize( sequence.tw, sequence.th );
+  const string key = tiling.servedKey( sequence.resolution );
+
+
+  // Our image is only opened once we find a tile that is not already cached
+  IIPImage* image = NULL;
+  unsigned int decoded = 0;
+  bool waiting = false;
+
+  try{
+
+    for( vector< pair<int,int> >::const_iterator v = views.begin(); v != views.end() && decoded < limit && !waiting; v++ ){
+      for( list<int>::const_iterator t = sequence.tiles.begin(); t != sequence.tiles.end() && decoded < limit; t++ ){
+
+	RawTile* cached = tileCache->getTile( sequence.image.getImageId(), sequence.resolution, *t, v->first, v->second,
+					      sequence.ctype, sequence.quality, key );
+	if( cached && cached->timestamp == sequence.image.timestamp ) continue;
+
+	// Give way to any request that is waiting and continue once it has been answered
+	if( requestWaiting( listen_fd, connection_fd ) ){
+	  waiting = pending = true;
+	  break;
+	}
+
+	if( !image ){
+	  Session session;
+	  session.logfile = logfile;
+	  session.codecOptions = sequence.codecOptions;
+	  image = FIF::createImage( &session, sequence.image, false );
+	  image->openImage();
+	}
+
+	TileManager tilemanager( tileCache, image, watermark, compressor, logfile, loglevel, memcached );
+	tilemanager.setTileSize( sequence.tw, sequence.th );
+	tilemanager.getTile( sequence.resolution, *t, v->first, v->second, sequence.layers, sequence.ctype );
+	decoded++;
+      }
+    }
+
+  }
+  catch( const file_error& error ){
+    if( loglevel >= 2 ) *logfile << "SequencePrefetch :: " << error.what() << endl;
+  }
+  catch( const string& error ){
+    if( loglevel >= 2 ) *logfile << "SequencePrefetch :: " << error << endl;
+  }
+  catch( const exception& error ){
+    if( loglevel >= 2 ) *logfile << "SequencePrefetch :: " << error.what() << endl;
+  }
+
+  delete image;
+
+  if( loglevel >= 2 && decoded > 0 ){
+    *logfile << "SequencePrefetch :: Prefetched " << decoded << " tiles of angles adjacent to "
+	     << sequence.xangle << "," << sequence.yangle << " of " << sequence.image.getImagePath()
+	     << ( waiting ? " before giving way" : "" ) << " in " << timer.getTime() << " microseconds" << endl;
+  }
+
+  return decoded;
+}
@@ -0,0 +1,156 @@
+/*
+    IIPImage Server - Prefetching of adjacent angles and bands of image sequences
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _SEQUENCEPREFETCH_H
+#define _SEQUENCEPREFETCH_H
+
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Task.h"
+
+
+
+/// Speculative decoding of the tiles of adjacent angles or bands of image sequences and stacks
+/** Rotation viewers step through the horizontal and vertical angles of an image sequence and stack
+    viewers through the bands of an image stack, requesting the same set of visible tiles at each step.
+    The tiles requested for each sequence are recorded, together with the current angles and the
+    direction in which the viewer is moving. Once a response has been sent, the same tiles are decoded
+    for the neighbouring angles and inserted into the tile cache, starting in the direction of motion,
+    so that the next step is served from the cache. This takes place only while no other request is
+    waiting for our process and stops as soon as one arrives. Only unprocessed tiles are prefetched.
+ */
+class SequencePrefetch {
+
+ private:
+
+  /// The tiles most recently requested for an image sequence and the position of the viewer
+  struct Sequence {
+    IIPImage image;
+    std::map <const std::string, unsigned int> codecOptions;
+    int resolution;
+    int xangle;
+    int yangle;
+    int xstep;
+    int ystep;
+    int layers;
+    ImageEncoding ctype;
+    int quality;
+    bool default_quality;
+    float dpi_x;
+    float dpi_y;
+    int dpi_units;
+    std::string icc;
+    std::string xmp;
+    unsigned int tw;
+    unsigned int th;
+    std::list<int> tiles;
+  };
+
+  /// Maximum number of sequences tracked
+  static const size_t max_sequences = 64;
+
+  /// Maximum number of tiles decoded after each request: 0 disables prefetching
+  static unsigned int limit;
+
+  /// Sequences in least recently used order, with the most recent at the front
+  static std::list<Sequence> sequences;
+
+  /// Whether the most recent sequence has been updated since it was last prefetched
+  static bool pending;
+
+
+  /// Angles adjacent to the current angle, in the direction of motion first
+  /** @param angles list of angles of the sequence
+      @param angle current angle
+      @param step direction of the last step: 1 or -1
+      @param wrap whether the sequence forms a closed loop
+      @return adjacent angles
+   */
+  static std::vector<int> adjacent( const std::list<int>& angles, int angle, int step, bool wrap );
+
+
+  /// Direction of a step between two angles of a sequence
+  /** @param angles list of angles of the sequence
+      @param from previous angle
+      @param to new angle
+      @param wrap whether the sequence forms a closed loop
+      @return 1 for a step forwards through the sequence or -1 for a step backwards
+   */
+  static int direction( const std::list<int>& angles, int from, int to, bool wrap );
+
+
+  /// Check whether another request is waiting for our process
+  /** @param listen_fd socket on which new connections are accepted
+      @param connection_fd persistent connection to the web server or -1 if none
+   */
+  static bool requestWaiting( int listen_fd, int connection_fd );
+
+
+ public:
+
+  /// Set the maximum number of tiles decoded after each request
+  /** @param n maximum number of tiles: 0 disables prefetching */
+  static void setLimit( unsigned int n ){ limit = n; };
+
+  /// Get the maximum number of tiles decoded after each request
+  static unsigned int getLimit(){ return limit; };
+
+  /// Whether prefetching is enabled
+  static bool isEnabled(){ return limit > 0; };
+
+  /// Whether any tiles may be waiting to be prefetched
+  static bool isPending(){ return pending; };
+
+
+  /// Record a tile sent in response to a tile request for an image sequence or stack
+  /** Tiles of images without multiple angles or bands and degraded tiles are ignored
+      @param session our session, from which the image and view are taken
+      @param rawtile the encoded tile that was sent
+      @param compressor compressor with which the tile was encoded, whose quality, resolution, ICC
+      profile and XMP metadata are applied to prefetched tiles
+      @param tw served tile width or 0 for the native tile size
+      @param th served tile height or 0 for the native tile size
+   */
+  static void record( Session* session, const RawTile& rawtile, Compressor* compressor, unsigned int tw, unsigned int th );
+
+
+  /// Decode the recorded tiles of the angles adjacent to those of the most recently recorded sequence
+  /** Decoding stops once our limit has been reached or another request is waiting
+      @param tileCache tile cache into which tiles are inserted
+      @param watermark watermark applied to tiles
+      @param memcached shared tile store or NULL
+      @param logfile log file
+      @param loglevel logging level
+      @param listen_fd socket on which new connections are accepted
+      @param connection_fd persistent connection to the web server or -1 if none
+      @return number of tiles decoded
+   */
+  static unsigned int run( Cache* tileCache, Watermark* watermark, Memcache* memcached,
+			   Logger* logfile, int loglevel, int listen_fd, int connection_fd );
+
+};
+
+
+#endif
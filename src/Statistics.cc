@@ -0,0 +1,123 @@
+/*
+    IIPImage Server - Per-band image statistics
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include "Statistics.h"
+#include <cmath>
+#include <limits>
+
+
+using namespace std;
+
+
+// Initialize our static members
+const unsigned int Statistics::bins;
+const float Statistics::low_percentile = 0.01;
+const float Statistics::high_percentile = 0.99;
+
+
+
+/* Calculate the statistics of a single band in two passes: first our range and then our
+   histogram across this range, from which our percentiles are interpolated
+ */
+template <class T> static BandStatistics band( const T* data, uint32_t np, int nc, int c )
+{
+  BandStatistics b;
+  b.histogram.assign( Statistics::bins, 0 );
+
+  double minimum = numeric_limits<double>::max();
+  double maximum = -numeric_limits<double>::max();
+  uint32_t count = 0;
+
+  for( uint32_t n = 0; n < np; n++ ){
+    double v = (double) data[ (size_t)n*nc + c ];
+    if( !std::isfinite( v ) ) continue;
+    if( v < minimum ) minimum = v;
+    if( v > maximum ) maximum = v;
+    count++;
+  }
+
+  if( count == 0 ) return b;
+
+  b.minimum = minimum;
+  b.maximum = maximum;
+
+  // Bins are spread evenly across our range with the maximum in the final bin
+  const unsigned int last = Statistics::bins - 1;
+  const double scale = ( maximum > minimum ) ? last / (maximum - minimum) : 0.0;
+
+  for( uint32_t n = 0; n < np; n++ ){
+    double v = (double) data[ (size_t)n*nc + c ];
+    if( !std::isfinite( v ) ) continue;
+    unsigned int i = (unsigned int)( (v - minimum) * scale );
+    b.histogram[ (i > last) ? last : i ]++;
+  }
+
+  // Find the bins containing our percentiles and use their lower and upper edges respectively
+  const double step = ( scale > 0.0 ) ? 1.0 / scale : 0.0;
+  uint32_t low_count = (uint32_t)( Statistics::low_percentile * count );
+  uint32_t high_count = (uint32_t)( Statistics::high_percentile * count );
+  uint32_t cumulative = 0;
+  bool low_found = false;
+
+  b.low = minimum;
+  b.high = maximum;
+
+  for( unsigned int i = 0; i < Statistics::bins; i++ ){
+    cumulative += b.histogram[i];
+    if( !low_found && cumulative > low_count ){
+      b.low = minimum + i * step;
+      low_found = true;
+    }
+    if( cumulative >= high_count ){
+      double high = minimum + (i+1) * step;
+      b.high = ( high > maximum ) ? maximum : high;
+      break;
+    }
+  }
+
+  return b;
+}
+
+
+
+vector<BandStatistics> Statistics::compute( const RawTile& tile )
+{
+  const int nc = tile.channels;
+  const uint32_t np = (uint32_t) tile.width * tile.height;
+  vector<BandStatistics> bands( nc > 0 ? nc : 0 );
+
+  if( !tile.data || nc <= 0 || tile.compressionType != ImageEncoding::RAW ) return bands;
+
+  // Each band is independent, so calculate them in parallel
+#if defined(_OPENMP)
+#pragma omp parallel for if( nc > 1 )
+#endif
+  for( int c = 0; c < nc; c++ ){
+    if( tile.bpc == 32 && tile.sampleType == SampleType::FLOATINGPOINT ){
+      bands[c] = band( (const float*) tile.data, np, nc, c );
+    }
+    else if( tile.bpc == 32 ) bands[c] = band( (const unsigned int*) tile.data, np, nc, c );
+    else if( tile.bpc == 16 ) bands[c] = band( (const unsigned short*) tile.data, np, nc, c );
+    else bands[c] = band( (const unsigned char*) tile.data, np, nc, c );
+  }
+
+  return bands;
+}
@@ -0,0 +1,74 @@
+/*
+    IIPImage Server - Per-band image statistics
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _STATISTICS_H
+#define _STATISTICS_H
+
+
+#include <vector>
+#include "RawTile.h"
+
+
+
+/// Statistics for a single image band
+struct BandStatistics {
+
+  /// Observed minimum and maximum sample values, ignoring non-finite values
+  float minimum, maximum;
+
+  /// Robust range given by the low and high percentiles of the sample values
+  float low, high;
+
+  /// Histogram with bins spread evenly between our minimum and maximum
+  std::vector<unsigned int> histogram;
+
+  BandStatistics() : minimum( 0.0 ), maximum( 0.0 ), low( 0.0 ), high( 0.0 ) {};
+
+};
+
+
+
+/// Calculation of per-band image statistics
+/** Statistics are calculated from an uncompressed low resolution version of the image and
+    are stored with the image metadata so that they only need to be calculated once
+ */
+class Statistics {
+
+ public:
+
+  /// Number of histogram bins per band
+  static const unsigned int bins = 256;
+
+  /// Fractions of samples lying below the low and high percentiles of our robust range
+  static const float low_percentile;
+  static const float high_percentile;
+
+
+  /// Calculate statistics for each band of a tile, with bands processed in parallel
+  /** @param tile uncompressed tile of any bit depth or sample type
+      @return statistics for each band
+   */
+  static std::vector<BandStatistics> compute( const RawTile& tile );
+
+};
+
+
+#endif
@@ -0,0 +1,255 @@
+/*
+    IIP Deflate compressed TIFF Compressor Class:
+    Handles full precision output of 8, 16 and 32 bit integer and floating point data
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include "TIFFCompressor.h"
+#include <zlib.h>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+
+// TIFF field types
+#define TIFF_BYTE 1
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+#define TIFF_RATIONAL 5
+#define TIFF_UNDEFINED 7
+
+
+/// Check for little endianness
+inline bool byte_order_little_endian() {
+  long one = 1;
+  return (*((char*)(&one)));
+}
+
+
+
+/// A single TIFF directory entry with its value in native byte order
+struct TIFFEntry {
+  uint16_t tag;
+  uint16_t type;
+  uint32_t count;
+  string value;
+
+  TIFFEntry( uint16_t t, uint16_t y, uint32_t c, const void* v, size_t size ) :
+    tag( t ), type( y ), count( c ), value( (const char*) v, size ) {};
+
+  bool operator<( const TIFFEntry& e ) const { return tag < e.tag; };
+};
+
+
+static void addShorts( vector<TIFFEntry>& entries, uint16_t tag, const vector<uint16_t>& v ){
+  entries.push_back( TIFFEntry( tag, TIFF_SHORT, v.size(), &v[0], v.size()*sizeof(uint16_t) ) );
+}
+
+static void addShort( vector<TIFFEntry>& entries, uint16_t tag, uint16_t v ){
+  entries.push_back( TIFFEntry( tag, TIFF_SHORT, 1, &v, sizeof(uint16_t) ) );
+}
+
+static void addLong( vector<TIFFEntry>& entries, uint16_t tag, uint32_t v ){
+  entries.push_back( TIFFEntry( tag, TIFF_LONG, 1, &v, sizeof(uint32_t) ) );
+}
+
+static void addRational( vector<TIFFEntry>& entries, uint16_t tag, float v ){
+  uint32_t r[2] = { (uint32_t)( v * 100.0 + 0.5 ), 100 };
+  entries.push_back( TIFFEntry( tag, TIFF_RATIONAL, 1, r, sizeof(r) ) );
+}
+
+
+
+/// Horizontal differencing (TIFF predictor 2) of a row of integer samples
+template <class T> static void differentiate( T* row, unsigned int n, unsigned int channels ){
+  for( unsigned int i = n-1; i >= channels; i-- ) row[i] = (T)( row[i] - row[i-channels] );
+}
+
+
+
+/// Floating point predictor (TIFF predictor 3): shuffle the bytes of a row of samples into byte planes,
+/// most significant first, and then difference adjacent bytes within each plane
+static void shuffle( unsigned char* row, unsigned char* tmp, unsigned int n, unsigned int channels, unsigned int bps ){
+
+  const bool little_endian = byte_order_little_endian();
+  memcpy( tmp, row, (size_t) n * bps );
+
+  for( unsigned int i = 0; i < n; i++ ){
+    for( unsigned int b = 0; b < bps; b++ ){
+      unsigned int plane = little_endian ? (bps - b - 1) : b;
+      row[ (size_t) plane * n + i ] = tmp[ (size_t) bps * i + b ];
+    }
+  }
+
+  for( size_t i = (size_t) n * bps - 1; i >= channels; i-- ) row[i] = (unsigned char)( row[i] - row[i-channels] );
+}
+
+
+
+unsigned int TIFFCompressor::Compress( RawTile& rawtile ){
+
+  if( rawtile.bpc != 8 && rawtile.bpc != 16 && rawtile.bpc != 32 ){
+    throw string( "TIFFCompressor :: Unsupported bit depth" );
+  }
+
+  const unsigned int width = rawtile.width;
+  const unsigned int height = rawtile.height;
+  const unsigned int channels = rawtile.channels;
+  const unsigned int bps = rawtile.bpc / 8;
+  const bool floating = ( rawtile.sampleType == SampleType::FLOATINGPOINT );
+  const size_t row_size = (size_t) width * channels * bps;
+  const size_t size = row_size * height;
+
+
+  // Apply our predictor row by row to a copy of our data
+  vector<unsigned char> predicted( (const unsigned char*) rawtile.data, (const unsigned char*) rawtile.data + size );
+
+#if defined(_OPENMP)
+#pragma omp parallel if( size > 65536 )
+#endif
+  {
+    vector<unsigned char> tmp( floating ? row_size : 0 );
+#if defined(_OPENMP)
+#pragma omp for
+#endif
+    for( int j = 0; j < (int) height; j++ ){
+      unsigned char* row = &predicted[ (size_t) j * row_size ];
+      unsigned int n = width * channels;
+      if( n <= channels ) continue;
+      if( floating ) shuffle( row, &tmp[0], n, channels, bps );
+      else if( bps == 4 ) differentiate( (uint32_t*) row, n, channels );
+      else if( bps == 2 ) differentiate( (uint16_t*) row, n, channels );
+      else differentiate( row, n, channels );
+    }
+  }
+
+
+  // Deflate our data as a single strip
+  uLongf strip_size = compressBound( size );
+  vector<unsigned char> strip( strip_size );
+  if( compress2( &strip[0], &strip_size, &predicted[0], size, Q ) != Z_OK ){
+    throw string( "TIFFCompressor :: Deflate compression failed" );
+  }
+
+
+  // Describe our image. Values are written in our native byte order, which is indicated in our header
+  const uint32_t header_size = 8;
+  vector<TIFFEntry> entries;
+  addLong( entries, 256, width );                                   // ImageWidth
+  addLong( entries, 257, height );                                  // ImageLength
+  addShorts( entries, 258, vector<uint16_t>( channels, rawtile.bpc ) );  // BitsPerSample
+  addShort( entries, 259, 8 );                                      // Compression: Adobe Deflate
+  addShort( entries, 262, (channels >= 3) ? 2 : 1 );                // PhotometricInterpretation: RGB or MinIsBlack
+  addLong( entries, 273, 0 );                                       // StripOffsets: set below
+  addShort( entries, 277, channels );                               // SamplesPerPixel
+  addLong( entries, 278, height );                                  // RowsPerStrip
+  addLong( entries, 279, strip_size );                              // StripByteCounts
+  addShort( entries, 284, 1 );                                      // PlanarConfiguration: contiguous
+  addShort( entries, 317, floating ? 3 : 2 );                       // Predictor
+  addShorts( entries, 339, vector<uint16_t>( channels, floating ? 3 : 1 ) );  // SampleFormat
+
+  // Any channels beyond our color channels are extra samples with unspecified meaning
+  unsigned int extra = channels - ( (channels >= 3) ? 3 : 1 );
+  if( extra > 0 ) addShorts( entries, 338, vector<uint16_t>( extra, 0 ) );
+
+  // Physical resolution with units given as 1 for inches or 2 for centimeters
+  if( dpi_x > 0 && dpi_y > 0 && dpi_units > 0 ){
+    addRational( entries, 282, dpi_x );
+    addRational( entries, 283, dpi_y );
+    addShort( entries, 296, (dpi_units == 2) ? 3 : 2 );
+  }
+
+  if( xmp.size() > 0 ) entries.push_back( TIFFEntry( 700, TIFF_BYTE, xmp.size(), xmp.data(), xmp.size() ) );
+  if( icc.size() > 0 ) entries.push_back( TIFFEntry( 34675, TIFF_UNDEFINED, icc.size(), icc.data(), icc.size() ) );
+
+  sort( entries.begin(), entries.end() );
+
+
+  // Our directory follows our header and is followed by any values too large to fit within their entry and then our strip
+  const uint32_t ifd_size = 2 + entries.size()*12 + 4;
+  uint32_t offset = header_size + ifd_size;
+  for( vector<TIFFEntry>::const_iterator e = entries.begin(); e != entries.end(); e++ ){
+    if( e->value.size() > 4 ) offset += e->value.size() + (e->value.size() & 1);
+  }
+  const uint32_t strip_offset = offset;
+  for( vector<TIFFEntry>::iterator e = entries.begin(); e != entries.end(); e++ ){
+    if( e->tag == 273 ) e->value.assign( (const char*) &strip_offset, sizeof(uint32_t) );
+  }
+
+  string output;
+  output.reserve( strip_offset + strip_size );
+
+  // Header: byte order, magic number and offset of our directory
+  output.append( byte_order_little_endian() ? "II" : "MM" );
+  uint16_t magic = 42;
+  output.append( (const char*) &magic, 2 );
+  output.append( (const char*) &header_size, 4 );
+
+  // Directory entries
+  uint16_t n = entries.size();
+  output.append( (const char*) &n, 2 );
+  uint32_t value_offset = header_size + ifd_size;
+  for( vector<TIFFEntry>::const_iterator e = entries.begin(); e != entries.end(); e++ ){
+    output.append( (const char*) &e->tag, 2 );
+    output.append( (const char*) &e->type, 2 );
+    output.append( (const char*) &e->count, 4 );
+    if( e->value.size() > 4 ){
+      output.append( (const char*) &value_offset, 4 );
+      value_offset += e->value.size() + (e->value.size() & 1);
+    }
+    else{
+      // Values that fit are left-justified within the 4 byte value field
+      output.append( e->value );
+      output.append( 4 - e->value.size(), '\0' );
+    }
+  }
+  uint32_t next = 0;
+  output.append( (const char*) &next, 4 );
+
+  // Values too large for their entries, each starting on a word boundary
+  for( vector<TIFFEntry>::const_iterator e = entries.begin(); e != entries.end(); e++ ){
+    if( e->value.size() > 4 ){
+      output.append( e->value );
+      if( e->value.size() & 1 ) output.append( 1, '\0' );
+    }
+  }
+
+  output.append( (const char*) &strip[0], strip_size );
+
+
+  // Allocate the appropriate amount of memory if the encoded TIFF is larger than the raw image buffer
+  if( output.size() > rawtile.capacity || !rawtile.memoryManaged ){
+    if( rawtile.memoryManaged ) delete[] (unsigned char*) rawtile.data;
+    rawtile.data = new unsigned char[output.size()];
+    rawtile.capacity = output.size();
+    rawtile.memoryManaged = 1;
+  }
+
+  rawtile.dataLength = output.size();
+  memcpy( rawtile.data, output.data(), rawtile.dataLength );
+
+  // Set the tile compression type
+  rawtile.compressionType = ImageEncoding::DEFLATE;
+  rawtile.quality = Q;
+
+  // Return the size of the data we have compressed
+  return rawtile.dataLength;
+}
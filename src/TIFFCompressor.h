@@ -0,0 +1,82 @@
+/*
+    IIP Deflate compressed TIFF Compressor Class:
+    Handles full precision output of 8, 16 and 32 bit integer and floating point data
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _TIFFCOMPRESSOR_H
+#define _TIFFCOMPRESSOR_H
+
+
+#include "Compressor.h"
+
+
+
+/// Deflate compressed TIFF encoder for lossless output at the native bit depth of an image
+/** Tiles and regions are written as single strip TIFF images using Deflate (Adobe) compression.
+    Integer data uses horizontal differencing (TIFF predictor 2) and floating point data the
+    floating point predictor (TIFF predictor 3), which shuffles the bytes of each row into byte
+    planes before differencing, so that data of any precision compresses well and can be read
+    by any TIFF reader. The Q parameter of the Compressor class stores the zlib compression level (0-9)
+ */
+class TIFFCompressor : public Compressor {
+
+ public:
+
+  /// Constructor
+  /** @param compressionLevel zlib compression level (0-9) */
+  TIFFCompressor( int compressionLevel ) : Compressor( compressionLevel ) {};
+
+
+  /// Set the compression level
+  /** @param quality zlib compression level (0-9) */
+  inline void setQuality( int quality ){
+
+    // Flag that user has manually changed quality level
+    default_quality = false;
+
+    // Deflate compression level
+    if( quality < 0 ) Q = 0;
+    else if( quality > 9 ) Q = 9;
+    else Q = quality;
+  }
+
+
+  /// Compress an entire tile or region in one go
+  /** @param rawtile tile of 8, 16 or 32 bit data, which is replaced by the encoded TIFF image
+      @return size of the encoded image in bytes
+   */
+  unsigned int Compress( RawTile& rawtile );
+
+
+  /// Return the TIFF mime type
+  inline const char* getMimeType() const { return "image/tiff"; };
+
+
+  /// Return the image filename suffix
+  inline const char* getSuffix() const { return "tif"; };
+
+
+  /// Get compression type
+  inline ImageEncoding getImageEncoding() const { return ImageEncoding::DEFLATE; };
+
+};
+
+
+#endif
@@ -20,6 +20,7 @@
 
 
 #include "Task.h"
+#include "SequencePrefetch.h"
 
 using namespace std;
 
@@ -121,13 +122,25 @@ void TIL::run( Session* session, const std::string& a ){
   }
 
 
+  TileManager tilemanager( session->tileCache, *session->image, session->watermark, session->jpeg, session->logfile, session->loglevel, session->memcached );
+  tilemanager.setOverload( session->overload );
+
+  // Fetch any tiles available in our shared tile store in a single batch
+  if( session->memcached ){
+    vector<int> tiles;
+    for( int i = startx; i <= endx; i++ ){
+      for( int j = starty; j <= endy; j++ ) tiles.push_back( i + (j*ntlx) );
+    }
+    tilemanager.prefetch( resolution, tiles, session->view->xangle, session->view->yangle, ImageEncoding::JPEG );
+  }
+
+
   for( int i = startx; i <= endx; i++ ){
     for( int j = starty; j <= endy; j++ ){
 
       int n = i + (j*ntlx);
 
       // Get our tile using our tile manager
-      TileManager tilemanager( session->tileCache, *session->image, session->watermark, session->jpeg, session->logfile, session->loglevel );
       RawTile rawtile = tilemanager.getTile( resolution, n, session->view->xangle,
 					     session->view->yangle, session->view->getLayers(), ImageEncoding::JPEG );
 
@@ -210,6 +223,9 @@ void TIL::run( Session* session, const std::string& a ){
        */
       session->out->putS( "\r\n" );
 
+      // Prefetch this tile for the angles adjacent to those of image sequences
+      SequencePrefetch::record( session, rawtile, session->jpeg, 0, 0 );
+
       if( session->out->flush()  == -1 ) {
 	if( session->loglevel >= 1 ){
 	  *(session->logfile) << "TIL :: Error flushing jpeg tile" << endl;
@@ -23,6 +23,8 @@
 
 #include "TPTImage.h"
 #include "Logger.h"
+#include "DecodeCache.h"
+#include "JPEGTileDecoder.h"
 #include <sstream>
 
 using namespace std;
@@ -39,6 +41,22 @@ static const char* mode = "rmO";
 extern Logger logfile;
 
 
+// Size of the virtual tiles used to serve striped images
+static const unsigned int striped_tile_size = 256;
+
+// Maximum memory in bytes used to cache decoded strips of striped images
+static const size_t strip_cache_size = 64 * 1024 * 1024;
+
+
+
+// Decoded strips shared by all striped images within this process
+static DecodeCache strip_cache( strip_cache_size );
+
+// Persistent decompressor for JPEG-encoded tiles and buffer for their raw data
+static JPEGTileDecoder jpeg_decoder;
+static vector<unsigned char> jpeg_buffer;
+
+
 // Handle libtiff errors as exceptions and log warnings to our Logger
 static void errorHandler( const char* module, const char* fmt, va_list args ){
   char buffer[1024];
@@ -76,6 +94,9 @@ void TPTImage::openImage()
     throw file_error( "TPTImage :: TIFFOpen() failed for: " + filename );
   }
 
+  // Images stored in strips rather than tiles are served through virtual tiles
+  striped = !TIFFIsTiled( tiff );
+
   // Load our metadata if not already loaded
   if( bpc == 0 ) loadImageInfo( currentX, currentY );
 
@@ -95,10 +116,7 @@ void TPTImage::loadImageInfo( int seq, int ang )
   int count = 0;
   uint16_t colour, samplesperpixel, bitspersample, sampleformat;
   double *sminvalue = NULL, *smaxvalue = NULL;
-  double scale;
   unsigned int tw, th, w, h;
-  string filename;
-  const char *tmp = NULL;
 
   currentX = seq;
   currentY = ang;
@@ -116,7 +134,11 @@ void TPTImage::loadImageInfo( int seq, int ang )
 
   // If image is untiled, set tile sizes to zero
   if( TIFFGetField( tiff, TIFFTAG_TILEWIDTH, &tw ) == 0 ) tw = 0;
-  if( TIFFGetField( tiff, TIFFTAG_TILEWIDTH, &th ) == 0 ) th = 0;
+  if( TIFFGetField( tiff, TIFFTAG_TILELENGTH, &th ) == 0 ) th = 0;
+
+  // Serve striped images through virtual tiles
+  striped = ( tw == 0 || th == 0 );
+  if( striped ) tw = th = striped_tile_size;
 
   // Units for libtiff are 1=unknown, 2=DPI and 3=pixels/cm, whereas we want 0=unknown, 1=DPI and 2=pixels/cm
   dpi_units--;
@@ -153,8 +175,9 @@ void TPTImage::loadImageInfo( int seq, int ang )
   // Sub-resolutions can either be stored within the SubIFDs of a top-level IFD or in separate top-level IFDs.
   // Check first for sub-resolution levels stored within SubIFDs (as used by OME-TIFF).
   // In these files, the full resolution image is stored in the first IFD and subsequent
-  // resolutions are stored in SubIFDs
-  loadSubIFDs();
+  // resolutions are stored in SubIFDs. Striped images only use their full resolution
+  if( striped ) subifds.clear();
+  else loadSubIFDs();
   subifd_ifd = 0;
 
   if( subifds.size() > 0 ){
@@ -193,7 +216,7 @@ void TPTImage::loadImageInfo( int seq, int ang )
   }
 
   // If there are no SubIFD resolutions, look for them in the main sequence of IFD TIFF directories
-  if( pyramid == NORMAL ){
+  if( pyramid == NORMAL && !striped ){
     for( count = 0; TIFFReadDirectory( tiff ); count++ ){
 
       // Only use tiled IFD directories
@@ -231,6 +254,25 @@ void TPTImage::loadImageInfo( int seq, int ang )
   }
 
 
+  // Synthesise lower resolutions for striped images down to the size of a single tile
+  virtual_levels = 0;
+  if( striped ){
+    while( w > tw || h > th ){
+      w = (w+1) / 2;
+      h = (h+1) / 2;
+      image_widths.push_back( w );
+      image_heights.push_back( h );
+      tile_widths.push_back( tw );
+      tile_heights.push_back( th );
+      virtual_levels++;
+    }
+    if( IIPImage::logging ){
+      logfile << "TPTImage :: Striped image: serving virtual " << tw << "x" << th << " tiles with "
+	      << virtual_levels << " synthesised resolutions" << endl;
+    }
+  }
+
+
   // Total number of available resolutions
   numResolutions = image_widths.size();
 
@@ -296,6 +338,7 @@ void TPTImage::loadImageInfo( int seq, int ang )
   // Make sure our min and max arrays are empty
   min.clear();
   max.clear();
+  default_range = false;
 
   for( unsigned int i=0; i<channels; i++ ){
     // Set our max to the full bit range if max not set in header
@@ -304,7 +347,10 @@ void TPTImage::loadImageInfo( int seq, int ang )
       else if( bpc == 12 ) smaxvalue[i] = 4095.0;
       else if( bpc == 16 ) smaxvalue[i] = 65535.0;
       else if( bpc == 32 && sampleType == SampleType::FIXEDPOINT ) smaxvalue[i] = 4294967295.0;
-      else if( bpc == 32 && sampleType == SampleType::FLOATINGPOINT ) smaxvalue[i] = 1.0;  // Set dummy value for float
+      else if( bpc == 32 && sampleType == SampleType::FLOATINGPOINT ){
+	smaxvalue[i] = 1.0;  // Set dummy value for float, to be replaced by the range given by our image statistics
+	default_range = true;
+      }
     }
     min.push_back( (float)sminvalue[i] );
     max.push_back( (float)smaxvalue[i] );
@@ -313,7 +359,35 @@ void TPTImage::loadImageInfo( int seq, int ang )
   delete[] default_min;
   delete[] default_max;
 
-  // Also get some basic metadata
+  // Descriptive metadata, XMP and ICC profiles can be large, so only load these on demand
+  metadata.clear();
+  metadata_loaded = false;
+}
+
+
+
+void TPTImage::loadMetadata()
+{
+  uint32_t count;
+  double scale;
+  const char *tmp = NULL;
+
+  if( metadata_loaded ) return;
+
+  // Open the TIFF if it's not already open
+  if( !tiff ){
+    string filename = getFileName( currentX, currentY );
+    if( ( tiff = TIFFOpen( filename.c_str(), mode ) ) == NULL ){
+      throw file_error( "TPTImage :: TIFFOpen() failed for: " + filename );
+    }
+  }
+
+  // Metadata is stored within the first TIFF directory
+  tdir_t current_dir = TIFFCurrentDirectory( tiff );
+  if( current_dir != 0 ){
+    if( !TIFFSetDirectory( tiff, 0 ) ) throw file_error( "TPTImage :: TIFFSetDirectory() failed" );
+  }
+
   if( TIFFGetField( tiff, TIFFTAG_ARTIST, &tmp ) ) metadata["creator"] = tmp;
   if( TIFFGetField( tiff, TIFFTAG_COPYRIGHT, &tmp ) ) metadata["rights"] = tmp;
   if( TIFFGetField( tiff, TIFFTAG_DATETIME, &tmp ) ) metadata["date"] = tmp;
@@ -330,6 +404,13 @@ void TPTImage::loadImageInfo( int seq, int ang )
     snprintf( buffer, sizeof(buffer), "%g", scale );
     metadata["scale"] = buffer;
   }
+
+  // Reset the TIFF directory to where it was
+  if( current_dir != 0 ){
+    if( !TIFFSetDirectory( tiff, current_dir ) ) throw file_error( "TPTImage :: TIFFSetDirectory() failed" );
+  }
+
+  metadata_loaded = true;
 }
 
 
@@ -373,6 +454,7 @@ RawTile TPTImage::getTile( int x, int y, unsigned int res, int layers, unsigned
     if( ( tiff = TIFFOpen( filename.c_str(), mode ) ) == NULL ){
       throw file_error( "TPTImage :: TIFFOpen() failed for:" + filename );
     }
+    striped = !TIFFIsTiled( tiff );
   }
 
 
@@ -382,6 +464,10 @@ RawTile TPTImage::getTile( int x, int y, unsigned int res, int layers, unsigned
   }
 
 
+  // Striped images are served through virtual tiles
+  if( striped ) return getStripedTile( x, y, res, tile );
+
+
   // The IIP protocol defines the first resolution as the smallest, so we need to invert
   //  the requested resolution as our TIFF images are stored with the largest resolution first
   int vipsres = ( numResolutions - 1 ) - res;
@@ -504,7 +590,7 @@ RawTile TPTImage::getTile( int x, int y, unsigned int res, int layers, unsigned
 
   // Initialize our RawTile object
   RawTile rawtile( tile, res, x, y, tile_widths[vipsres], tile_heights[vipsres], channels, bpc );
-  rawtile.filename = getImagePath();
+  rawtile.imageId = getImageId();
   rawtile.timestamp = timestamp;
   rawtile.sampleType = sampleType;
 
@@ -590,6 +676,13 @@ RawTile TPTImage::getTile( int x, int y, unsigned int res, int layers, unsigned
   }
 #endif
 
+  // Decode 8 bit JPEG-encoded tiles ourselves, bypassing the per-tile setup of libtiff's JPEG codec
+  else if( compression == COMPRESSION_JPEG && bpc == 8 && (channels == 1 || (channels == 3 && planar == PLANARCONFIG_CONTIG)) &&
+	   decodeJPEGTile( tile, (unsigned char*) rawtile.data, colour, rawtile.ycbcr ) ){
+    rawtile.dataLength = bytes;
+    rawtile.compressionType = ImageEncoding::RAW;
+  }
+
   // Decode the tile into raw pixel data - dump data directly into RawTile buffer
   else{
 
@@ -655,6 +748,213 @@ RawTile TPTImage::getTile( int x, int y, unsigned int res, int layers, unsigned
 
 
 
+bool TPTImage::decodeJPEGTile( unsigned int tile, unsigned char* output, uint16_t colour, bool& ycbcr )
+{
+  unsigned char* jpeg_tables = NULL;
+  uint32_t count = 0;
+  uint32_t tw, th;
+
+  TIFFGetField( tiff, TIFFTAG_TILEWIDTH, &tw );
+  TIFFGetField( tiff, TIFFTAG_TILELENGTH, &th );
+  if( TIFFGetField( tiff, TIFFTAG_JPEGTABLES, &count, &jpeg_tables ) == 0 ) count = 0;
+
+  // Size of our raw tile data - use the on-demand loading of byte counts where available
+#if TIFFLIB_VERSION >= 20191103
+  uint64_t length = TIFFGetStrileByteCount( tiff, tile );
+#else
+  uint64_t *bytecounts = NULL;
+  uint64_t length = TIFFGetField( tiff, TIFFTAG_TILEBYTECOUNTS, &bytecounts ) ? bytecounts[tile] : 0;
+#endif
+  if( length == 0 ) return false;
+
+  // YCbCr data can be left unconverted if the tile is to be re-encoded as JPEG
+  bool ycbcr_input = ( colour == PHOTOMETRIC_YCBCR );
+  bool leave_ycbcr = ycbcr_input && ycbcr_output && channels == 3;
+
+  // Our decoder and buffer are shared by all images, so only one thread may use them at a time.
+  // Exceptions may not leave a critical section, so keep any errors until it has been left
+  string read_error, decode_error;
+
+#if defined(_OPENMP)
+#pragma omp critical(jpeg_decoder)
+#endif
+  {
+    try{
+      if( jpeg_buffer.size() < length ) jpeg_buffer.resize( length );
+      tmsize_t n = TIFFReadRawTile( tiff, (ttile_t) tile, (tdata_t) jpeg_buffer.data(), (tmsize_t) length );
+      if( n <= 0 ){
+	read_error = "TPTImage :: TIFFReadRawTile() failed for JPEG-encoded tile for " + getFileName( currentX, currentY );
+      }
+      else jpeg_decoder.decode( jpeg_tables, count, jpeg_buffer.data(), n, tw, th, channels, ycbcr_input, leave_ycbcr, output );
+    }
+    catch( const file_error& error ){ read_error = error.what(); }
+    catch( const string& error ){ decode_error = error; }
+  }
+
+  if( !read_error.empty() ) throw file_error( read_error );
+
+  if( !decode_error.empty() ){
+    // Let libtiff handle anything we are unable to decode
+    if( IIPImage::logging ) logfile << "TPTImage :: " << decode_error << ": decoding with libtiff" << endl;
+    return false;
+  }
+
+  ycbcr = leave_ycbcr;
+  return true;
+}
+
+
+
+RawTile TPTImage::getStripedTile( int x, int y, unsigned int res, unsigned int tile )
+{
+  uint32_t rows_per_strip;
+  uint16_t colour, planar, compression, samplesperpixel, bitspersample;
+
+  // All resolutions are taken from the full resolution image in the first directory of the file
+  if( TIFFCurrentDirectory( tiff ) != 0 ){
+    if( !TIFFSetDirectory( tiff, 0 ) ) throw file_error( "TPTImage :: TIFFSetDirectory() failed" );
+  }
+
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_PHOTOMETRIC, &colour );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_PLANARCONFIG, &planar );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_COMPRESSION, &compression );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesperpixel );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_BITSPERSAMPLE, &bitspersample );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip );
+
+  // JPEG encoded strips can be subsampled YCbCr encoded. Ask to decode these to RGB
+  if( colour == PHOTOMETRIC_YCBCR ) TIFFSetField( tiff, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB );
+
+  // Only handle the first plane of images with separate image planes, as for tiled images
+  unsigned int spp = ( planar == PLANARCONFIG_SEPARATE ) ? 1 : samplesperpixel;
+  if( bitspersample != 1 && bitspersample % 8 != 0 ){
+    ostringstream error;
+    error << "TPTImage :: Unsupported bit depth for striped image: " << bitspersample;
+    throw file_error( error.str() );
+  }
+  if( bitspersample == 1 && spp != 1 ){
+    throw file_error( "TPTImage :: Unsupported multi-channel bilevel striped image" );
+  }
+
+
+  // Locate our tile within the requested resolution
+  int vipsres = ( numResolutions - 1 ) - res;
+  unsigned int factor = 1 << vipsres;
+  unsigned int full_width = image_widths[0];
+  unsigned int full_height = image_heights[0];
+  unsigned int im_width = image_widths[vipsres];
+  unsigned int im_height = image_heights[vipsres];
+  unsigned int tw = tile_widths[vipsres];
+  unsigned int th = tile_heights[vipsres];
+  unsigned int ntlx = (im_width / tw) + (im_width % tw == 0 ? 0 : 1);
+  unsigned int ntly = (im_height / th) + (im_height % th == 0 ? 0 : 1);
+
+  if( tile >= ntlx * ntly ){
+    ostringstream tile_no;
+    tile_no << "TPTImage :: Asked for non-existent tile: " << tile;
+    throw file_error( tile_no.str() );
+  }
+
+  unsigned int left = (tile % ntlx) * tw;
+  unsigned int top = (tile / ntlx) * th;
+  if( left + tw > im_width ) tw = im_width - left;
+  if( top + th > im_height ) th = im_height - top;
+
+
+  // Bilevel images are unpacked to 8 bits
+  unsigned int out_bpc = ( bitspersample == 1 ) ? 8 : bitspersample;
+  unsigned int pixel_bytes = spp * out_bpc / 8;
+  unsigned char black = 0, white = 255;
+  if( colour == PHOTOMETRIC_MINISWHITE ){
+    black = 255; white = 0;
+  }
+
+  RawTile rawtile( tile, res, x, y, tw, th, spp, out_bpc );
+  rawtile.imageId = getImageId();
+  rawtile.timestamp = timestamp;
+  rawtile.sampleType = sampleType;
+  rawtile.allocate();
+  rawtile.dataLength = (size_t) tw * th * pixel_bytes;
+  rawtile.compressionType = ImageEncoding::RAW;
+  unsigned char* output = (unsigned char*) rawtile.data;
+
+  tmsize_t scanline_size = TIFFScanlineSize( tiff );
+  tmsize_t strip_size = TIFFStripSize( tiff );
+  if( rows_per_strip == 0 || rows_per_strip > full_height ) rows_per_strip = full_height;
+
+  // Uncompressed rows can be read individually, so only compressed strips need to be decoded and cached
+  vector<unsigned char> row_buffer( scanline_size );
+
+  string prefix = getFileName( x, y ) + ":" + to_string( (long long) timestamp ) + ":";
+
+  // Synthesise each row of our tile by subsampling the corresponding row of the full resolution image
+  for( unsigned int j = 0; j < th; j++ ){
+
+    uint32_t row = (uint32_t)( (top + j) * factor );
+    if( row >= full_height ) row = full_height - 1;
+
+    const unsigned char* line;
+
+    if( compression == COMPRESSION_NONE ){
+      if( TIFFReadScanline( tiff, (tdata_t) row_buffer.data(), row, 0 ) == -1 ){
+	throw file_error( "TPTImage :: TIFFReadScanline() failed for " + getFileName( x, y ) );
+      }
+      line = row_buffer.data();
+    }
+    else{
+      tstrip_t strip = TIFFComputeStrip( tiff, row, 0 );
+      string key = prefix + to_string( (unsigned long long) strip );
+      size_t offset = (size_t)( row % rows_per_strip ) * scanline_size;
+
+      // Our strip cache is shared between threads, so copy our row out of it while it is locked
+      bool cached = false;
+#if defined(_OPENMP)
+#pragma omp critical(strip_cache)
+#endif
+      {
+	const vector<unsigned char>* data = strip_cache.find( key );
+	if( data ){
+	  memcpy( row_buffer.data(), data->data() + offset, scanline_size );
+	  cached = true;
+	}
+      }
+
+      if( !cached ){
+	vector<unsigned char> buffer( strip_size );
+	if( TIFFReadEncodedStrip( tiff, strip, (tdata_t) buffer.data(), strip_size ) == -1 ){
+	  throw file_error( "TPTImage :: TIFFReadEncodedStrip() failed for " + getFileName( x, y ) );
+	}
+	memcpy( row_buffer.data(), buffer.data() + offset, scanline_size );
+#if defined(_OPENMP)
+#pragma omp critical(strip_cache)
+#endif
+	strip_cache.insert( key, buffer );
+      }
+      line = row_buffer.data();
+    }
+
+    unsigned char* out = &output[ (size_t) j * tw * pixel_bytes ];
+
+    for( unsigned int i = 0; i < tw; i++ ){
+      uint32_t column = (uint32_t)( (left + i) * factor );
+      if( column >= full_width ) column = full_width - 1;
+      if( bitspersample == 1 ){
+	// TIFF bilevel data is packed MSB first
+	out[i] = ( line[column >> 3] & ( 0x80 >> (column & 7) ) ) ? white : black;
+      }
+      else memcpy( &out[ (size_t) i * pixel_bytes ], &line[ (size_t) column * pixel_bytes ], pixel_bytes );
+    }
+  }
+
+  if( IIPImage::logging && factor > 1 ){
+    logfile << "TPTImage :: Synthesised striped tile at resolution " << res << " with subsampling factor " << factor << endl;
+  }
+
+  return rawtile;
+}
+
+
+
 // Load any list of SubIFDs linked to this IFD
 void TPTImage::loadSubIFDs()
 {
@@ -44,27 +44,50 @@ class TPTImage : public IIPImage {
   /// To which IFD do these SubIFDs belong
   tdir_t subifd_ifd;
 
+  /// Whether the full resolution image is stored in strips rather than tiles
+  bool striped;
+
   /// Load any SubIFD offsets
   void loadSubIFDs();
 
   /// Load any stack metadata - name and scale
   void loadStackInfo();
 
+  /// Get a virtual tile from a striped image
+  /** Tiles are cut out of the full resolution image, decoding only the strips containing the rows
+      required. Lower resolutions are synthesised by subsampling, so that only every n-th row is needed.
+      Decoded strips are cached, as each strip is generally shared by several tiles
+      @param x horizontal sequence angle
+      @param y vertical sequence angle
+      @param res resolution
+      @param tile tile number
+   */
+  RawTile getStripedTile( int x, int y, unsigned int res, unsigned int tile );
+
+  /// Decode a JPEG-encoded tile of the current directory directly with our persistent JPEG decoder
+  /** @param tile tile number
+      @param output buffer for the decoded tile
+      @param colour photometric interpretation
+      @param ycbcr set to whether the decoded data has been left as YCbCr
+      @return false if the tile could not be decoded and should be decoded by libtiff instead
+   */
+  bool decodeJPEGTile( unsigned int tile, unsigned char* output, uint16_t colour, bool& ycbcr );
+
 
  public:
 
   /// Constructor
-  TPTImage():IIPImage(), tiff( NULL ) {};
+  TPTImage():IIPImage(), tiff( NULL ), subifd_ifd(0), striped(false) {};
 
   /// Constructor
   /** @param path image path
    */
-  TPTImage( const std::string& path ): IIPImage(path), tiff(NULL), subifd_ifd(0) {};
+  TPTImage( const std::string& path ): IIPImage(path), tiff(NULL), subifd_ifd(0), striped(false) {};
 
   /// Copy Constructor
   /** @param image IIPImage object
    */
-  TPTImage( const TPTImage& image ): IIPImage(image), tiff(NULL), subifd_ifd(0) {};
+  TPTImage( const TPTImage& image ): IIPImage(image), tiff(NULL), subifd_ifd(0), striped(image.striped) {};
 
   /// Assignment Operator
   /** @param image TPTImage object
@@ -74,6 +97,7 @@ class TPTImage : public IIPImage {
       closeImage();
       IIPImage::operator=(image);
       tiff = image.tiff;
+      striped = image.striped;
     }
     return *this;
   }
@@ -81,7 +105,7 @@ class TPTImage : public IIPImage {
   /// Construct from an IIPImage object
   /** @param image IIPImage object
    */
-  TPTImage( const IIPImage& image ): IIPImage(image), tiff(NULL), subifd_ifd(0) {};
+  TPTImage( const IIPImage& image ): IIPImage(image), tiff(NULL), subifd_ifd(0), striped(false) {};
 
   /// Destructor
   ~TPTImage() { closeImage(); };
@@ -98,6 +122,9 @@ class TPTImage : public IIPImage {
    */
   void loadImageInfo( int x, int y );
 
+  /// Overloaded function for loading optional metadata on demand: descriptive tags, XMP and ICC profile
+  void loadMetadata();
+
   /// Overloaded function for closing a TIFF image
   void closeImage();
 
@@ -22,7 +22,11 @@
 #include "Task.h"
 #include "Tokenizer.h"
 #include "URL.h"
+#include "MetadataIndex.h"
 #include <cstdlib>
+#include <stdexcept>
+#include <map>
+#include <sstream>
 #include <cmath>
 #include <algorithm>
 
@@ -41,6 +45,8 @@ Task* Task::factory( const string& t ){
 
   if( type == "obj" ) return new OBJ;
   else if( type == "fif" ) return new FIF;
+  else if( type == "info" ) return new INFO;
+  else if( type == "sheet" ) return new SHEET;
   else if( type == "qlt" ) return new QLT;
   else if( type == "sds" ) return new SDS;
   else if( type == "minmax" ) return new MINMAX;
@@ -56,6 +62,9 @@ Task* Task::factory( const string& t ){
 #endif
 #ifdef HAVE_WEBP
   else if( type == "wtl" ) return new WTL;
+#endif
+#ifdef HAVE_ZLIB
+  else if( type == "dtl" ) return new DTL;
 #endif
   else if( type == "jtl" ) return new JTL;
   else if( type == "jtls" ) return new JTLS;
@@ -72,6 +81,7 @@ Task* Task::factory( const string& t ){
   else if( type == "ctw" ) return new CTW;
   else if( type == "col" ) return new COL;
   else if( type == "cnv" ) return new CNV;
+  else if( type == "stk" ) return new STK;
   else if( type == "iiif" ) return new IIIF;
   else return NULL;
 
@@ -87,6 +97,361 @@ void Task::checkImage(){
 
 
 
+void Task::loadMetadata(){
+
+  IIPImage* image = *(session->image);
+  if( !image || image->metadataLoaded() ) return;
+
+  Timer metadata_timer;
+  if( session->loglevel >= 3 ) metadata_timer.start();
+
+  image->loadMetadata();
+
+  // Memoise in our metadata cache so that subsequent requests need not reload
+  imageCacheMapType::iterator i = session->imageCache->find( image->getImagePath() );
+  if( i != session->imageCache->end() && i->second.timestamp == image->timestamp ){
+    i->second = *image;
+  }
+
+  if( session->loglevel >= 3 ){
+    *(session->logfile) << "Task :: Image metadata loaded in " << metadata_timer.getTime() << " microseconds" << endl;
+  }
+}
+
+
+
+void Task::loadStatistics( TileManager& tilemanager ){
+
+  IIPImage* image = *(session->image);
+  if( !image ) return;
+
+  // Binary images have no use for a histogram
+  bool need_histogram = image->histogram.empty() && image->getColorSpace() != ColorSpace::BINARY;
+  if( !image->statistics.empty() && !need_histogram ) return;
+
+  Timer statistics_timer;
+  if( session->loglevel >= 3 ) statistics_timer.start();
+
+  // Use our smallest resolution, which should be sufficient for our statistics. If even this is
+  // large, as for images without a pyramid, fall back to the first tile of this resolution
+  unsigned int n = image->getNumResolutions() - 1;
+  unsigned int width = image->image_widths[n];
+  unsigned int height = image->image_heights[n];
+  RawTile thumbnail = ( width <= 2048 && height <= 2048 ) ?
+    tilemanager.getRegion( 0, 0, session->view->yangle, session->view->getLayers(), 0, 0, width, height ) :
+    tilemanager.getTile( 0, 0, 0, session->view->yangle, session->view->getLayers(), ImageEncoding::RAW );
+
+  if( image->statistics.empty() ){
+
+    image->statistics = Statistics::compute( thumbnail );
+
+    // Floating point images would otherwise be normalised using an arbitrary default range
+    if( image->default_range && image->statistics.size() == image->channels ){
+      for( unsigned int c = 0; c < image->channels; c++ ){
+	const BandStatistics& b = image->statistics[c];
+	image->min[c] = b.low;
+	image->max[c] = ( b.high > b.low ) ? b.high : b.maximum;
+      }
+      image->default_range = false;
+    }
+  }
+
+  // Our histogram normalises the thumbnail, so must be calculated last
+  if( need_histogram ){
+    image->histogram = session->processor->histogram( thumbnail, image->max, image->min );
+  }
+
+  // Memoise in our metadata cache and persistent metadata index so that statistics survive restarts
+  imageCacheMapType::iterator i = session->imageCache->find( image->getImagePath() );
+  if( i != session->imageCache->end() && i->second.timestamp == image->timestamp ){
+    i->second = *image;
+  }
+  if( FIF::metadata_index ) FIF::metadata_index->store( image->getImagePath(), *image );
+
+  if( session->loglevel >= 3 ){
+    *(session->logfile) << "Task :: Image statistics calculated in " << statistics_timer.getTime() << " microseconds" << endl;
+  }
+}
+
+
+
+RawTile Task::reduceStack( TileManager& tilemanager, int resolution, int tile,
+			   unsigned int x, unsigned int y, unsigned int w, unsigned int h ){
+
+  enum reduction_type op = session->view->reduction;
+
+  // Ratios and normalized differences use a pair of bands, other reductions every band in our stack
+  list <int> views;
+  if( op == REDUCE_RATIO || op == REDUCE_NDIFF ){
+    list <int> available = (*session->image)->getHorizontalViewsList();
+    for( unsigned int k = 0; k < 2; k++ ){
+      int band = session->view->reduction_bands[k];
+      if( find( available.begin(), available.end(), band ) == available.end() ){
+	ostringstream error;
+	error << "Task :: Stack reduction band " << band << " does not exist";
+	throw error.str();
+      }
+      views.push_back( band );
+    }
+  }
+  else views = (*session->image)->getHorizontalViewsList();
+
+  Timer reduction_timer;
+  if( session->loglevel >= 4 ) reduction_timer.start();
+
+  RawTile reduced;
+  unsigned int n = 0;
+  for( list<int>::const_iterator i = views.begin(); i != views.end(); i++, n++ ){
+
+    // Stop if our client has gone away
+    if( session->cancellation ) session->cancellation->check();
+
+    RawTile band = ( tile >= 0 ) ?
+      tilemanager.getTile( resolution, tile, *i, session->view->yangle, session->view->getLayers(), ImageEncoding::RAW ) :
+      tilemanager.getRegion( resolution, *i, session->view->yangle, session->view->getLayers(), x, y, w, h );
+
+    session->processor->reduce( reduced, band, op, n );
+  }
+
+  if( session->loglevel >= 4 ){
+    *(session->logfile) << "Task :: Stack reduction of " << n << " band" << ((n>1)?"s":"")
+			<< " in " << reduction_timer.getTime() << " microseconds" << endl;
+  }
+
+  return reduced;
+}
+
+
+
+void Task::parseImageList( const string& list, vector<ImageEntry>& entries, vector<unsigned int>& order, unsigned int max ){
+
+  map<string,unsigned int> seen;
+
+  Tokenizer izer( list, "," );
+  while( izer.hasMoreTokens() ){
+
+    URL url( izer.nextToken() );
+    string path = url.decode();
+
+    // Filter out any ../ to prevent users by-passing any file system prefix
+    unsigned int n;
+    while( (n=path.find("../")) < path.length() ) path.erase(n,3);
+    if( path.empty() ) continue;
+
+    map<string,unsigned int>::const_iterator s = seen.find( path );
+    if( s != seen.end() ){
+      order.push_back( s->second );
+      continue;
+    }
+
+    if( entries.size() >= max ){
+      throw invalid_argument( "too many images requested: maximum is " + to_string( max ) );
+    }
+
+    seen[path] = entries.size();
+    order.push_back( entries.size() );
+    entries.push_back( ImageEntry() );
+    entries.back().path = path;
+  }
+}
+
+
+
+unsigned int Task::resolveImages( vector<ImageEntry>& entries ){
+
+  // First look up our metadata cache and persistent index, neither of which may be accessed concurrently
+  Timer function_timer;
+  if( session->loglevel >= 3 ) function_timer.start();
+
+  unsigned int cache_hits = 0, index_hits = 0;
+  for( unsigned int i = 0; i < entries.size(); i++ ){
+
+    ImageEntry& e = entries[i];
+
+    if( FIF::max_metadata_cache_size != 0 ){
+      imageCacheMapType::const_iterator c = session->imageCache->find( e.path );
+      if( c != session->imageCache->end() ){
+	e.image = c->second;
+	e.cached = true;
+	cache_hits++;
+	continue;
+      }
+    }
+
+    e.image = IIPImage( e.path );
+    e.image.setFileNamePattern( FIF::filename_pattern );
+    e.image.setFileSystemPrefix( FIF::filesystem_prefix );
+    e.image.setFileSystemSuffix( FIF::filesystem_suffix );
+
+    // Index records are validated against the modification time of the image file on retrieval
+    if( FIF::metadata_index && FIF::metadata_index->retrieve( e.path, e.image ) ){
+      e.resolved = true;
+      index_hits++;
+    }
+  }
+
+  if( session->loglevel >= 3 ){
+    *(session->logfile) << "Task :: " << cache_hits << " metadata cache hits and " << index_hits
+			<< " persistent index hits in " << function_timer.getTime() << " microseconds" << endl;
+  }
+
+
+  // Check cached images are up to date and open the remaining images in parallel. Decoder modules
+  // may not be thread-safe, so these are left for later. Codec logging is not synchronised, so
+  // only work in parallel if this is disabled
+  if( session->loglevel >= 3 ) function_timer.start();
+
+  vector<unsigned int> deferred;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) if( !IIPImage::logging )
+#endif
+  for( int i = 0; i < (int) entries.size(); i++ ){
+
+    ImageEntry& e = entries[i];
+    if( e.resolved ) continue;
+
+    try{
+
+      // Reload cached metadata if the image has since been modified
+      if( e.cached ){
+	time_t timestamp = e.image.timestamp;
+	e.image.updateTimestamp( e.image.getFileName( e.image.currentX, e.image.currentY ) );
+	if( e.image.timestamp == timestamp ){
+	  e.resolved = true;
+	  continue;
+	}
+	e.cached = false;
+	e.image = IIPImage( e.path );
+	e.image.setFileNamePattern( FIF::filename_pattern );
+	e.image.setFileSystemPrefix( FIF::filesystem_prefix );
+	e.image.setFileSystemSuffix( FIF::filesystem_suffix );
+      }
+
+      e.image.Initialise();
+
+      if( e.image.getImageFormat() == ImageEncoding::UNSUPPORTED ){
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+	deferred.push_back( i );
+	continue;
+      }
+
+      IIPImage* image = FIF::createImage( session, e.image, false );
+      try{
+	image->openImage();
+	e.image = *image;
+      }
+      catch( ... ){
+	delete image;
+	throw;
+      }
+      delete image;
+
+      e.resolved = true;
+      e.update_index = true;
+    }
+    catch( const exception& error ){
+      e.error = error.what();
+    }
+    catch( const string& error ){
+      e.error = error;
+    }
+    catch( ... ){
+      e.error = "Unable to open image";
+    }
+  }
+
+
+  // Images handled by decoder modules are opened sequentially
+  for( unsigned int i = 0; i < deferred.size(); i++ ){
+    ImageEntry& e = entries[deferred[i]];
+    try{
+      IIPImage* image = FIF::createImage( session, e.image, false );
+      try{
+	image->openImage();
+	e.image = *image;
+      }
+      catch( ... ){
+	delete image;
+	throw;
+      }
+      delete image;
+      e.resolved = true;
+      e.update_index = true;
+    }
+    catch( const exception& error ){
+      e.error = error.what();
+    }
+    catch( const string& error ){
+      e.error = error;
+    }
+    catch( ... ){
+      e.error = "Unable to open image";
+    }
+  }
+
+  if( session->loglevel >= 3 ){
+    *(session->logfile) << "Task :: Images checked and opened in " << function_timer.getTime() << " microseconds" << endl;
+  }
+
+
+  // Store newly opened images in our metadata cache and persistent index
+  unsigned int errors = 0;
+  for( unsigned int i = 0; i < entries.size(); i++ ){
+
+    ImageEntry& e = entries[i];
+    if( !e.resolved ){
+      errors++;
+      if( session->loglevel >= 1 ) *(session->logfile) << "Task :: " << e.path << ": " << e.error << endl;
+      continue;
+    }
+    if( e.cached ) continue;
+
+    if( e.update_index && FIF::metadata_index ) FIF::metadata_index->store( e.path, e.image );
+
+    if( FIF::max_metadata_cache_size != 0 ){
+      // Delete items if our metadata cache becomes too large - unless we have set cache size to -1 (unlimited)
+      if( FIF::max_metadata_cache_size > 0 ){
+	while( session->imageCache->size() >= (unsigned long) FIF::max_metadata_cache_size ){
+	  session->imageCache->erase( session->imageCache->begin() );
+	}
+      }
+      (*session->imageCache)[e.path] = e.image;
+    }
+  }
+
+  return errors;
+}
+
+
+
+string Task::escapeJSON( const string& s ){
+  string json;
+  for( unsigned int i = 0; i < s.length(); i++ ){
+    char c = s[i];
+    if( c == '"' || c == '\\' ) json += '\\';
+    if( (unsigned char) c < 0x20 ) continue;
+    json += c;
+  }
+  return json;
+}
+
+
+
+void Task::getServedTileSize( Session* session, unsigned int& tw, unsigned int& th ){
+  if( session->tileSize > 0 ){
+    tw = th = session->tileSize;
+  }
+  else{
+    tw = (*session->image)->getTileWidth();
+    th = (*session->image)->getTileHeight();
+  }
+}
+
+
+
 void QLT::run( Session* session, const string& argument ){
 
   if( argument.length() ){
@@ -97,7 +462,7 @@ void QLT::run( Session* session, const string& argument ){
     if( factor < 0 || factor > 100 ){
       if( session->loglevel >= 2 ){
 	*(session->logfile) << "QLT :: Quality factor of " << argument
-			    << " out of bounds. Must be 0-100 for JPEG and 0-9 for PNG" << endl;
+			    << " out of bounds. Must be 0-100 for JPEG and 0-9 for PNG and TIFF" << endl;
       }
     }
 
@@ -108,6 +473,9 @@ void QLT::run( Session* session, const string& argument ){
 #ifdef HAVE_WEBP
     session->webp->setQuality( factor );
 #endif
+#ifdef HAVE_ZLIB
+    session->tiff->setQuality( factor );
+#endif
 
     if( session->loglevel >= 2 ) *(session->logfile) << "QLT :: Requested quality is " << factor << endl;
   }
@@ -263,6 +631,12 @@ void CVT::run( Session* session, const string& src ){
     session->view->output_format = ImageEncoding::WEBP;
     if( session->loglevel >= 3 ) *(session->logfile) << "CVT :: WebP output" << endl;
   }
+#endif
+#ifdef HAVE_ZLIB
+  else if( argument == "tiff" || argument == "tif" ){
+    session->view->output_format = ImageEncoding::DEFLATE;
+    if( session->loglevel >= 3 ) *(session->logfile) << "CVT :: Deflate compressed TIFF output" << endl;
+  }
 #endif
   else{
     session->view->output_format = ImageEncoding::JPEG;
@@ -668,3 +1042,65 @@ void CNV::run( Session* session, const string& src ){
   }
 
 }
+
+
+
+void STK::run( Session* session, const string& src ){
+
+  /* The argument is the reduction to apply across the bands of an image stack: MAX, MIN, MEAN or SUM
+     over all bands or RATIO:a,b or ND:a,b for the ratio a/b or normalized difference (a-b)/(a+b) of
+     the two stack bands a and b, which are given as horizontal sequence numbers
+  */
+
+  if( session->loglevel >= 3 ) *(session->logfile) << "STK handler reached" << endl;
+
+  // Convert to lower case in order to do our string comparison
+  string argument = src;
+  transform( argument.begin(), argument.end(), argument.begin(), ::tolower );
+
+  size_t delimitter = argument.find( ":" );
+  string op = argument.substr( 0, delimitter );
+
+  enum reduction_type reduction = REDUCE_NONE;
+  if( op == "max" ) reduction = REDUCE_MAX;
+  else if( op == "min" ) reduction = REDUCE_MIN;
+  else if( op == "mean" ) reduction = REDUCE_MEAN;
+  else if( op == "sum" ) reduction = REDUCE_SUM;
+  else if( op == "ratio" ) reduction = REDUCE_RATIO;
+  else if( op == "nd" ) reduction = REDUCE_NDIFF;
+  else{
+    if( session->loglevel >= 1 ) *(session->logfile) << "STK :: Unsupported reduction: " << src << endl;
+    return;
+  }
+
+  // Ratios and normalized differences require a pair of bands
+  if( reduction == REDUCE_RATIO || reduction == REDUCE_NDIFF ){
+
+    int bands[2];
+    int i = 0;
+    if( delimitter != string::npos ){
+      Tokenizer izer( argument.substr( delimitter + 1 ), "," );
+      while( izer.hasMoreTokens() && i<2 ){
+	bands[i++] = atoi( izer.nextToken().c_str() );
+      }
+    }
+
+    if( i != 2 ){
+      if( session->loglevel >= 1 ) *(session->logfile) << "STK :: Reduction requires two bands: " << src << endl;
+      return;
+    }
+
+    session->view->reduction_bands[0] = bands[0];
+    session->view->reduction_bands[1] = bands[1];
+  }
+
+  session->view->reduction = reduction;
+
+  if( session->loglevel >= 3 ){
+    *(session->logfile) << "STK :: requested " << op << " reduction";
+    if( reduction == REDUCE_RATIO || reduction == REDUCE_NDIFF ){
+      *(session->logfile) << " of bands " << session->view->reduction_bands[0] << " and " << session->view->reduction_bands[1];
+    }
+    *(session->logfile) << endl;
+  }
+}
@@ -23,6 +23,7 @@
 
 
 #include <string>
+#include <vector>
 
 #include "IIPImage.h"
 #include "IIPResponse.h"
@@ -41,6 +42,13 @@
 #ifdef HAVE_WEBP
 #include "WebPCompressor.h"
 #endif
+#ifdef HAVE_ZLIB
+#include "TIFFCompressor.h"
+#endif
+
+
+class MetadataIndex;
+class AdmissionControl;
 
 
 // Define our http header cache max age (24 hours)
@@ -73,6 +81,9 @@ struct Session {
 #endif
 #ifdef HAVE_WEBP
   WebPCompressor* webp;
+#endif
+#ifdef HAVE_ZLIB
+  TIFFCompressor* tiff;
 #endif
   View* view;
   IIPResponse* response;
@@ -85,6 +96,11 @@ struct Session {
 
   imageCacheMapType *imageCache;
   Cache* tileCache;
+  Memcache* memcached;
+  AdmissionControl* admission;
+  bool overload;
+  Cancellation* cancellation;
+  unsigned int tileSize;
 
 #ifdef DEBUG
   FileWriter* out;
@@ -97,6 +113,20 @@ struct Session {
 
 
 
+/// Metadata of one of several images requested at once
+struct ImageEntry {
+  std::string path;           ///< Decoded image path
+  IIPImage image;             ///< Image metadata
+  std::string error;          ///< Error message if the image could not be opened
+  bool cached;                ///< Whether our metadata came from our metadata cache
+  bool resolved;              ///< Whether our metadata is complete and valid
+  bool update_index;          ///< Whether the image needs to be added to our metadata index
+  ImageEntry() : cached( false ), resolved( false ), update_index( false ) {};
+};
+
+
+
+
 /// Generic class to encapsulate various commands
 class Task {
 
@@ -127,6 +157,62 @@ class Task {
   /// Check image
   void checkImage();
 
+  /// Load optional image metadata on demand and store it in our metadata cache
+  void loadMetadata();
+
+  /// Calculate image statistics and histogram on first use and store them in our metadata cache and index
+  /** Floating point images without a sample range of their own are given the robust range of their statistics
+      @param tilemanager tile manager for our image
+   */
+  void loadStatistics( TileManager& tilemanager );
+
+  /// Reduce the bands of an image stack to a single tile or region using the reduction requested in our view
+  /** Each band is decoded in turn and accumulated into a floating point result, so only one band is held at a time
+      @param tilemanager tile manager for our image
+      @param resolution resolution number
+      @param tile tile number or -1 to reduce a region
+      @param x left offset of region with respect to full image
+      @param y top offset of region with respect to full image
+      @param w width of region
+      @param h height of region
+      @return floating point tile or region
+   */
+  RawTile reduceStack( TileManager& tilemanager, int resolution, int tile,
+		       unsigned int x = 0, unsigned int y = 0, unsigned int w = 0, unsigned int h = 0 );
+
+  /// Parse a comma-delimited list of URL-encoded image paths
+  /** Each distinct image is only listed once in our entries
+      @param list comma-delimited list of image paths
+      @param entries distinct images in the order in which they first appear
+      @param order index within our entries of each requested image in the order requested
+      @param max maximum number of distinct images
+   */
+  static void parseImageList( const std::string& list, std::vector<ImageEntry>& entries,
+			      std::vector<unsigned int>& order, unsigned int max );
+
+  /// Resolve the metadata of several images at once
+  /** Metadata is taken from our metadata cache or persistent metadata index where possible and the
+      remaining images are opened in parallel. Newly opened images are added to both. Images which
+      cannot be opened are given an error message rather than causing an exception to be thrown
+      @param entries images to resolve
+      @return number of images which could not be resolved
+   */
+  unsigned int resolveImages( std::vector<ImageEntry>& entries );
+
+  /// Escape a string for output within JSON, dropping any control characters
+  /** @param s string to escape
+      @return escaped string
+   */
+  static std::string escapeJSON( const std::string& s );
+
+  /// Get the tile size advertised and served by the IIIF, DeepZoom and Zoomify protocols
+  /** This is the configured served tile size if set or the native tile size of the image otherwise
+      @param session our current session
+      @param tw tile width
+      @param th tile height
+   */
+  static void getServedTileSize( Session* session, unsigned int& tw, unsigned int& th );
+
 };
 
 
@@ -222,12 +308,34 @@ class ROT : public Task {
 
 /// FIF Command
 class FIF : public Task {
+
+ private:
+  /// Try to load our image metadata from our persistent metadata index
+  /** @param session our current session
+      @param path image path
+      @param image IIPImage object to fill
+      @return whether the image was found in the index
+   */
+  bool loadFromIndex( Session* session, const std::string& path, IIPImage& image );
+
  public:
+  /// Create an image object of the appropriate type for the format of an initialised image
+  /** @param session our current session
+      @param image initialised IIPImage object
+      @param log whether to log the detected format
+      @return newly allocated image object, which the caller must delete
+   */
+  static IIPImage* createImage( Session* session, IIPImage& image, bool log );
+
   /// Store some necessary environment variables
   static long max_metadata_cache_size;
   static std::string filesystem_prefix;
   static std::string filesystem_suffix;
   static std::string filename_pattern;
+
+  /// Persistent metadata index or NULL if unused
+  static MetadataIndex* metadata_index;
+
   void run( Session* session, const std::string& argument );
 };
 
@@ -241,8 +349,19 @@ class JTL : public Task {
   /** @param session our current session
       @param resolution requested image resolution
       @param tile requested tile index
+      @param tw served tile width or 0 for the native tile size
+      @param th served tile height or 0 for the native tile size
    */
-  void send( Session* session, int resolution, int tile );
+  void send( Session* session, int resolution, int tile, unsigned int tw = 0, unsigned int th = 0 );
+
+ private:
+
+  /// Write an encoded tile to the client
+  /** @param session our current session
+      @param rawtile encoded tile
+      @param mimeType mime type of the tile encoding
+   */
+  void sendTile( Session* session, const RawTile& rawtile, const std::string& mimeType );
 };
 
 
@@ -268,6 +387,17 @@ public:
 };
 
 
+/// Deflate compressed TIFF Tile Command for full precision output
+class DTL : public JTL {
+public:
+  void run( Session* session, const std::string& argument ){
+    // Set our encoding format and call JTL::run
+    session->view->output_format = ImageEncoding::DEFLATE;
+    JTL::run( session, argument );
+  };
+};
+
+
 /// JPEG Tile Sequence Command
 class JTLS : public Task {
  public:
@@ -394,4 +524,25 @@ class CNV : public Task {
 };
 
 
+/// INFO Bulk Image Information Command
+class INFO : public Task {
+ public:
+  void run( Session* session, const std::string& argument );
+};
+
+
+/// SHEET Contact Sheet Command
+class SHEET : public Task {
+ public:
+  void run( Session* session, const std::string& argument );
+};
+
+
+/// STK Stack Reduction Command
+class STK : public Task {
+ public:
+  void run( Session* session, const std::string& argument );
+};
+
+
 #endif
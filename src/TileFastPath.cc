@@ -0,0 +1,150 @@
+/*
+    IIPImage Server - Fast path for cached tile requests
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#include "TileFastPath.h"
+#include <sys/stat.h>
+#include <sstream>
+
+
+using namespace std;
+
+
+// Initialize our static members
+const size_t TileFastPath::max_entries;
+int TileFastPath::interval = 0;
+list<TileFastPath::Entry> TileFastPath::entries;
+unordered_map<string,TileFastPath::EntryIterator> TileFastPath::index;
+
+
+
+void TileFastPath::record( Session* session, const RawTile& rawtile, const string& key, const string& mimeType ){
+
+  // Degraded tiles are not cached and only encoded tiles can be sent as they are
+  if( interval < 0 || session->overload || rawtile.compressionType == ImageEncoding::RAW ) return;
+
+  const string request = session->headers["QUERY_STRING"];
+  if( request.empty() ) return;
+
+  IIPImage* image = *session->image;
+
+  // Replace any existing entry for this request
+  unordered_map<string,EntryIterator>::iterator i = index.find( request );
+  if( i != index.end() ){
+    entries.erase( i->second );
+    index.erase( i );
+  }
+
+  Entry entry;
+  entry.request = request;
+  entry.file = image->getFileName( image->currentX, image->currentY );
+  entry.imageId = rawtile.imageId;
+  entry.resolution = rawtile.resolution;
+  entry.tile = rawtile.tileNum;
+  entry.xangle = rawtile.hSequence;
+  entry.yangle = rawtile.vSequence;
+  entry.ctype = rawtile.compressionType;
+  entry.quality = rawtile.quality;
+  entry.key = key;
+  entry.mimeType = mimeType;
+  entry.timestamp = image->timestamp;
+  entry.checked = time( NULL );
+
+  entries.push_front( entry );
+  index[request] = entries.begin();
+
+  // Evict the least recently used entry if we have too many
+  if( entries.size() > max_entries ){
+    index.erase( entries.back().request );
+    entries.pop_back();
+  }
+}
+
+
+
+bool TileFastPath::serve( Session* session, const string& request ){
+
+  if( interval < 0 ) return false;
+
+  unordered_map<string,EntryIterator>::iterator i = index.find( request );
+  if( i == index.end() ) return false;
+
+  EntryIterator e = i->second;
+
+
+  // Check whether our image has been modified since it was last checked
+  time_t now = time( NULL );
+  if( interval == 0 || now - e->checked >= interval ){
+    struct stat sb;
+    if( stat( e->file.c_str(), &sb ) != 0 || sb.st_mtime != e->timestamp ){
+      if( session->loglevel >= 2 ){
+	*(session->logfile) << "TileFastPath :: Image modified: discarding entry for " << e->file << endl;
+      }
+      entries.erase( e );
+      index.erase( i );
+      return false;
+    }
+    e->checked = now;
+  }
+
+
+  // The tile may since have been evicted from our tile cache
+  RawTile* rawtile = session->tileCache->getTile( e->imageId, e->resolution, e->tile, e->xangle, e->yangle,
+						  e->ctype, e->quality, e->key );
+  if( !rawtile || rawtile->timestamp != e->timestamp ) return false;
+
+  entries.splice( entries.begin(), entries, e );
+
+  int len = rawtile->dataLength;
+
+#ifndef DEBUG
+
+  // Send HTTP header with the same timestamp as would be given by our image
+  const time_t tm1 = e->timestamp;
+  tm *t = gmtime( &tm1 );
+  char strt[64];
+  strftime( strt, 64, "%a, %d %b %Y %H:%M:%S GMT", t );
+
+  stringstream header;
+  header << session->response->createHTTPHeader( e->mimeType, strt, len );
+  if( session->out->putStr( header.str().c_str(), (int) header.tellp() ) == -1 ){
+    if( session->loglevel >= 1 ){
+      *(session->logfile) << "TileFastPath :: Error writing HTTP header" << endl;
+    }
+  }
+
+#endif
+
+  if( session->out->putStr( static_cast<const char*>(rawtile->data), len ) != len ){
+    if( session->loglevel >= 1 ){
+      *(session->logfile) << "TileFastPath :: Error writing tile" << endl;
+    }
+  }
+
+  if( session->out->flush() == -1 ){
+    if( session->loglevel >= 1 ){
+      *(session->logfile) << "TileFastPath :: Error flushing tile" << endl;
+    }
+  }
+
+  session->response->setImageSent();
+
+  return true;
+}
@@ -0,0 +1,118 @@
+/*
+    IIPImage Server - Fast path for cached tile requests
+
+    Copyright (C) 2026 Ruven Pillay.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _TILEFASTPATH_H
+#define _TILEFASTPATH_H
+
+
+#include <ctime>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "Task.h"
+
+
+/// Status code thrown once a request has been answered by the fast path
+#define TILE_FAST_PATH_HIT 101
+
+
+
+/// Fast path answering repeated tile requests directly from the tile cache
+/** Every tile request normally passes through FIF, which constructs, initialises and opens the image, before
+    the tile is found in the tile cache. Once a JTL, IIIF, DeepZoom or Zoomify tile request has been answered,
+    the tile cache key of the tile that was sent is recorded against the request string, together with the
+    image file and its timestamp. A repeat of the same request can then be answered from the tile cache before
+    any command is run. The image file is checked for modification at most once every interval seconds and
+    the entry is discarded on any change. Requests whose entry or tile are not found take the normal path.
+ */
+class TileFastPath {
+
+ private:
+
+  /// The tile cache key and image details recorded for a request
+  struct Entry {
+    std::string request;
+    std::string file;
+    uint32_t imageId;
+    int resolution;
+    int tile;
+    int xangle;
+    int yangle;
+    ImageEncoding ctype;
+    int quality;
+    std::string key;
+    std::string mimeType;
+    time_t timestamp;
+    time_t checked;
+  };
+
+  typedef std::list<Entry>::iterator EntryIterator;
+
+  /// Maximum number of requests recorded
+  static const size_t max_entries = 10000;
+
+  /// Seconds between image modification checks: 0 checks every request and -1 disables the fast path
+  static int interval;
+
+  /// Entries in least recently used order, with the most recent at the front
+  static std::list<Entry> entries;
+
+  /// Index of entries by request string
+  static std::unordered_map<std::string,EntryIterator> index;
+
+
+ public:
+
+  /// Set the interval between image modification checks
+  /** @param seconds interval in seconds: 0 checks every request and -1 disables the fast path */
+  static void setInterval( int seconds ){ interval = seconds; };
+
+  /// Get the interval between image modification checks
+  static int getInterval(){ return interval; };
+
+  /// Whether the fast path is enabled
+  static bool isEnabled(){ return interval >= 0; };
+
+  /// Get the number of requests recorded
+  static size_t size(){ return entries.size(); };
+
+
+  /// Record the tile sent in response to a tile request
+  /** @param session our session, from which the request string and image are taken
+      @param rawtile the encoded tile that was sent
+      @param key the additional key with which the tile was inserted into the tile cache
+      @param mimeType mime type of the tile
+   */
+  static void record( Session* session, const RawTile& rawtile, const std::string& key, const std::string& mimeType );
+
+
+  /// Answer a request directly from the tile cache if possible
+  /** @param session our session
+      @param request the request string
+      @return whether the tile has been sent
+   */
+  static bool serve( Session* session, const std::string& request );
+
+};
+
+
+#endif
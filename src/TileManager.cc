@@ -25,6 +25,9 @@
 
 #include <cmath>
 #include "TileManager.h"
+#ifdef HAVE_MEMCACHED
+#include "Memcached.h"
+#endif
 
 
 using namespace std;
@@ -36,9 +39,28 @@ RawTile TileManager::getNewTile( int resolution, int tile, int xangle, int yangl
   // If user has overriden quality factor, decode to raw format to allow us to re-encode
   ImageEncoding source_encoding = (compressor->defaultQuality() == true) ? ctype : ImageEncoding::RAW;
 
-  // Get a tile from the IIPImage image object
+  // In overload mode decode only a quarter of the available quality layers. Prefer any pre-encoded
+  // tile over re-encoding. Such degraded tiles are cached separately under their own key
+  string degraded;
+  if( overload ){
+    if( source_encoding != ctype ){
+      source_encoding = ctype;
+      degraded = "overload";
+    }
+    if( image->quality_layers > 1 ){
+      int reduced = (image->quality_layers + 3) / 4;
+      if( layers <= 0 || layers > reduced ) layers = reduced;
+      degraded = "overload";
+      if( loglevel >= 3 ) *logfile << "TileManager :: Overload: decoding " << layers << " quality layers" << endl;
+    }
+  }
+
+  // Get a tile from the IIPImage image object. Tiles which are only to be re-encoded as JPEG can be
+  // decoded to YCbCr, but not if a watermark is to be applied to the pixel data
   if( loglevel >= 2 ) insert_timer.start();
+  image->ycbcr_output = ( ctype == ImageEncoding::JPEG ) && !( watermark && watermark->isSet() );
   RawTile ttt = image->getTile( xangle, yangle, resolution, layers, tile, source_encoding );
+  image->ycbcr_output = false;
   if( loglevel >= 2 ) *logfile << "TileManager :: Tile decoding time: " << insert_timer.getTime()
 			       << " microseconds" << endl;
 
@@ -54,12 +76,28 @@ RawTile TileManager::getNewTile( int resolution, int tile, int xangle, int yangl
   }
 
 
+  // Uniform tiles, such as those of background areas, are described by their colour and size. Identical
+  // tiles share a single copy of their data within our tile cache and their encodings are reused
+  string content;
+  const RawTile* encoded = NULL;
+  if( ttt.isUniform() ){
+    content = this->uniformContent( ttt, ctype );
+    if( ctype != ImageEncoding::RAW ) encoded = tileCache->getContent( content );
+    if( loglevel >= 4 ) *logfile << "TileManager :: Uniform tile detected: " << content << endl;
+  }
+
+
   // If our tile is already correctly encoded, no need to re-encode
   if( (ttt.compressionType == ctype) && (ctype != ImageEncoding::RAW) ){
      // Need to set quality to allow cache to sort correctly
      ttt.quality = compressor->getQuality();
      if( loglevel >= 3 ) *logfile << "TileManager :: Returning pre-encoded tile" << endl;
   }
+  // Reuse the encoding of an identical uniform tile
+  else if( encoded ){
+    this->reuseEncoding( ttt, *encoded );
+    if( loglevel >= 3 ) *logfile << "TileManager :: Reusing encoding of identical uniform tile" << endl;
+  }
   // Encode our tile
   else{
 
@@ -98,8 +136,11 @@ RawTile TileManager::getNewTile( int resolution, int tile, int xangle, int yangl
 
 
       case ImageEncoding::DEFLATE:
-	// No deflate for the time being ;-)
-	if( loglevel >= 4 ) *logfile << "TileManager :: DEFLATE compression requested: Not currently available" << endl;
+	// Deflate compressed TIFF at the native bit depth of our tile
+	if( loglevel >= 4 ) compression_timer.start();
+	compressor->Compress( ttt );
+	if( loglevel >= 4 ) *logfile << "TileManager :: DEFLATE compression time: "
+				     << compression_timer.getTime() << " microseconds" << endl;
 	break;
 
 
@@ -110,12 +151,14 @@ RawTile TileManager::getNewTile( int resolution, int tile, int xangle, int yangl
   }
 
 
-  // Add to our tile cache
+  // Add to our tile cache. Only share data that has been encoded as requested
   if( loglevel >= 4 ) insert_timer.start();
-  tileCache->insert( ttt );
+  tileCache->insert( ttt, degraded, (ttt.compressionType == ctype) ? content : string() );
   if( loglevel >= 4 ) *logfile << "TileManager :: Tile cache insertion time: " << insert_timer.getTime()
 			       << " microseconds" << endl;
 
+  // Share encoded tiles with other nodes and protocols
+  if( degraded.empty() ) this->storeShared( ttt );
 
   return ttt;
 
@@ -123,8 +166,180 @@ RawTile TileManager::getNewTile( int resolution, int tile, int xangle, int yangl
 
 
 
+bool TileManager::servedTiling( int resolution ) const {
+
+  if( served_width == 0 || served_height == 0 ) return false;
+  int vipsres = image->getNativeResolution( resolution );
+  return ( served_width != image->tile_widths[vipsres] || served_height != image->tile_heights[vipsres] );
+}
+
+
+
+string TileManager::uniformContent( const RawTile& tile, ImageEncoding ctype ) const {
+
+  // Describe our tile by its size, sample format and the value of its first pixel
+  char tmp[64];
+  snprintf( tmp, 64, "uniform:%ux%u:%d:%d:%d:%d:", tile.width, tile.height, tile.channels, tile.bpc,
+	    (int) tile.sampleType, (int) tile.ycbcr );
+  string content( tmp );
+
+  static const char hex[] = "0123456789abcdef";
+  const unsigned char* pixel = (const unsigned char*) tile.data;
+  for( int i = 0; i < tile.channels * (tile.bpc/8); i++ ){
+    content += hex[ pixel[i] >> 4 ];
+    content += hex[ pixel[i] & 0x0f ];
+  }
+
+  // Encodings are not shared between images as they may carry image-specific metadata such as ICC profiles.
+  // Include the timestamp of our image, so that those of an image modified in place are not reused
+  if( ctype != ImageEncoding::RAW ){
+    content += ":" + to_string( (int) ctype ) + ":" + to_string( compressor->getQuality() )
+      + ":" + to_string( image->getImageId() ) + ":" + to_string( (long long) image->timestamp );
+  }
+
+  return content;
+}
+
+
+
+void TileManager::reuseEncoding( RawTile& tile, const RawTile& encoded ) const {
+
+  // As for our compressors, only reallocate if our buffer is too small
+  if( encoded.dataLength > tile.capacity || !tile.memoryManaged ){
+    if( tile.memoryManaged ) tile.deallocate( tile.data );
+    tile.data = new unsigned char[encoded.dataLength];
+    tile.capacity = encoded.dataLength;
+    tile.memoryManaged = 1;
+  }
+  memcpy( tile.data, encoded.data, encoded.dataLength );
+  tile.dataLength = encoded.dataLength;
+  tile.compressionType = encoded.compressionType;
+  tile.quality = encoded.quality;
+  tile.ycbcr = false;
+}
+
+
+
+string TileManager::servedKey( int resolution ) const {
+
+  if( !this->servedTiling( resolution ) ) return string();
+  return "@" + to_string( served_width ) + "x" + to_string( served_height );
+}
+
+
+
 RawTile TileManager::getTile( int resolution, int tile, int xangle, int yangle, int layers, ImageEncoding ctype ){
 
+  if( this->servedTiling( resolution ) ) return this->getServedTile( resolution, tile, xangle, yangle, layers, ctype );
+  return this->getNativeTile( resolution, tile, xangle, yangle, layers, ctype );
+}
+
+
+
+RawTile TileManager::getServedTile( int resolution, int tile, int xangle, int yangle, int layers, ImageEncoding ctype ){
+
+  if( loglevel >= 3 ) tile_timer.start();
+
+  const string key = this->servedKey( resolution );
+  const int quality = (ctype == ImageEncoding::RAW) ? 0 : compressor->getQuality();
+
+  // Served tiles are only cached in encoded form - the native tiles from which they are built are cached in raw form
+  if( ctype != ImageEncoding::RAW ){
+
+    RawTile* cached = tileCache->getTile( image->getImageId(), resolution, tile, xangle, yangle, ctype, quality, key );
+    if( cached && cached->timestamp == image->timestamp ){
+      if( loglevel >= 3 ) *logfile << "TileManager :: Served tile cache hit for resolution: " << resolution
+				   << ", tile: " << tile << " in " << tile_timer.getTime() << " microseconds" << endl;
+      return RawTile( *cached );
+    }
+
+#ifdef HAVE_MEMCACHED
+    if( memcached ){
+      RawTile shared( tile, resolution, xangle, yangle );
+      shared.imageId = image->getImageId();
+      string index = Cache::getSharedIndex( image->getImagePath(), resolution, tile, xangle, yangle, ctype, quality, key );
+      if( memcached->retrieveTile( index, shared ) && (shared.timestamp == image->timestamp) ){
+	tileCache->insert( shared, key );
+	if( loglevel >= 3 ) *logfile << "TileManager :: Memcached served tile hit for resolution: " << resolution
+				     << ", tile: " << tile << " in " << tile_timer.getTime() << " microseconds" << endl;
+	return shared;
+      }
+    }
+#endif
+  }
+
+
+  // Locate our served tile within the image at this resolution
+  int vipsres = image->getNativeResolution( resolution );
+  unsigned int im_width = image->image_widths[vipsres];
+  unsigned int im_height = image->image_heights[vipsres];
+  unsigned int ntlx = (im_width / served_width) + (im_width % served_width == 0 ? 0 : 1);
+  unsigned int ntly = (im_height / served_height) + (im_height % served_height == 0 ? 0 : 1);
+
+  if( tile < 0 || (unsigned int) tile >= ntlx*ntly ){
+    throw string( "TileManager :: Invalid served tile number: " + to_string( tile ) );
+  }
+
+  unsigned int x = (tile % ntlx) * served_width;
+  unsigned int y = (tile / ntlx) * served_height;
+  unsigned int w = (x + served_width > im_width) ? im_width - x : served_width;
+  unsigned int h = (y + served_height > im_height) ? im_height - y : served_height;
+
+  if( loglevel >= 4 ) *logfile << "TileManager :: Assembling " << served_width << "x" << served_height
+			       << " served tile " << tile << " from region " << x << "," << y
+			       << " " << w << "x" << h << endl;
+
+  RawTile ttt = this->getRegion( resolution, xangle, yangle, layers, x, y, w, h );
+  ttt.tileNum = tile;
+  ttt.imageId = image->getImageId();
+  ttt.timestamp = image->timestamp;
+
+  // Regions decoded directly by the image have not passed through getNewTile() and are not yet watermarked
+  if( image->regionDecoding() && watermark && watermark->isSet() ){
+    watermark->apply( ttt.data, ttt.width, ttt.height, ttt.channels, ttt.bpc );
+  }
+
+  // Encode our tile. JPEG requires 8 bit data with 1 or 3 channels, whereas Deflate compressed TIFF
+  // keeps the full precision of our data
+  if( ( ctype == ImageEncoding::JPEG && ttt.bpc == 8 && (ttt.channels == 1 || ttt.channels == 3) ) ||
+      ctype == ImageEncoding::PNG || ctype == ImageEncoding::WEBP || ctype == ImageEncoding::DEFLATE ){
+
+    // Uniform served tiles reuse the encoding of any identical tile
+    string content;
+    const RawTile* encoded = NULL;
+    if( ttt.isUniform() ){
+      content = this->uniformContent( ttt, ctype );
+      encoded = tileCache->getContent( content );
+    }
+
+    if( encoded ){
+      this->reuseEncoding( ttt, *encoded );
+      if( loglevel >= 3 ) *logfile << "TileManager :: Reusing encoding of identical uniform served tile" << endl;
+    }
+    else{
+      if( loglevel >= 4 ) compression_timer.start();
+      compressor->Compress( ttt );
+      if( loglevel >= 4 ) *logfile << "TileManager :: Served tile compression time: "
+				   << compression_timer.getTime() << " microseconds" << endl;
+    }
+
+    // Tiles assembled from degraded native tiles in overload mode are neither cached nor shared
+    if( !overload ){
+      tileCache->insert( ttt, key, content );
+      this->storeShared( ttt, key );
+    }
+  }
+
+  if( loglevel >= 3 ) *logfile << "TileManager :: Total served tile access time: "
+			       << tile_timer.getTime() << " microseconds" << endl;
+
+  return ttt;
+}
+
+
+
+RawTile TileManager::getNativeTile( int resolution, int tile, int xangle, int yangle, int layers, ImageEncoding ctype ){
+
   RawTile* rawtile = NULL;
   string tileCompression;
   string compName;
@@ -134,6 +349,19 @@ RawTile TileManager::getTile( int resolution, int tile, int xangle, int yangle,
   if( loglevel >= 3 ) tile_timer.start();
 
 
+  // In overload mode, check first for a degraded tile of the requested type
+  if( overload && ( image->quality_layers > 1 || !compressor->defaultQuality() ) ){
+    rawtile = tileCache->getTile( image->getImageId(), resolution, tile, xangle, yangle, ctype,
+				  (ctype == ImageEncoding::RAW) ? 0 : compressor->getQuality(), "overload" );
+    if( rawtile && rawtile->timestamp == image->timestamp ){
+      if( loglevel >= 3 ) *logfile << "TileManager :: Degraded tile cache hit for resolution: " << resolution
+				   << ", tile: " << tile << endl;
+      return RawTile( *rawtile );
+    }
+    rawtile = NULL;
+  }
+
+
   /* Try to get the encoded tile directly from our cache first.
      Otherwise decode one from the source image and add it to the cache
    */
@@ -141,31 +369,39 @@ RawTile TileManager::getTile( int resolution, int tile, int xangle, int yangle,
     {
 
     case ImageEncoding::JPEG:
-      if( (rawtile = tileCache->getTile( image->getImagePath(), resolution, tile,
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
 					 xangle, yangle, ImageEncoding::JPEG, compressor->getQuality() )) ) break;
-      if( (rawtile = tileCache->getTile( image->getImagePath(), resolution, tile,
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
 					 xangle, yangle, ImageEncoding::RAW, 0 )) ) break;
       break;
 
 
     case ImageEncoding::PNG:
-      if( (rawtile = tileCache->getTile( image->getImagePath(), resolution, tile,
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
 					 xangle, yangle, ImageEncoding::PNG, compressor->getQuality() )) ) break;
-      if( (rawtile = tileCache->getTile( image->getImagePath(), resolution, tile,
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
 					 xangle, yangle, ImageEncoding::RAW, 0 )) ) break;
       break;
 
 
     case ImageEncoding::WEBP:
-      if( (rawtile = tileCache->getTile( image->getImagePath(), resolution, tile,
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
 					 xangle, yangle, ImageEncoding::WEBP, compressor->getQuality() )) ) break;
-      if( (rawtile = tileCache->getTile( image->getImagePath(), resolution, tile,
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
+					 xangle, yangle, ImageEncoding::RAW, 0 )) ) break;
+      break;
+
+
+    case ImageEncoding::DEFLATE:
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
+					 xangle, yangle, ImageEncoding::DEFLATE, compressor->getQuality() )) ) break;
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
 					 xangle, yangle, ImageEncoding::RAW, 0 )) ) break;
       break;
 
 
     case ImageEncoding::RAW:
-      if( (rawtile = tileCache->getTile( image->getImagePath(), resolution, tile,
+      if( (rawtile = tileCache->getTile( image->getImageId(), resolution, tile,
 					 xangle, yangle, ImageEncoding::RAW, 0 )) ) break;
       break;
 
@@ -207,6 +443,30 @@ RawTile TileManager::getTile( int resolution, int tile, int xangle, int yangle,
 				 << " tiles, " << tileCache->getMemorySize() << " MB" << endl;
 
 
+#ifdef HAVE_MEMCACHED
+    // Try our shared tile store before decoding from the source image. Only encoded tiles are shared
+    if( memcached && ctype != ImageEncoding::RAW ){
+
+      RawTile shared( tile, resolution, xangle, yangle );
+      shared.imageId = image->getImageId();
+      string key = Cache::getSharedIndex( image->getImagePath(), resolution, tile, xangle, yangle,
+					 ctype, compressor->getQuality() );
+
+      if( memcached->retrieveTile( key, shared ) && (shared.timestamp == image->timestamp) ){
+
+	if( loglevel >= 3 ) *logfile << "TileManager :: Memcached tile hit for resolution: " << resolution
+				     << ", tile: " << tile << ", " << shared.dataLength << " bytes" << endl;
+
+	// Add to our local cache
+	tileCache->insert( shared );
+
+	if( loglevel >= 3 ) *logfile << "TileManager :: Total tile access time: "
+				     << tile_timer.getTime() << " microseconds" << endl;
+	return shared;
+      }
+    }
+#endif
+
     RawTile newtile = this->getNewTile( resolution, tile, xangle, yangle, layers, ctype );
 
     if( loglevel >= 3 ) *logfile << "TileManager :: Total tile access time: "
@@ -228,10 +488,10 @@ RawTile TileManager::getTile( int resolution, int tile, int xangle, int yangle,
 
   // Check whether the compression used for out tile matches our requested compression type. If not, we must convert
   // Perform JPEG compression iff we have an 8 bit per channel image and either 1 or 3 bands
-  // PNG compression can have 8 or 16 bits and alpha channels
+  // PNG compression can have 8 or 16 bits and alpha channels and Deflate compressed TIFF any bit depth
   if( (rawtile->compressionType == ImageEncoding::RAW) &&
       ( ( ctype==ImageEncoding::JPEG && rawtile->bpc==8 && (rawtile->channels==1 || rawtile->channels==3) ) ||
-	ctype==ImageEncoding::PNG || ctype==ImageEncoding::WEBP ) ){
+	ctype==ImageEncoding::PNG || ctype==ImageEncoding::WEBP || ctype==ImageEncoding::DEFLATE ) ){
 
     // Rawtile is a pointer to the cache data, so we need to create a copy of it in case we compress it
     RawTile ttt( *rawtile );
@@ -251,6 +511,9 @@ RawTile TileManager::getTile( int resolution, int tile, int xangle, int yangle,
     if( loglevel >= 3 ) *logfile << "TileManager :: Tile cache insertion time: " << insert_timer.getTime()
 				 << " microseconds" << endl;
 
+    // Share this encoded tile with other nodes and protocols
+    this->storeShared( ttt );
+
     if( loglevel >= 3 ) *logfile << "TileManager :: Total tile access time: "
 				 << tile_timer.getTime() << " microseconds" << endl;
     return RawTile( ttt );
@@ -265,6 +528,123 @@ RawTile TileManager::getTile( int resolution, int tile, int xangle, int yangle,
 }
 
 
+unsigned int TileManager::prefetch( int resolution, const vector<int>& tiles, int xangle, int yangle, ImageEncoding ctype ){
+
+  unsigned int found = 0;
+
+#ifdef HAVE_MEMCACHED
+  if( !memcached || ctype == ImageEncoding::RAW || tiles.empty() ) return 0;
+
+  if( loglevel >= 3 ) tile_timer.start();
+
+  // Only request tiles that we do not already have locally
+  vector<string> keys;
+  vector<RawTile> shared;
+  for( vector<int>::const_iterator t = tiles.begin(); t != tiles.end(); t++ ){
+    RawTile* rawtile = tileCache->getTile( image->getImageId(), resolution, *t, xangle, yangle,
+					   ctype, compressor->getQuality() );
+    if( rawtile && rawtile->timestamp == image->timestamp ) continue;
+
+    RawTile tile( *t, resolution, xangle, yangle );
+    tile.imageId = image->getImageId();
+    keys.push_back( Cache::getSharedIndex( image->getImagePath(), resolution, *t, xangle, yangle,
+					  ctype, compressor->getQuality() ) );
+    shared.push_back( tile );
+  }
+
+  if( keys.empty() ) return 0;
+
+  memcached->retrieveTiles( keys, shared );
+
+  // Add valid tiles to our local cache
+  for( vector<RawTile>::iterator t = shared.begin(); t != shared.end(); t++ ){
+    if( t->dataLength > 0 && t->timestamp == image->timestamp ){
+      tileCache->insert( *t );
+      found++;
+    }
+  }
+
+  if( loglevel >= 3 ) *logfile << "TileManager :: Memcached batch lookup of " << keys.size() << " tiles: "
+			       << found << " found in " << tile_timer.getTime() << " microseconds" << endl;
+#endif
+
+  return found;
+}
+
+
+
+bool TileManager::getProcessedTile( int resolution, int tile, int xangle, int yangle, ImageEncoding ctype,
+				    const string& p, RawTile& rawtile ){
+
+  if( loglevel >= 3 ) tile_timer.start();
+
+  // Processed tiles from a served tiling are distinguished by the served tile size
+  const string key = p + this->servedKey( resolution );
+
+  RawTile* cached = tileCache->getTile( image->getImageId(), resolution, tile, xangle, yangle,
+					ctype, compressor->getQuality(), key );
+  if( cached && cached->timestamp == image->timestamp ){
+    rawtile = *cached;
+    if( loglevel >= 3 ) *logfile << "TileManager :: Processed tile cache hit for resolution: " << resolution
+				 << ", tile: " << tile << " in " << tile_timer.getTime() << " microseconds" << endl;
+    return true;
+  }
+
+#ifdef HAVE_MEMCACHED
+  if( memcached ){
+    RawTile shared( tile, resolution, xangle, yangle );
+    shared.imageId = image->getImageId();
+    string index = Cache::getSharedIndex( image->getImagePath(), resolution, tile, xangle, yangle,
+					 ctype, compressor->getQuality(), key );
+
+    if( memcached->retrieveTile( index, shared ) && (shared.timestamp == image->timestamp) ){
+      tileCache->insert( shared, key );
+      rawtile = shared;
+      if( loglevel >= 3 ) *logfile << "TileManager :: Memcached processed tile hit for resolution: " << resolution
+				   << ", tile: " << tile << " in " << tile_timer.getTime() << " microseconds" << endl;
+      return true;
+    }
+  }
+#endif
+
+  return false;
+}
+
+
+
+void TileManager::storeProcessedTile( const RawTile& tile, const string& p ){
+
+  if( tile.compressionType == ImageEncoding::RAW ) return;
+
+  const string key = p + this->servedKey( tile.resolution );
+
+  if( loglevel >= 4 ) insert_timer.start();
+  tileCache->insert( tile, key );
+  if( loglevel >= 4 ) *logfile << "TileManager :: Processed tile cache insertion time: " << insert_timer.getTime()
+			       << " microseconds" << endl;
+
+  this->storeShared( tile, key );
+}
+
+
+
+void TileManager::storeShared( const RawTile& tile, const string& p ){
+
+#ifdef HAVE_MEMCACHED
+  if( !memcached || tile.compressionType == ImageEncoding::RAW ) return;
+
+  if( loglevel >= 4 ) insert_timer.start();
+  string key = Cache::getSharedIndex( image->getImagePath(), tile.resolution, tile.tileNum,
+				     tile.hSequence, tile.vSequence, tile.compressionType, tile.quality, p );
+  memcached->storeTile( key, tile );
+  if( loglevel >= 4 ) *logfile << "TileManager :: Memcached tile insertion time: " << insert_timer.getTime()
+			       << " microseconds" << endl;
+#endif
+
+}
+
+
+
 RawTile TileManager::getRegion( unsigned int res, int seq, int ang, int layers, unsigned int x, unsigned int y, unsigned int width, unsigned int height ){
 
   // If our image type can directly handle region compositing, simply return that
@@ -344,11 +724,14 @@ RawTile TileManager::getRegion( unsigned int res, int seq, int ang, int layers,
 
     for( unsigned int j=startx; j<endx; j++ ){
 
+      // Stop if our client has gone away
+      if( cancellation ) cancellation->check();
+
       // Time the tile retrieval
       if( loglevel >= 3 ) tile_timer.start();
 
       // Get a raw tile
-      RawTile rawtile = this->getTile( res, (i*ntlx) + j, seq, ang, layers, ImageEncoding::RAW );
+      RawTile rawtile = this->getNativeTile( res, (i*ntlx) + j, seq, ang, layers, ImageEncoding::RAW );
 
       if( loglevel >= 5 ){
 	*logfile << "TileManager getRegion :: Tile access time " << tile_timer.getTime() << " microseconds for tile "
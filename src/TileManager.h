@@ -37,6 +37,10 @@
 #include "Timer.h"
 #include "Watermark.h"
 #include "Logger.h"
+#include "Cancellation.h"
+#include <vector>
+
+class Memcache;
 
 
 /// Class to manage access to the tile cache
@@ -51,7 +55,11 @@ class TileManager{
   IIPImage* image;
   Watermark* watermark;
   Logger* logfile;
+  Memcache* memcached;
   int loglevel;
+  bool overload;
+  Cancellation* cancellation;
+  unsigned int served_width, served_height;
   Timer compression_timer, tile_timer, insert_timer;
 
   /// Get a new tile from the image file
@@ -70,6 +78,61 @@ class TileManager{
   RawTile getNewTile( int resolution, int tile, int xangle, int yangle, int layers, ImageEncoding e );
 
 
+  /// Get a tile in the native tiling of the image from the cache or image file
+  /**
+   *  @param resolution resolution number
+   *  @param tile tile number
+   *  @param xangle horizontal sequence number
+   *  @param yangle vertical sequence number
+   *  @param layers number of quality layers within image to decode
+   *  @param c Compression
+   *  @return RawTile
+   */
+  RawTile getNativeTile( int resolution, int tile, int xangle, int yangle, int layers, ImageEncoding c );
+
+
+  /// Get a tile in our served tiling, assembled from or cut out of native tiles
+  /**
+   *  Native tiles are cached in raw form by getRegion() and the assembled tiles are cached
+   *  in encoded form under a key including the served tile size.
+   *  @param resolution resolution number
+   *  @param tile served tile number
+   *  @param xangle horizontal sequence number
+   *  @param yangle vertical sequence number
+   *  @param layers number of quality layers within image to decode
+   *  @param c Compression
+   *  @return RawTile
+   */
+  RawTile getServedTile( int resolution, int tile, int xangle, int yangle, int layers, ImageEncoding c );
+
+
+  /// Whether tiles at a given resolution are served in a tiling that differs from the native tiling
+  /** @param resolution resolution number */
+  bool servedTiling( int resolution ) const;
+
+
+  /// Return the content key describing a uniform tile by its colour and size
+  /** @param tile uncompressed tile whose pixels all have the same value
+      @param c encoding for which the key is required
+      @return content key
+   */
+  std::string uniformContent( const RawTile& tile, ImageEncoding c ) const;
+
+
+  /// Replace the data of an uncompressed tile with an existing encoding of identical content
+  /** @param tile uncompressed tile
+      @param encoded encoded tile
+   */
+  void reuseEncoding( RawTile& tile, const RawTile& encoded ) const;
+
+
+  /// Store an encoded tile in our shared memcached tile store if one is available
+  /** @param tile encoded tile
+      @param p processing key for processed tiles
+   */
+  void storeShared( const RawTile& tile, const std::string& p = std::string() );
+
+
  public:
 
 
@@ -81,23 +144,60 @@ class TileManager{
    * @param c  pointer to Compressor object
    * @param s  pointer to Logger object
    * @param l  logging level
+   * @param m  pointer to shared Memcache tile store or NULL if unused
    */
-  TileManager( Cache* tc, IIPImage* im, Watermark* w, Compressor* c, Logger* s, int l ){
+  TileManager( Cache* tc, IIPImage* im, Watermark* w, Compressor* c, Logger* s, int l, Memcache* m = NULL ){
     tileCache = tc; 
     image = im;
     watermark = w;
     compressor = c;
     logfile = s ;
     loglevel = l;
+    memcached = m;
+    overload = false;
+    cancellation = NULL;
+    served_width = served_height = 0;
   };
 
 
 
+  /// Set overload mode
+  /**
+   *  In overload mode, fewer quality layers are decoded from images with multiple quality layers.
+   *  Such degraded tiles are cached separately from full quality tiles and are not shared
+   *  via memcached. Full quality tiles already in the cache continue to be used.
+   *  @param o whether to use overload mode
+   */
+  void setOverload( bool o ){ overload = o; };
+
+
+
+  /// Set the cancellation token of the current request
+  /**
+   *  The token is checked between tiles when compositing regions, so that decoding stops
+   *  once the client has disconnected.
+   *  @param c cancellation token or NULL
+   */
+  void setCancellation( Cancellation* c ){ cancellation = c; };
+
+
+
+  /// Set the size of the tiles to be served
+  /**
+   *  Tile numbers passed to getTile() then refer to a grid of tiles of this size rather than to
+   *  the native tiles of the image. Such tiles are assembled from or cut out of native tiles.
+   *  @param w served tile width or 0 for the native tile size
+   *  @param h served tile height or 0 for the native tile size
+   */
+  void setTileSize( unsigned int w, unsigned int h ){ served_width = w; served_height = h; };
+
+
+
   /// Get a tile from the cache
   /**
    *  If the encoded tile already exists in the cache, use that, otherwise check for
    *  an uncompressed tile. If that does not exist either, extract a tile from the
-   *  image.
+   *  image. If a served tile size has been set, the tile is taken from the served tiling.
    *  @param resolution resolution number
    *  @param tile tile number
    *  @param xangle horizontal sequence number
@@ -110,6 +210,55 @@ class TileManager{
 
 
 
+  /// Pre-load a set of encoded tiles from our shared memcached tile store
+  /**
+   *  Tiles which are not already in the local tile cache are requested from memcached in a
+   *  single batched lookup and inserted into the local cache. Subsequent calls to getTile() for
+   *  these tiles will then be local cache hits. Does nothing if no shared tile store is available.
+   *  @param resolution resolution number
+   *  @param tiles list of tile numbers
+   *  @param xangle horizontal sequence number
+   *  @param yangle vertical sequence number
+   *  @param c Compression
+   *  @return number of tiles loaded
+   */
+  unsigned int prefetch( int resolution, const std::vector<int>& tiles, int xangle, int yangle, ImageEncoding c );
+
+
+
+  /// Get an encoded tile to which image processing has already been applied
+  /**
+   *  Processed tiles are stored under a key that includes the processing parameters of the view.
+   *  The local tile cache is checked first, followed by our shared memcached tile store.
+   *  @param resolution resolution number
+   *  @param tile tile number
+   *  @param xangle horizontal sequence number
+   *  @param yangle vertical sequence number
+   *  @param c Compression
+   *  @param p processing key
+   *  @param rawtile tile to fill
+   *  @return whether an up to date processed tile was found
+   */
+  bool getProcessedTile( int resolution, int tile, int xangle, int yangle, ImageEncoding c,
+			 const std::string& p, RawTile& rawtile );
+
+
+
+  /// Store an encoded tile to which image processing has been applied
+  /**
+   *  @param tile encoded tile
+   *  @param p processing key
+   */
+  void storeProcessedTile( const RawTile& tile, const std::string& p );
+
+
+
+  /// Return the cache key suffix for served tiles or an empty string for native tiles
+  /** @param resolution resolution number */
+  std::string servedKey( int resolution ) const;
+
+
+
   /// Generate a complete region
   /**
    *  Build up an arbitrary region by extracting tiles from the cache by using getTile function.
@@ -498,7 +498,8 @@ void Transform::interpolate_nearestneighbour( RawTile& in, unsigned int resample
   // Pointer to input buffer
   unsigned char *input = (unsigned char*) in.data;
 
-  int channels = in.channels;
+  // Pixels are copied byte by byte, so this works for any bit depth
+  int channels = in.channels * ( (in.bpc > 8) ? in.bpc/8 : 1 );
   unsigned int width = in.width;
   unsigned int height = in.height;
 
@@ -509,7 +510,7 @@ void Transform::interpolate_nearestneighbour( RawTile& in, unsigned int resample
   bool new_buffer = false;
   if( resampled_width*resampled_height > in.width*in.height ){
     new_buffer = true;
-    output = new unsigned char[(uint32_t)resampled_width*resampled_height*in.channels];
+    output = new unsigned char[(uint32_t)resampled_width*resampled_height*channels];
   }
   else output = (unsigned char*) in.data;
 
@@ -527,7 +528,7 @@ void Transform::interpolate_nearestneighbour( RawTile& in, unsigned int resample
       uint32_t pyramid_index = (uint32_t) channels * ( ii + jj*width );
 
       uint32_t resampled_index = (uint32_t)(i + j*resampled_width)*channels;
-      for( uint32_t k=0; k<(uint32_t)in.channels; k++ ){
+      for( uint32_t k=0; k<(uint32_t)channels; k++ ){
 	output[resampled_index+k] = input[pyramid_index+k];
       }
     }
@@ -539,7 +540,7 @@ void Transform::interpolate_nearestneighbour( RawTile& in, unsigned int resample
   // Correctly set our Rawtile info
   in.width = resampled_width;
   in.height = resampled_height;
-  in.dataLength = (uint32_t) resampled_width * resampled_height * channels * (in.bpc/8);
+  in.dataLength = (uint32_t) resampled_width * resampled_height * channels;
   in.capacity = in.dataLength;
   in.data = output;
 }
@@ -874,72 +875,212 @@ void Transform::greyscale( RawTile& rawtile ){
 // values as there are channels in the raw input data
 void Transform::twist( RawTile& rawtile, const vector< vector<float> >& matrix ){
 
-  uint32_t np = (uint32_t) rawtile.width * rawtile.height;
+  const uint32_t np = (uint32_t) rawtile.width * rawtile.height;
+  const int nc = rawtile.channels;
 
   // Determine the number of rows and, therefore, output channels (this can be different to the number of input channels)
-  int output_channels = matrix.size();
+  const int oc = matrix.size();
+
+  // Pack the non-zero coefficients of each row into contiguous arrays together with their input channels,
+  // ignoring any columns beyond the number of channels in the raw data. Rows start at the given offsets
+  vector<int> offsets( oc+1, 0 );
+  vector<int> columns;
+  vector<float> coefficients;
+  for( int k=0; k<oc; k++ ){
+    int ncols = std::min( (int) matrix[k].size(), nc );
+    for( int j=0; j<ncols; j++ ){
+      if( matrix[k][j] != 0.0f ){
+	columns.push_back( j );
+	coefficients.push_back( matrix[k][j] );
+      }
+    }
+    offsets[k+1] = columns.size();
+  }
+
+  const float* input = (const float*) rawtile.data;
+  float* output = new float[(size_t) np * oc];
+
+  // Process blocks of pixels so that the input for each block remains in cache while each output channel is
+  // calculated. Within a block each coefficient is applied to all pixels in turn, which the compiler can vectorize
+  const uint32_t block = 1024;
+  const int nblocks = (int)( (np + block - 1) / block );
+
+#if defined(__ICC) || defined(__INTEL_COMPILER)
+#pragma ivdep
+#elif defined(_OPENMP)
+#pragma omp parallel for if( np > PARALLEL_THRESHOLD )
+#endif
+  for( int b=0; b<nblocks; b++ ){
 
-  // Output buffer
-  float *output = NULL;
+    const uint32_t start = (uint32_t) b * block;
+    const uint32_t end = std::min( start + block, np );
 
-  // If we are creating an image with different number of output channels, create a new data buffer
-  if( output_channels == rawtile.channels ) output = (float*) rawtile.data;
-  else output = new float[np * output_channels];
+    for( int k=0; k<oc; k++ ){
 
-  // Need to make sure the matrix is adapted to the number of channels in the raw data
-  unsigned int* row_sizes = new unsigned int[output_channels]; // Number of columns for each row
+      // Rows without any coefficients produce an empty channel
+      if( offsets[k] == offsets[k+1] ){
+	for( uint32_t i=start; i<end; i++ ) output[(size_t)i*oc + k] = 0.0f;
+	continue;
+      }
+
+      // Initialise with our first coefficient and accumulate the remainder in column order
+      float m = coefficients[offsets[k]];
+      int j = columns[offsets[k]];
+      for( uint32_t i=start; i<end; i++ ) output[(size_t)i*oc + k] = input[(size_t)i*nc + j] * m;
 
-  // Get the number of columns in each row - can be less than number of channels - limit if there are more
-  for( int k=0; k<output_channels; k++ ){
-    row_sizes[k] = (matrix[k].size()>(unsigned int)rawtile.channels) ? rawtile.channels : matrix[k].size();
+      for( int c=offsets[k]+1; c<offsets[k+1]; c++ ){
+	m = coefficients[c];
+	j = columns[c];
+	for( uint32_t i=start; i<end; i++ ) output[(size_t)i*oc + k] += input[(size_t)i*nc + j] * m;
+      }
+    }
   }
 
-#pragma omp parallel if( rawtile.width*rawtile.height > PARALLEL_THRESHOLD )
-  {
-    // Create temporary buffer for our calculated values (need one for each thread)
-    float* pixel = new float[output_channels];
+  // Swap our buffer and update our rawtile parameters
+  delete[] (float*) rawtile.data;
+  rawtile.data = output;
+  rawtile.channels = oc;
+  rawtile.dataLength = (uint32_t) np * rawtile.channels * (rawtile.bpc/8);
+  rawtile.capacity = rawtile.dataLength;
+
+}
+
 
-    // Loop through each pixel
-#pragma omp for
-    for( uint32_t i=0; i<np; i++ ){
 
-      uint32_t in = (uint32_t) i*rawtile.channels;  // Pixel index in input buffer
-      uint32_t on = (uint32_t) i*output_channels;   // Pixel index in output buffer
+// Compact the bands of an image in place. Each retained band moves to the same or a lower
+// position, so no sample is overwritten before it has been read
+template <class T> static void compact( T* data, uint32_t np, int nc, const vector<int>& bands ){
+  const int nb = bands.size();
+  for( uint32_t i=0; i<np; i++ ){
+    for( int k=0; k<nb; k++ ) data[(size_t)i*nb + k] = data[(size_t)i*nc + bands[k]];
+  }
+}
 
-      // Calculate pixel value for each output channel
-      for( int k=0; k<output_channels; k++ ){
 
-	// First zero our pixel buffer
-	pixel[k] = 0.0f;
 
-	// Loop through each column (input channel coefficient ) in the matrix
-	for( unsigned int j=0; j<row_sizes[k]; j++ ){
-	  float m = matrix[k][j];
-	  if( m ){
-	    float p = ((float*)rawtile.data)[in+j];
-	    pixel[k] += (m == 1.0) ? p : p * m;
-	  }
-	}
+// Remove those bands not used by a colour twist so that they are neither normalised nor processed
+void Transform::twistBands( RawTile& in, vector< vector<float> >& ctw, vector<float>& min, vector<float>& max ){
+
+  // Find the input bands with a non-zero weight in any row of our matrix
+  vector<int> bands;
+  for( int j=0; j<in.channels; j++ ){
+    for( unsigned int k=0; k<ctw.size(); k++ ){
+      if( (unsigned int) j < ctw[k].size() && ctw[k][j] != 0.0f ){
+	bands.push_back( j );
+	break;
       }
+    }
+  }
+
+  if( bands.size() == (size_t) in.channels ) return;
+  if( bands.empty() ) bands.push_back( 0 );
 
-      // Only write out to our buffer at the end as we reuse channel values several times during the twist loops
-      for( int k=0; k<output_channels; k++ ) output[on++] = pixel[k];
+  uint32_t np = (uint32_t) in.width * in.height;
+  if( in.bpc == 32 && in.sampleType == SampleType::FLOATINGPOINT ) compact( (float*) in.data, np, in.channels, bands );
+  else if( in.bpc == 32 ) compact( (unsigned int*) in.data, np, in.channels, bands );
+  else if( in.bpc == 16 ) compact( (unsigned short*) in.data, np, in.channels, bands );
+  else compact( (unsigned char*) in.data, np, in.channels, bands );
+
+  in.channels = bands.size();
+  in.dataLength = (uint32_t) np * in.channels * (in.bpc/8);
+
+  // Remap the columns of our matrix and our ranges to the remaining bands
+  for( unsigned int k=0; k<ctw.size(); k++ ){
+    vector<float> row;
+    for( unsigned int b=0; b<bands.size(); b++ ){
+      row.push_back( ( (unsigned int) bands[b] < ctw[k].size() ) ? ctw[k][bands[b]] : 0.0f );
     }
+    ctw[k] = row;
+  }
 
-    delete[] pixel;
+  vector<float> rmin, rmax;
+  for( unsigned int b=0; b<bands.size(); b++ ){
+    if( !min.empty() ) rmin.push_back( min[ std::min( (size_t) bands[b], min.size()-1 ) ] );
+    if( !max.empty() ) rmax.push_back( max[ std::min( (size_t) bands[b], max.size()-1 ) ] );
   }
+  min = rmin;
+  max = rmax;
+}
+
+
 
-  delete[] row_sizes;
+// Combine a stack band of a given type with our floating point output
+template <class T> static void combine( float* out, const T* in, size_t n, enum reduction_type op, unsigned int count ){
 
-  // If we have a different number of output channels, swap our buffer and update our rawtile parameters
-  if( output_channels != rawtile.channels ){
-    delete[] (float*) rawtile.data;
-    rawtile.data = output;
-    rawtile.channels = output_channels;
-    rawtile.dataLength = (uint32_t) np * rawtile.channels * (rawtile.bpc/8);
-    rawtile.capacity = rawtile.dataLength;
+  const float weight = 1.0f / (count + 1);
+
+#if defined(__ICC) || defined(__INTEL_COMPILER)
+#pragma ivdep
+#elif defined(_OPENMP)
+#pragma omp parallel for if( n > PARALLEL_THRESHOLD )
+#endif
+  for( int64_t i=0; i<(int64_t)n; i++ ){
+    const float v = (float) in[i];
+    const float o = out[i];
+    switch( op ){
+      case REDUCE_MAX: out[i] = (v > o) ? v : o; break;
+      case REDUCE_MIN: out[i] = (v < o) ? v : o; break;
+      case REDUCE_MEAN: out[i] = o + (v - o) * weight; break;
+      case REDUCE_SUM: out[i] = o + v; break;
+      case REDUCE_RATIO: out[i] = (v != 0.0f) ? o / v : 0.0f; break;
+      case REDUCE_NDIFF: out[i] = (o + v != 0.0f) ? (o - v) / (o + v) : 0.0f; break;
+      default: out[i] = v;
+    }
   }
+}
 
+
+
+// Accumulate a band of an image stack into a stack reduction
+void Transform::reduce( RawTile& out, const RawTile& in, enum reduction_type op, unsigned int n ){
+
+  const size_t np = (size_t) in.width * in.height * in.channels;
+
+  // Initialise our output with the dimensions of our first band
+  if( n == 0 ){
+    if( out.memoryManaged ) out.deallocate( out.data );
+    out.tileNum = in.tileNum;
+    out.resolution = in.resolution;
+    out.hSequence = in.hSequence;
+    out.vSequence = in.vSequence;
+    out.imageId = in.imageId;
+    out.timestamp = in.timestamp;
+    out.width = in.width;
+    out.height = in.height;
+    out.channels = in.channels;
+    out.bpc = 32;
+    out.sampleType = SampleType::FLOATINGPOINT;
+    out.compressionType = ImageEncoding::RAW;
+    out.allocate();
+    out.dataLength = (uint32_t)( np * sizeof(float) );
+  }
+  else if( in.width != out.width || in.height != out.height || in.channels != out.channels ){
+    throw string( "Transform :: stack bands have differing dimensions and cannot be reduced" );
+  }
+
+  // The first band is simply converted, so use a copy operation
+  if( n == 0 ) op = REDUCE_NONE;
+
+  float* o = (float*) out.data;
+  if( in.bpc == 32 && in.sampleType == SampleType::FLOATINGPOINT ) combine( o, (const float*) in.data, np, op, n );
+  else if( in.bpc == 32 ) combine( o, (const unsigned int*) in.data, np, op, n );
+  else if( in.bpc == 16 ) combine( o, (const unsigned short*) in.data, np, op, n );
+  else combine( o, (const unsigned char*) in.data, np, op, n );
+}
+
+
+
+// Get the natural range of a stack reduction
+void Transform::reductionRange( enum reduction_type op, unsigned int bands, vector<float>& min, vector<float>& max ){
+
+  for( unsigned int k=0; k<min.size() && k<max.size(); k++ ){
+    switch( op ){
+      case REDUCE_SUM: min[k] *= bands; max[k] *= bands; break;
+      case REDUCE_RATIO: min[k] = 0.0f; max[k] = 2.0f; break;
+      case REDUCE_NDIFF: min[k] = -1.0f; max[k] = 1.0f; break;
+      default: break;
+    }
+  }
 }
 
 
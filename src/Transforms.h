@@ -34,6 +34,7 @@ inline double round(double r) { return (r > 0.0) ? floor(r + 0.5) : ceil(r - 0.5
 
 enum interpolation { NEAREST, BILINEAR, CUBIC, LANCZOS2, LANCZOS3 };
 enum cmap_type { HOT, COLD, JET, BLUE, GREEN, RED };
+enum reduction_type { REDUCE_NONE, REDUCE_MAX, REDUCE_MIN, REDUCE_MEAN, REDUCE_SUM, REDUCE_RATIO, REDUCE_NDIFF };
 
 
 /// Image Processing Transforms
@@ -113,7 +114,7 @@ struct Transform {
   void log( RawTile& in );
 
 
-  /// Resize image using nearest neighbour interpolation
+  /// Resize image using nearest neighbour interpolation for data of any bit depth
   /** @param in tile input data
       @param w target width
       @param h target height
@@ -149,6 +150,40 @@ struct Transform {
   void twist( RawTile& in, const std::vector< std::vector<float> >& ctw );
 
 
+  /// Remove the bands not used by a colour twist
+  /** Bands with a zero weight in every row of the matrix are removed before normalisation so that they are neither
+      converted nor processed. The columns of the matrix and the per-band ranges are remapped to the remaining bands
+      @param in input image
+      @param ctw 2D color twist matrix
+      @param min per-band minima
+      @param max per-band maxima
+  */
+  void twistBands( RawTile& in, std::vector< std::vector<float> >& ctw, std::vector<float>& min, std::vector<float>& max );
+
+
+  /// Accumulate a band of an image stack into a stack reduction
+  /** The first band initialises our output as a floating point copy of the input. Each subsequent band is combined
+      with the output sample by sample: maximum, minimum, running mean or sum. For a ratio or normalized difference,
+      the second band gives the denominator or subtracted band respectively
+      @param out floating point output tile
+      @param in stack band of any bit depth with the same dimensions as our output
+      @param op reduction operation
+      @param n index of this band within the reduction starting from 0
+  */
+  void reduce( RawTile& out, const RawTile& in, enum reduction_type op, unsigned int n );
+
+
+  /// Get the natural range of a stack reduction for normalization
+  /** Maximum, minimum and mean keep the range of the input bands, a sum scales this by the number of
+      bands, a normalized difference lies between -1 and 1 and a ratio is mapped from 0 to 2
+      @param op reduction operation
+      @param bands number of bands in the reduction
+      @param min per-band minima of the input, replaced with the minima of the output
+      @param max per-band maxima of the input, replaced with the maxima of the output
+  */
+  void reductionRange( enum reduction_type op, unsigned int bands, std::vector<float>& min, std::vector<float>& max );
+
+
   /// Extract bands
   /** @param in input image
       @param bands number of bands
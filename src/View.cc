@@ -20,6 +20,8 @@
 
 #include "View.h"
 #include <cmath>
+#include <cstdio>
+#include <sstream>
 using namespace std;
 
 
@@ -276,3 +278,43 @@ int View::getLayers(){
 
   return layers;
 }
+
+
+
+/// Return a compact key identifying our processing parameters
+string View::getProcessingKey( const vector<float>& min, const vector<float>& max ){
+
+  // Serialize every parameter that affects the output of the processing pipeline
+  ostringstream params;
+  params.precision( 9 );
+  params << contrast << ';' << gamma << ';' << (int) colorspace << ';' << inverted << ';'
+	 << cmapped << ',' << (int) cmap << ';' << shaded << ',' << shade[0] << ',' << shade[1] << ';'
+	 << rotation << ';' << flip << ';' << equalization << ';' << minmax << ';' << embedICC() << ';'
+	 << (int) reduction << ',' << reduction_bands[0] << ',' << reduction_bands[1] << ';'
+	 << getLayers() << ';';
+
+  // The ranges set by MINMAX replace those of our image
+  if( minmax ){
+    for( unsigned int i = 0; i < min.size(); i++ ) params << min[i] << ',';
+    params << ';';
+    for( unsigned int i = 0; i < max.size(); i++ ) params << max[i] << ',';
+    params << ';';
+  }
+  for( unsigned int i = 0; i < ctw.size(); i++ ){
+    for( unsigned int j = 0; j < ctw[i].size(); j++ ) params << ctw[i][j] << ',';
+    params << ';';
+  }
+  for( unsigned int i = 0; i < convolution.size(); i++ ) params << convolution[i] << ',';
+
+  // 64 bit FNV-1a hash
+  const string p = params.str();
+  unsigned long long hash = 14695981039346656037ULL;
+  for( unsigned int i = 0; i < p.length(); i++ ){
+    hash ^= (unsigned char) p[i];
+    hash *= 1099511628211ULL;
+  }
+
+  char key[17];
+  snprintf( key, 17, "%016llx", hash );
+  return string( key );
+}
@@ -25,6 +25,7 @@
 
 #include <cstddef>
 #include <vector>
+#include <string>
 
 #include "Transforms.h"
 
@@ -83,6 +84,8 @@ class View{
   std::vector<float> convolution;             /// Convolution matrix
   bool equalization;                          /// Whether to perform histogram equalization
   bool minmax;                                /// Whether to perform contrast stretching using user-defined min/max
+  enum reduction_type reduction;              /// Reduction to apply across the bands of an image stack
+  int reduction_bands[2];                     /// Stack bands used by ratio and normalized difference reductions
 
 
   /// Constructor
@@ -106,6 +109,7 @@ class View{
     output_format = ImageEncoding::JPEG;
     equalization = false;
     minmax = false;
+    reduction = REDUCE_NONE; reduction_bands[0] = 0; reduction_bands[1] = 0;
   };
 
 
@@ -273,7 +277,8 @@ class View{
 
   /// Whether view requires floating point processing
   bool floatProcessing(){
-    if( contrast != 1.0 || gamma != 1.0 || cmapped || shaded || inverted || minmax || ctw.size() || convolution.size() ){
+    if( contrast != 1.0 || gamma != 1.0 || cmapped || shaded || inverted || minmax || ctw.size() || convolution.size()
+	|| reduction != REDUCE_NONE ){
       return true;
     }
     else return false;
@@ -285,6 +290,14 @@ class View{
     else return false;
   }
 
+  /// Return a compact key identifying the image processing requested for this view
+  /** Used to cache tiles to which processing has been applied
+      @param min per-band minimum values of our image, used for contrast stretching with MINMAX
+      @param max per-band maximum values of our image, used for contrast stretching with MINMAX
+      @return hexadecimal hash of the processing parameters
+   */
+  std::string getProcessingKey( const std::vector<float>& min, const std::vector<float>& max );
+
 };
 
 
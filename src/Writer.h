@@ -31,6 +31,7 @@
 
 #include <cstdio>
 #include <cstring>
+#include "Cancellation.h"
 
 
 /// Virtual base class for various writers
@@ -70,6 +71,15 @@ class FCGIWriter {
   FCGX_Stream *out;
   static const unsigned int bufsize = 65536;
 
+  /// Cancellation token for the current request, marked if writing to the client fails
+  Cancellation *cancellation;
+
+  /// Mark our request as cancelled on write errors
+  int status( int r ){
+    if( r < 0 && cancellation ) cancellation->cancel();
+    return r;
+  };
+
   /// Add the message to our buffer
   void cpy2buf( const char* msg, size_t len ){
     if( sz+len > bufsize ) buffer = (char*) realloc( buffer, sz+len );
@@ -86,8 +96,12 @@ class FCGIWriter {
   size_t sz;
 
   /// Constructor
-  FCGIWriter( FCGX_Stream* o ){
+  /** @param o FCGI output stream
+      @param c optional cancellation token for the current request
+   */
+  FCGIWriter( FCGX_Stream* o, Cancellation* c = NULL ){
     out = o;
+    cancellation = c;
     buffer = (char*) malloc(bufsize);
     sz = 0;
   };
@@ -97,20 +111,20 @@ class FCGIWriter {
 
   int putStr( const char* msg, int len ){
     cpy2buf( msg, len );
-    return FCGX_PutStr( msg, len, out );
+    return status( FCGX_PutStr( msg, len, out ) );
   };
   int putS( const char* msg ){
     int len = (int) strlen( msg );
     cpy2buf( msg, len );
-    if( FCGX_PutStr( msg, len, out ) != len ) return -1;
+    if( FCGX_PutStr( msg, len, out ) != len ) return status( -1 );
     return len;
   }
   int printf( const char* msg ){
     cpy2buf( msg, strlen(msg) );
-    return FCGX_FPrintF( out, msg );
+    return status( FCGX_FPrintF( out, msg ) );
   };
   int flush(){
-    return FCGX_FFlush( out );
+    return status( FCGX_FFlush( out ) );
   };
 
 };
@@ -65,7 +65,8 @@ void Zoomify::run( Session* session, const std::string& argument ){
   unsigned int height = (*session->image)->getImageHeight();
 
 
-  int tw = (*session->image)->getTileWidth();
+  unsigned int tw, th;
+  getServedTileSize( session, tw, th );
   unsigned int numResolutions = (*session->image)->getNumResolutions();
 
 
@@ -79,8 +80,8 @@ void Zoomify::run( Session* session, const std::string& argument ){
   unsigned int ntiles = 1;
 
   for( n=0; n<numResolutions; n++ ){
-    int width = (*session->image)->image_widths[n];
-    int height = (*session->image)->image_heights[n];
+    unsigned int width = (*session->image)->image_widths[n];
+    unsigned int height = (*session->image)->image_heights[n];
     if( width < tw && height < tw ){
       discard++;
     } else {
@@ -155,7 +156,7 @@ void Zoomify::run( Session* session, const std::string& argument ){
 
   // Simply pass this on to our JTL send command
   JTL jtl;
-  jtl.send( session, resolution, tile );
+  jtl.send( session, resolution, tile, tw, th );
 
 
   // Total Zoomify response time